@@ -0,0 +1,595 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <optional>
+#include <functional>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#if defined(__linux__)
+#include <sys/ptrace.h>
+#endif
+
+#ifndef FSC_BENCH_EXECUTABLE
+#define FSC_BENCH_EXECUTABLE "fsc"
+#endif
+
+namespace
+{
+    struct Options
+    {
+        std::filesystem::path root{ std::filesystem::temp_directory_path() / "fsc_bench" };
+        std::string fscExecutable{ FSC_BENCH_EXECUTABLE };
+        std::string output;
+        std::uint64_t seed{ 0x5eed };
+        std::uint64_t scale{ 1 };
+        bool countSyscalls{ false };
+        bool baselines{ true };
+        std::vector<std::string> profiles;
+    };
+
+    struct Measurement
+    {
+        double wallSeconds{ 0.0 };
+        double userSeconds{ 0.0 };
+        double systemSeconds{ 0.0 };
+        long peakRssKib{ 0 };
+        std::optional<std::uint64_t> syscalls;
+        int exitStatus{ 0 };
+        std::string error;
+    };
+
+    struct Result
+    {
+        std::string profile;
+        std::string operation;
+        std::string tool;
+        std::string command;
+        Measurement measurement;
+    };
+
+    // splitmix64, so generated trees are identical across standard libraries.
+    class Random
+    {
+    public:
+
+        explicit Random(std::uint64_t seed) noexcept : state{ seed } {}
+
+        std::uint64_t Next() noexcept
+        {
+            std::uint64_t value{ state += 0x9e3779b97f4a7c15ull };
+            value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+            value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+            return value ^ (value >> 31);
+        }
+
+        std::uint64_t Below(std::uint64_t bound) noexcept
+        {
+            return bound == 0 ? 0 : Next() % bound;
+        }
+
+    private:
+
+        std::uint64_t state;
+
+    };
+
+    std::uint64_t HashName(const std::string& name) noexcept
+    {
+        std::uint64_t hash{ 14695981039346656037ull };
+        for (char character : name)
+        {
+            hash ^= static_cast<unsigned char>(character);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    void WriteRandomFile(const std::filesystem::path& path, std::uint64_t size, Random& random)
+    {
+        int descriptor{ open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) };
+        if (descriptor < 0)
+        {
+            throw std::runtime_error{ "Failed to create \"" + path.string() + "\": " + std::strerror(errno) };
+        }
+        std::vector<std::uint64_t> block(static_cast<std::size_t>(std::min<std::uint64_t>(size / sizeof(std::uint64_t) + 1, 1 << 17)));
+        while (size > 0)
+        {
+            std::size_t chunk{ static_cast<std::size_t>(std::min<std::uint64_t>(size, block.size() * sizeof(std::uint64_t))) };
+            for (std::size_t word{ 0 }; word < chunk / sizeof(std::uint64_t) + 1 && word < block.size(); ++word)
+            {
+                block[word] = random.Next();
+            }
+            if (write(descriptor, block.data(), chunk) != static_cast<ssize_t>(chunk))
+            {
+                close(descriptor);
+                throw std::runtime_error{ "Failed to write \"" + path.string() + "\"." };
+            }
+            size -= chunk;
+        }
+        close(descriptor);
+    }
+
+    void WriteSparseFile(const std::filesystem::path& path, std::uint64_t size, std::uint64_t stride, Random& random)
+    {
+        int descriptor{ open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) };
+        if (descriptor < 0 || ftruncate(descriptor, static_cast<off_t>(size)) != 0)
+        {
+            throw std::runtime_error{ "Failed to create \"" + path.string() + "\"." };
+        }
+        std::vector<std::uint64_t> block(512);
+        for (std::uint64_t offset{ 0 }; offset < size; offset += stride)
+        {
+            for (std::uint64_t& word : block)
+            {
+                word = random.Next();
+            }
+            std::size_t chunk{ static_cast<std::size_t>(std::min<std::uint64_t>(size - offset, block.size() * sizeof(std::uint64_t))) };
+            if (pwrite(descriptor, block.data(), chunk, static_cast<off_t>(offset)) != static_cast<ssize_t>(chunk))
+            {
+                close(descriptor);
+                throw std::runtime_error{ "Failed to write \"" + path.string() + "\"." };
+            }
+        }
+        close(descriptor);
+    }
+
+    struct Profile
+    {
+        std::string name;
+        std::function<std::filesystem::path(const std::filesystem::path&, std::uint64_t, Random&)> generate;
+    };
+
+    // Each generator builds the tree under "<root>/<name>" and returns the file used by the read benchmark.
+    std::vector<Profile> GetProfiles()
+    {
+        return {
+            Profile{ "tiny_files", [](const std::filesystem::path& tree, std::uint64_t scale, Random& random)
+            {
+                for (std::uint64_t directory{ 0 }; directory < 100; ++directory)
+                {
+                    std::filesystem::path directoryPath{ tree / ("d" + std::to_string(directory)) };
+                    std::filesystem::create_directories(directoryPath);
+                    for (std::uint64_t file{ 0 }; file < 100 * scale; ++file)
+                    {
+                        WriteRandomFile(directoryPath / ("f" + std::to_string(file)), random.Below(4096), random);
+                    }
+                }
+                return tree / "d0" / "f0";
+            } },
+            Profile{ "deep_narrow", [](const std::filesystem::path& tree, std::uint64_t scale, Random& random)
+            {
+                std::filesystem::path directoryPath{ tree };
+                for (std::uint64_t depth{ 0 }; depth < 128 * scale; ++depth)
+                {
+                    directoryPath /= "n";
+                    std::filesystem::create_directories(directoryPath);
+                    WriteRandomFile(directoryPath / "a", random.Below(8192), random);
+                    WriteRandomFile(directoryPath / "b", random.Below(8192), random);
+                }
+                return directoryPath / "a";
+            } },
+            Profile{ "wide_flat", [](const std::filesystem::path& tree, std::uint64_t scale, Random& random)
+            {
+                std::filesystem::create_directories(tree);
+                for (std::uint64_t file{ 0 }; file < 20000 * scale; ++file)
+                {
+                    WriteRandomFile(tree / ("entry_" + std::to_string(file)), random.Below(512), random);
+                }
+                return tree / "entry_0";
+            } },
+            Profile{ "huge_files", [](const std::filesystem::path& tree, std::uint64_t scale, Random& random)
+            {
+                std::filesystem::create_directories(tree);
+                for (std::uint64_t file{ 0 }; file < 2; ++file)
+                {
+                    WriteRandomFile(tree / ("huge_" + std::to_string(file)), (std::uint64_t{ 128 } << 20) * scale, random);
+                }
+                return tree / "huge_0";
+            } },
+            Profile{ "sparse_files", [](const std::filesystem::path& tree, std::uint64_t scale, Random& random)
+            {
+                std::filesystem::create_directories(tree);
+                for (std::uint64_t file{ 0 }; file < 4; ++file)
+                {
+                    WriteSparseFile(tree / ("sparse_" + std::to_string(file)), (std::uint64_t{ 1 } << 30) * scale, std::uint64_t{ 64 } << 20, random);
+                }
+                return tree / "sparse_0";
+            } },
+            Profile{ "hardlink_farm", [](const std::filesystem::path& tree, std::uint64_t scale, Random& random)
+            {
+                std::filesystem::create_directories(tree / "sources");
+                for (std::uint64_t file{ 0 }; file < 200 * scale; ++file)
+                {
+                    std::filesystem::path source{ tree / "sources" / ("s" + std::to_string(file)) };
+                    WriteRandomFile(source, random.Below(16384), random);
+                    std::filesystem::path linkDirectory{ tree / ("links" + std::to_string(file % 10)) };
+                    std::filesystem::create_directories(linkDirectory);
+                    for (std::uint64_t link{ 0 }; link < 20; ++link)
+                    {
+                        std::filesystem::create_hard_link(source, linkDirectory / ("l" + std::to_string(file) + "_" + std::to_string(link)));
+                    }
+                }
+                return tree / "sources" / "s0";
+            } },
+        };
+    }
+
+    double ToSeconds(const timeval& time) noexcept
+    {
+        return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_usec) / 1e6;
+    }
+
+#if defined(__linux__)
+    // Counts syscall stops of the child and every thread or process it creates; each syscall stops twice.
+    std::optional<std::uint64_t> TraceChild(pid_t child, int& status, rusage& usage)
+    {
+        if (waitpid(child, &status, 0) != child || !WIFSTOPPED(status))
+        {
+            return std::nullopt;
+        }
+        long options{ PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_EXITKILL };
+        ptrace(PTRACE_SETOPTIONS, child, nullptr, reinterpret_cast<void*>(options));
+        ptrace(PTRACE_SYSCALL, child, nullptr, nullptr);
+
+        std::uint64_t stops{ 0 };
+        while (true)
+        {
+            int traceStatus;
+            rusage traceUsage{};
+            pid_t pid{ wait4(-1, &traceStatus, __WALL, &traceUsage) };
+            if (pid < 0)
+            {
+                break;
+            }
+            if (WIFEXITED(traceStatus) || WIFSIGNALED(traceStatus))
+            {
+                if (pid == child)
+                {
+                    status = traceStatus;
+                    usage = traceUsage;
+                    break;
+                }
+                continue;
+            }
+            int deliverSignal{ 0 };
+            if (WSTOPSIG(traceStatus) == (SIGTRAP | 0x80))
+            {
+                stops += 1;
+            }
+            else if ((traceStatus >> 16) == 0 && WSTOPSIG(traceStatus) != SIGSTOP && WSTOPSIG(traceStatus) != SIGTRAP)
+            {
+                deliverSignal = WSTOPSIG(traceStatus);
+            }
+            ptrace(PTRACE_SYSCALL, pid, nullptr, reinterpret_cast<void*>(static_cast<long>(deliverSignal)));
+        }
+        return (stops + 1) / 2;
+    }
+#endif
+
+    // fsc reports errors on standard error and still exits with 0, so the first line of it is kept in the report.
+    Measurement Run(const std::vector<std::string>& command, bool countSyscalls, const std::filesystem::path& errorFile)
+    {
+        sync();
+        std::vector<char*> argv;
+        for (const std::string& argument : command)
+        {
+            argv.push_back(const_cast<char*>(argument.c_str()));
+        }
+        argv.push_back(nullptr);
+
+        auto start{ std::chrono::steady_clock::now() };
+        pid_t child{ fork() };
+        if (child < 0)
+        {
+            throw std::runtime_error{ "fork failed: " + std::string{ std::strerror(errno) } };
+        }
+        if (child == 0)
+        {
+            int devNull{ open("/dev/null", O_RDWR) };
+            dup2(devNull, STDIN_FILENO);
+            dup2(devNull, STDOUT_FILENO);
+            int errorDescriptor{ open(errorFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) };
+            if (errorDescriptor >= 0)
+            {
+                dup2(errorDescriptor, STDERR_FILENO);
+            }
+#if defined(__linux__)
+            if (countSyscalls)
+            {
+                ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+            }
+#endif
+            execvp(argv[0], argv.data());
+            _exit(127);
+        }
+
+        Measurement measurement;
+        int status{ 0 };
+        rusage usage{};
+#if defined(__linux__)
+        if (countSyscalls)
+        {
+            measurement.syscalls = TraceChild(child, status, usage);
+        }
+        else
+#endif
+        {
+            wait4(child, &status, 0, &usage);
+        }
+        auto end{ std::chrono::steady_clock::now() };
+
+        measurement.wallSeconds = std::chrono::duration<double>(end - start).count();
+        measurement.userSeconds = ToSeconds(usage.ru_utime);
+        measurement.systemSeconds = ToSeconds(usage.ru_stime);
+        measurement.peakRssKib = usage.ru_maxrss;
+        measurement.exitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        std::ifstream errorStream{ errorFile };
+        std::getline(errorStream, measurement.error);
+        return measurement;
+    }
+
+    std::string FilesystemName(const std::filesystem::path& path)
+    {
+        struct statfs information{};
+        if (statfs(path.c_str(), &information) != 0)
+        {
+            return "unknown";
+        }
+        switch (static_cast<unsigned long>(information.f_type))
+        {
+        case 0x01021994ul: return "tmpfs";
+        case 0xEF53ul: return "ext4";
+        case 0x58465342ul: return "xfs";
+        case 0x9123683Eul: return "btrfs";
+        default:
+        {
+            std::ostringstream name;
+            name << "0x" << std::hex << static_cast<unsigned long>(information.f_type);
+            return name.str();
+        }
+        }
+    }
+
+    std::string EscapeJson(const std::string& text)
+    {
+        std::string escaped;
+        for (char character : text)
+        {
+            if (character == '"' || character == '\\')
+            {
+                escaped += '\\';
+            }
+            if (static_cast<unsigned char>(character) < 0x20)
+            {
+                escaped += ' ';
+                continue;
+            }
+            escaped += character;
+        }
+        return escaped;
+    }
+
+    void WriteJson(std::ostream& stream, const Options& options, const std::vector<Result>& results)
+    {
+        stream << "{\n";
+        stream << "  \"seed\": " << options.seed << ",\n";
+        stream << "  \"scale\": " << options.scale << ",\n";
+        stream << "  \"root\": \"" << EscapeJson(options.root.string()) << "\",\n";
+        stream << "  \"filesystem\": \"" << FilesystemName(options.root) << "\",\n";
+        stream << "  \"syscalls_traced\": " << (options.countSyscalls ? "true" : "false") << ",\n";
+        stream << "  \"results\": [\n";
+        for (std::size_t i{ 0 }; i < results.size(); ++i)
+        {
+            const Result& result{ results[i] };
+            const Measurement& measurement{ result.measurement };
+            stream << "    { \"profile\": \"" << result.profile << "\", \"operation\": \"" << result.operation
+                << "\", \"tool\": \"" << result.tool << "\", \"command\": \"" << EscapeJson(result.command)
+                << "\", \"wall_seconds\": " << measurement.wallSeconds
+                << ", \"user_seconds\": " << measurement.userSeconds
+                << ", \"system_seconds\": " << measurement.systemSeconds
+                << ", \"cpu_seconds\": " << measurement.userSeconds + measurement.systemSeconds
+                << ", \"peak_rss_kib\": " << measurement.peakRssKib
+                << ", \"syscalls\": ";
+            if (measurement.syscalls)
+            {
+                stream << *measurement.syscalls;
+            }
+            else
+            {
+                stream << "null";
+            }
+            stream << ", \"exit_status\": " << measurement.exitStatus << ", \"error\": ";
+            if (measurement.error.empty())
+            {
+                stream << "null";
+            }
+            else
+            {
+                stream << "\"" << EscapeJson(measurement.error) << "\"";
+            }
+            stream << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        stream << "  ]\n";
+        stream << "}\n";
+    }
+
+    struct Tool
+    {
+        std::string name;
+        std::function<std::vector<std::string>(const std::filesystem::path&)> list;
+        std::function<std::vector<std::string>(const std::filesystem::path&)> read;
+        std::function<std::vector<std::string>(const std::filesystem::path&, const std::filesystem::path&)> clone;
+        std::function<std::vector<std::string>(const std::filesystem::path&, const std::filesystem::path&)> move;
+        std::function<std::vector<std::string>(const std::filesystem::path&)> remove;
+    };
+
+    std::vector<Tool> GetTools(const Options& options)
+    {
+        std::string fsc{ options.fscExecutable };
+        std::vector<Tool> tools{
+            Tool{
+                "fsc",
+                [fsc](const std::filesystem::path& tree) { return std::vector<std::string>{ fsc, "list", tree.string(), "-r" }; },
+                [fsc](const std::filesystem::path& file) { return std::vector<std::string>{ fsc, "read", file.string() }; },
+                [fsc](const std::filesystem::path& target, const std::filesystem::path& destination) { return std::vector<std::string>{ fsc, "clone", target.string(), destination.string(), "-o", "-s" }; },
+                [fsc](const std::filesystem::path& target, const std::filesystem::path& destination) { return std::vector<std::string>{ fsc, "move", target.string(), destination.string(), "-o", "-s" }; },
+                [fsc](const std::filesystem::path& tree) { return std::vector<std::string>{ fsc, "delete", tree.string(), "-r", "-s" }; },
+            },
+        };
+        if (options.baselines)
+        {
+            tools.push_back(Tool{
+                "coreutils",
+                [](const std::filesystem::path& tree) { return std::vector<std::string>{ "ls", "-R", tree.string() }; },
+                [](const std::filesystem::path& file) { return std::vector<std::string>{ "cat", file.string() }; },
+                [](const std::filesystem::path& target, const std::filesystem::path& destination) { return std::vector<std::string>{ "cp", "-r", target.string(), destination.string() + "/" }; },
+                [](const std::filesystem::path& target, const std::filesystem::path& destination) { return std::vector<std::string>{ "mv", target.string(), destination.string() + "/" }; },
+                [](const std::filesystem::path& tree) { return std::vector<std::string>{ "rm", "-rf", tree.string() }; },
+            });
+        }
+        return tools;
+    }
+
+    std::string JoinCommand(const std::vector<std::string>& command)
+    {
+        std::string joined;
+        for (const std::string& argument : command)
+        {
+            joined += (joined.empty() ? "" : " ") + argument;
+        }
+        return joined;
+    }
+
+    void PrintUsage()
+    {
+        std::cout <<
+            "Usage: fsc_bench [options]\n"
+            "  --root <dir>       Directory to generate trees in, e.g. a tmpfs or loopback mount.\n"
+            "  --fsc <path>       fsc executable to benchmark.\n"
+            "  --output <file>    Write the JSON report to a file instead of standard output.\n"
+            "  --seed <n>         Seed of the synthetic tree generator.\n"
+            "  --scale <n>        Multiplies the size of every generated tree.\n"
+            "  --profile <name>   Only run the given profile, may be repeated.\n"
+            "  --syscalls         Count syscalls with ptrace, this inflates wall time.\n"
+            "  --no-baselines     Skip the coreutils baselines.\n";
+    }
+
+    Options ParseOptions(int argc, char* argv[])
+    {
+        Options options;
+        for (int i{ 1 }; i < argc; ++i)
+        {
+            std::string argument{ argv[i] };
+            auto Value = [&]()
+            {
+                if (i + 1 >= argc)
+                {
+                    throw std::runtime_error{ "Option \"" + argument + "\" requires a value." };
+                }
+                return std::string{ argv[++i] };
+            };
+
+            if (argument == "--root") { options.root = Value(); }
+            else if (argument == "--fsc") { options.fscExecutable = Value(); }
+            else if (argument == "--output") { options.output = Value(); }
+            else if (argument == "--seed") { options.seed = std::stoull(Value()); }
+            else if (argument == "--scale") { options.scale = std::max<std::uint64_t>(1, std::stoull(Value())); }
+            else if (argument == "--profile") { options.profiles.push_back(Value()); }
+            else if (argument == "--syscalls") { options.countSyscalls = true; }
+            else if (argument == "--no-baselines") { options.baselines = false; }
+            else if (argument == "--help") { PrintUsage(); std::exit(0); }
+            else
+            {
+                throw std::runtime_error{ "Unknown option \"" + argument + "\", see \"--help\"." };
+            }
+        }
+        return options;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        Options options{ ParseOptions(argc, argv) };
+        std::filesystem::create_directories(options.root);
+        options.root = std::filesystem::canonical(options.root);
+
+        std::vector<Result> results;
+        for (const Profile& profile : GetProfiles())
+        {
+            if (!options.profiles.empty() && std::find(options.profiles.begin(), options.profiles.end(), profile.name) == options.profiles.end())
+            {
+                continue;
+            }
+
+            std::filesystem::path workspace{ options.root / profile.name };
+            std::filesystem::remove_all(workspace);
+            std::filesystem::path tree{ workspace / "tree" };
+            Random random{ options.seed ^ HashName(profile.name) };
+            std::cerr << "Generating " << profile.name << "..." << std::endl;
+            std::filesystem::path readFile{ profile.generate(tree, options.scale, random) };
+
+            for (const Tool& tool : GetTools(options))
+            {
+                std::filesystem::path cloneDestination{ workspace / ("clone_" + tool.name) };
+                std::filesystem::path moveDestination{ workspace / ("move_" + tool.name) };
+                std::filesystem::create_directories(cloneDestination);
+                std::filesystem::create_directories(moveDestination);
+
+                auto Measure = [&](const std::string& operation, const std::vector<std::string>& command)
+                {
+                    std::cerr << "  " << tool.name << " " << operation << std::endl;
+                    results.push_back(Result{ profile.name, operation, tool.name, JoinCommand(command), Run(command, options.countSyscalls, workspace / "stderr.txt") });
+                };
+
+                Measure("list", tool.list(tree));
+                Measure("read", tool.read(readFile));
+                Measure("clone", tool.clone(tree, cloneDestination));
+                Measure("move", tool.move(cloneDestination / "tree", moveDestination));
+                Measure("delete", tool.remove(moveDestination / "tree"));
+
+                std::filesystem::remove_all(cloneDestination);
+                std::filesystem::remove_all(moveDestination);
+            }
+            std::filesystem::remove_all(workspace);
+        }
+
+        if (options.output.empty())
+        {
+            WriteJson(std::cout, options, results);
+        }
+        else
+        {
+            std::ofstream file{ options.output };
+            if (!file)
+            {
+                throw std::runtime_error{ "Failed to open \"" + options.output + "\"." };
+            }
+            WriteJson(file, options, results);
+        }
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
\ No newline at end of file
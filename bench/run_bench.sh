@@ -0,0 +1,41 @@
+#!/bin/sh
+# Runs fsc_bench on a tmpfs and on a loopback mounted ext4 image so results do not depend on the host's disks.
+# Requires root for mounting. Usage: run_bench.sh <fsc_bench> <output directory> [fsc_bench options...]
+set -eu
+
+if [ "$#" -lt 2 ]; then
+    echo "Usage: $0 <fsc_bench> <output directory> [fsc_bench options...]" >&2
+    exit 1
+fi
+if [ "$(id -u)" -ne 0 ]; then
+    echo "Mounting tmpfs and loopback images requires root." >&2
+    exit 1
+fi
+
+BENCH="$(realpath "$1")"
+OUTPUT="$(realpath -m "$2")"
+shift 2
+
+WORK="$(mktemp -d)"
+IMAGE="$WORK/bench.img"
+cleanup()
+{
+    umount "$WORK/tmpfs" 2>/dev/null || true
+    umount "$WORK/loop" 2>/dev/null || true
+    rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+mkdir -p "$OUTPUT" "$WORK/tmpfs" "$WORK/loop"
+
+mount -t tmpfs -o size="${FSC_BENCH_TMPFS_SIZE:-8G}" fsc_bench "$WORK/tmpfs"
+"$BENCH" --root "$WORK/tmpfs" --output "$OUTPUT/tmpfs.json" "$@"
+umount "$WORK/tmpfs"
+
+truncate -s "${FSC_BENCH_IMAGE_SIZE:-8G}" "$IMAGE"
+mkfs.ext4 -q -F "$IMAGE"
+mount -o loop "$IMAGE" "$WORK/loop"
+"$BENCH" --root "$WORK/loop" --output "$OUTPUT/loop.json" "$@"
+umount "$WORK/loop"
+
+echo "Results written to $OUTPUT/tmpfs.json and $OUTPUT/loop.json"
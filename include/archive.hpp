@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+#include "path_layer.hpp"
+
+// Streaming POSIX ustar archives with pax extended headers for long names and large files. Pack writes to standard output
+// and unpack reads from standard input, so trees can be piped between hosts without temporary files.
+namespace fsc_archive
+{
+    struct PackResult
+    {
+        std::uint64_t entries{ 0 };
+        std::uint64_t bytes{ 0 };
+    };
+
+    struct UnpackOptions
+    {
+        bool overwrite{ false };
+    };
+
+    PackResult Pack(const fsc_path::ResolvedPath& source);
+    PackResult Unpack(const fsc_path::ResolvedPath& destination, const UnpackOptions& options);
+}
@@ -1,29 +1,93 @@
 #pragma once
 
-#include <string>
+#include <array>
+#include <span>
 #include <vector>
-#include <unordered_map>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
 
 struct CommandStructure;
+struct Flag;
 class CommandList;
 
+// Every flag of every command and the global flags, the parser keeps one bit per flag so callers test flags without
+// comparing names. A command's flag table lists the ids it accepts.
+enum class FlagId : std::uint8_t
+{
+    FILES,
+    DIRECTORY,
+    NO_GUARDS,
+    RECURSIVE,
+    SILENT,
+    CONTENTS,
+    SORTED,
+    OVERWRITE,
+    DEBOUNCE,
+    STATS,
+    TRACE,
+    BWLIMIT,
+    IOPS_LIMIT,
+    IONICE,
+    LATENCY_TARGET,
+    BLOCK_SIZE,
+    LARGE_FILE_THRESHOLD,
+    DIRECT_IO,
+    IO_BACKEND,
+    EXCLUDE,
+    EXCLUDE_FROM,
+    RESPECT_GITIGNORE,
+    COUNT,
+};
+
+inline constexpr std::size_t flagCount{ static_cast<std::size_t>(FlagId::COUNT) };
+
+inline constexpr std::array<std::string_view, flagCount> flagNames{
+    "-f", "-d", "-n", "-r", "-s", "-c", "-S", "-o", "--debounce",
+    "--stats", "--trace", "--bwlimit", "--iops-limit", "--ionice", "--latency-target", "--block-size",
+    "--large-file-threshold", "--direct-io", "--io-backend", "--exclude", "--exclude-from", "--respect-gitignore",
+};
+
+constexpr std::string_view GetFlagName(FlagId flag) noexcept
+{
+    return flagNames[static_cast<std::size_t>(flag)];
+}
+
 class ArgumentParser
 {
 public:
 
+    static constexpr std::size_t maxParameters{ 4 };
+
     ArgumentParser(int argc, char* argv[], const CommandList& commandList);
 
-    std::string GetCommand() const noexcept;
-    bool HasArgument(const std::string& parameterName) const noexcept;
-    std::string GetArgument(const std::string& parameterName) const noexcept;
-    bool HasFlag(const std::string& flagName) const noexcept;
+    std::string_view GetCommand() const noexcept;
+    const CommandStructure& GetCommandStructure() const noexcept;
+    bool HasArgument(std::string_view parameterName) const noexcept;
+    std::string_view GetArgument(std::string_view parameterName) const noexcept;
+    std::vector<std::string_view> GetArguments(std::string_view parameterName) const;
+    bool HasFlag(FlagId flag) const noexcept { return (flags >> static_cast<std::size_t>(flag)) & 1u; }
+    // The last value given wins.
+    std::string_view GetFlagValue(FlagId flag) const noexcept { return flagValues[static_cast<std::size_t>(flag)]; }
+    // Every value given for a flag that may be repeated, in argument order.
+    std::vector<std::string_view> GetFlagValues(FlagId flag) const;
 
 private:
 
-    void AddFlag(const std::string& argument, const CommandStructure& commandStructure);
+    static_assert(flagCount <= 64, "Too many flags for the flag bitset.");
+
+    std::size_t FindParameter(std::string_view parameterName) const noexcept;
+    void AddFlag(std::string_view argument);
+    void AssignArguments(std::size_t positionalCount);
 
-    std::string command;
-    std::unordered_map<std::string, std::string> arguments;
-    std::vector<std::string> flags;
+    const CommandStructure* commandStructure;
+    std::span<const Flag> globalFlags;
+    // Everything after the command, positional arguments are picked out of it again instead of being copied.
+    std::span<char*> rawArguments;
+    std::array<const char*, maxParameters> arguments{};
+    std::size_t repeatedBegin{ 0 };
+    std::size_t repeatedCount{ 0 };
+    std::uint64_t flags{ 0 };
+    std::array<std::string_view, flagCount> flagValues{};
 
 };
\ No newline at end of file
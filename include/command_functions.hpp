@@ -13,4 +13,10 @@ namespace fsc
     void Move(const ArgumentParser& argumentParser);
     void Rename(const ArgumentParser& argumentParser);
     void Version(const ArgumentParser& argumentParser);
+    void Serve(const ArgumentParser& argumentParser);
+    void Pack(const ArgumentParser& argumentParser);
+    void Unpack(const ArgumentParser& argumentParser);
+    void Snapshot(const ArgumentParser& argumentParser);
+    void Restore(const ArgumentParser& argumentParser);
+    void Watch(const ArgumentParser& argumentParser);
 }
\ No newline at end of file
@@ -1,21 +1,68 @@
 #pragma once
 
-#include <vector>
-#include <string>
+#include <array>
+#include <span>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
 
 #include "command_structure.hpp"
 
+// Command names are looked up through a perfect hash that is computed when the constexpr command table is built.
 class CommandList
 {
 public:
 
-    void AddCommandStructure(CommandStructure commandStructure) noexcept;
-    const std::vector<CommandStructure>& GetCommandStructures() const noexcept;
-    bool CommandStructureExists(const std::string& commandName) const noexcept;
-    CommandStructure GetCommandStructure(const std::string& commandName) const;
+    static constexpr std::size_t slotCount{ 64 };
+
+    constexpr CommandList(std::span<const CommandStructure> structures, std::span<const Flag> flags) : commandStructures{ structures }, globalFlags{ flags }
+    {
+        if (commandStructures.size() >= slotCount)
+        {
+            throw std::logic_error{ "Too many commands for the command hash table." };
+        }
+
+        for (seed = 0; seed < 100000; ++seed)
+        {
+            slots = {};
+            bool collision{ false };
+            for (std::size_t i{ 0 }; i < commandStructures.size() && !collision; ++i)
+            {
+                std::uint8_t& slot{ slots[Hash(commandStructures[i].name, seed) % slotCount] };
+                collision = slot != 0;
+                slot = static_cast<std::uint8_t>(i + 1);
+            }
+            if (!collision)
+            {
+                return;
+            }
+        }
+        throw std::logic_error{ "No perfect hash seed found for the command table." };
+    }
+
+    std::span<const CommandStructure> GetCommandStructures() const noexcept;
+    std::span<const Flag> GetGlobalFlags() const noexcept;
+    const CommandStructure* FindCommandStructure(std::string_view commandName) const noexcept;
+    bool CommandStructureExists(std::string_view commandName) const noexcept;
+    const CommandStructure& GetCommandStructure(std::string_view commandName) const;
 
 private:
 
-    std::vector<CommandStructure> commandStructures;
+    static constexpr std::uint32_t Hash(std::string_view name, std::uint32_t hashSeed) noexcept
+    {
+        std::uint32_t hash{ 2166136261u ^ hashSeed };
+        for (char character : name)
+        {
+            hash ^= static_cast<unsigned char>(character);
+            hash *= 16777619u;
+        }
+        return hash ^ (hash >> 15);
+    }
+
+    std::span<const CommandStructure> commandStructures;
+    std::span<const Flag> globalFlags;
+    std::uint32_t seed{ 0 };
+    std::array<std::uint8_t, slotCount> slots{};
 
 };
\ No newline at end of file
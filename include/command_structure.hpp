@@ -1,15 +1,18 @@
 #pragma once
 
-#include <string>
-#include <vector>
-#include <functional>
+#include <string_view>
+#include <span>
 
 #include "argument_parser.hpp"
 
 struct Flag
 {
-    std::string name;
-    std::string purpose;
+    consteval Flag(FlagId flagId, std::string_view flagPurpose, bool flagTakesValue = false) noexcept : id{ flagId }, name{ GetFlagName(flagId) }, purpose{ flagPurpose }, takesValue{ flagTakesValue } {}
+
+    FlagId id;
+    std::string_view name;
+    std::string_view purpose;
+    bool takesValue;
 };
 
 enum class ParameterRequirement
@@ -18,17 +21,19 @@ enum class ParameterRequirement
     OPTIONAL,
 };
 
+// A repeated parameter takes every argument not claimed by the parameters around it, at most one per command.
 struct Parameter
 {
-    std::string name;
+    std::string_view name;
     ParameterRequirement requirement;
-    std::string purpose;
+    std::string_view purpose;
+    bool repeated{ false };
 };
 
 struct CommandStructure
 {
-    std::string name;
-    std::vector<Parameter> parameters;
-    std::vector<Flag> flags;
-    std::function<void(const ArgumentParser&)> func;
+    std::string_view name;
+    std::span<const Parameter> parameters;
+    std::span<const Flag> flags;
+    void (*func)(const ArgumentParser&);
 };
\ No newline at end of file
@@ -4,6 +4,6 @@
 
 namespace fsc
 {
-    void InitializeCommands() noexcept;
     const CommandList& GetCommandList() noexcept;
+    void RunCommand(int argc, char* argv[]);
 }
\ No newline at end of file
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <functional>
+#include <filesystem>
+
+#include "path_layer.hpp"
+
+class ArgumentParser;
+
+// Exclusion rules in .gitignore syntax, from --exclude, --exclude-from and, with --respect-gitignore, the ignore files of the
+// walked tree. Rules are compiled once: literal names, extensions and anchored literal paths go to hash maps and only the
+// remaining patterns are matched one by one. Walkers check each entry against the Scope of its directory and never open
+// an excluded directory.
+namespace fsc_exclude
+{
+    // Compiled patterns of one source, the command line or one ignore file. The last matching rule decides.
+    class RuleSet
+    {
+    public:
+
+        void Add(std::string_view line);
+        void AddLines(std::string_view text);
+        bool IsEmpty() const noexcept;
+        bool HasAnchored() const noexcept;
+        // Excluded, included again by a negated rule, or no value when no rule matches. The path is relative to the
+        // directory the rules came from, only the name is matched when no rule is anchored.
+        std::optional<bool> Match(std::string_view relativePath, std::string_view name, bool directory) const;
+
+    private:
+
+        using RuleIndex = std::uint32_t;
+
+        struct StringHash
+        {
+            using is_transparent = void;
+            std::size_t operator()(std::string_view text) const noexcept { return std::hash<std::string_view>{}(text); }
+        };
+        using RuleMap = std::unordered_map<std::string, RuleIndex, StringHash, std::equal_to<>>;
+
+        struct GlobRule
+        {
+            RuleIndex index;
+            bool directoryOnly;
+            bool anchored;
+            std::string pattern;
+            // Anchored patterns split at "/", a "**" component matches any number of directories.
+            std::vector<std::string> components;
+        };
+
+        std::vector<bool> negated;
+        RuleMap names;
+        RuleMap directoryNames;
+        // Keyed by the suffix after "*", such as ".o" for "*.o".
+        RuleMap extensions;
+        RuleMap paths;
+        RuleMap directoryPaths;
+        std::vector<GlobRule> globs;
+        bool anchored{ false };
+
+    };
+
+    // The rules that apply to the entries of one directory. A default constructed scope excludes nothing.
+    class Scope
+    {
+    public:
+
+        bool IsEmpty() const noexcept;
+        bool IsExcluded(std::string_view name, bool directory) const;
+        // The scope of a subdirectory, reading its .gitignore when ignore files are respected.
+#if defined(__unix__) || defined(__APPLE__)
+        Scope Enter(int parentDirectory, std::string_view name) const;
+#endif
+        Scope Enter(const std::filesystem::path& directory) const;
+
+    private:
+
+        struct Active
+        {
+            std::shared_ptr<const RuleSet> rules;
+            // This directory relative to the directory the rules came from, empty or ending in "/".
+            std::string prefix;
+        };
+
+        Scope Enter(std::string_view name, std::optional<std::string> ignoreFile) const;
+
+        // Command line rules take precedence over ignore files, and deeper ignore files over those above them.
+        std::optional<Active> arguments;
+        std::vector<Active> ignoreFiles;
+        bool respectIgnoreFiles{ false };
+
+        friend Scope Open(const fsc_path::ResolvedPath& root);
+
+    };
+
+    // The scope inside the root of a walk, including the ignore files of its parents up to the repository root.
+    Scope Open(const fsc_path::ResolvedPath& root);
+    void ConfigureFromArguments(const ArgumentParser& argumentParser);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <system_error>
+
+#include "path_layer.hpp"
+#include "exclude_rules.hpp"
+
+// Bulk copy and removal relative to resolved directory handles, passing every operation through the shared I/O scheduler.
+// Walks skip entries excluded by the configured rules, and removals leave directories that still hold excluded entries.
+namespace fsc_operations
+{
+    void CopyTree(const fsc_path::ResolvedPath& source, const fsc_path::ResolvedPath& destinationDirectory, const std::string& destinationName);
+    // Makes the destination match the source, copying what differs and removing what the source no longer has. With
+    // skipUnchanged, files whose copy has the same size and is no older than the source are left alone. The scope applies
+    // inside the source, callers mirroring part of a larger walk pass the scope of that position.
+    void MirrorTree(const fsc_path::ResolvedPath& source, const fsc_path::ResolvedPath& destinationDirectory, const std::string& destinationName, bool skipUnchanged, const fsc_exclude::Scope& scope);
+    std::uintmax_t RemoveTree(const fsc_path::ResolvedPath& path, std::error_code& error);
+    std::uintmax_t RemoveContents(const fsc_path::ResolvedPath& path, std::error_code& error);
+    bool IsEmptyDirectory(const fsc_path::ResolvedPath& path);
+    void Rename(const fsc_path::ResolvedPath& source, const fsc_path::ResolvedPath& destination, std::error_code& error);
+}
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <span>
+#include <filesystem>
+
+// Shell style wildcards: "*", "?" and "[...]" classes (negated with "!" or "^"), "\" escapes the next character.
+// Wildcards never match a leading "." unless the pattern starts with one.
+namespace fsc_glob
+{
+    struct Expansion
+    {
+        std::string_view argument;
+        // Literal arguments pass through unchecked, patterns list their matches sorted by name and may be empty.
+        std::vector<std::filesystem::path> paths;
+        bool pattern{ false };
+    };
+
+    bool HasWildcards(std::string_view text) noexcept;
+    // With matchHidden, wildcards also match a leading "." as in ignore files.
+    bool Match(std::string_view pattern, std::string_view name, bool matchHidden = false) noexcept;
+
+    // Patterns may only use wildcards in their last component, each parent directory is scanned once for all of its patterns.
+    std::vector<Expansion> Expand(std::span<const std::string_view> arguments);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// Scoped timers and counters behind --stats and --trace. Without FSC_INSTRUMENTATION the macros compile to nothing,
+// with it a disabled run costs one relaxed atomic load per macro.
+namespace fsc_instrumentation
+{
+    enum class Counter : std::size_t
+    {
+        SYSCALLS,
+        BYTES,
+        ENTRIES,
+        ERRORS,
+        COUNT,
+    };
+
+    inline std::atomic<bool> enabled{ false };
+
+    inline std::int64_t Now() noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void Enable(bool printStats, const std::string& tracePath);
+    void Finish();
+    void Add(Counter counter, std::uint64_t amount) noexcept;
+    void RecordQueueDepth(std::uint64_t depth) noexcept;
+    std::int64_t BeginScope() noexcept;
+    void RecordScope(const char* name, std::int64_t start, std::int64_t end) noexcept;
+
+    class ScopedTimer
+    {
+    public:
+
+        explicit ScopedTimer(const char* name) noexcept : scopeName{ enabled.load(std::memory_order_relaxed) ? name : nullptr }
+        {
+            if (scopeName != nullptr)
+            {
+                start = BeginScope();
+            }
+        }
+
+        ~ScopedTimer()
+        {
+            if (scopeName != nullptr)
+            {
+                RecordScope(scopeName, start, Now());
+            }
+        }
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+
+        const char* scopeName;
+        std::int64_t start{ 0 };
+
+    };
+}
+
+#define FSC_INSTRUMENTATION_CONCAT_INNER(a, b) a##b
+#define FSC_INSTRUMENTATION_CONCAT(a, b) FSC_INSTRUMENTATION_CONCAT_INNER(a, b)
+
+#if defined(FSC_INSTRUMENTATION)
+#define FSC_TRACE_SCOPE(name) fsc_instrumentation::ScopedTimer FSC_INSTRUMENTATION_CONCAT(fscScopedTimer, __LINE__){ name }
+#define FSC_COUNT(counter, amount) \
+    do { if (fsc_instrumentation::enabled.load(std::memory_order_relaxed)) { fsc_instrumentation::Add(fsc_instrumentation::Counter::counter, static_cast<std::uint64_t>(amount)); } } while (false)
+#define FSC_QUEUE_DEPTH(depth) \
+    do { if (fsc_instrumentation::enabled.load(std::memory_order_relaxed)) { fsc_instrumentation::RecordQueueDepth(static_cast<std::uint64_t>(depth)); } } while (false)
+#else
+#define FSC_TRACE_SCOPE(name) static_cast<void>(0)
+#define FSC_COUNT(counter, amount) static_cast<void>(sizeof(amount))
+#define FSC_QUEUE_DEPTH(depth) static_cast<void>(sizeof(depth))
+#endif
\ No newline at end of file
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#if defined(__linux__)
+struct statx;
+#endif
+
+// Metadata and data operations submitted as one batch. The io_uring backend hands a batch to the kernel a ring at a time, one
+// io_uring_enter for hundreds of operations; the thread backend runs the operations as blocking calls on a small pool.
+// Both pass the batch through the shared I/O scheduler, and names and buffers must stay valid until Submit returns.
+namespace fsc_batch
+{
+    enum class Backend : std::uint8_t
+    {
+        URING,
+        THREADS,
+    };
+
+    class Batch
+    {
+    public:
+
+        using Index = std::size_t;
+
+#if defined(__linux__)
+        Index Stat(int directory, const char* name, int flags, struct statx* information);
+#endif
+        Index Open(int directory, const char* name, int flags, unsigned int mode = 0);
+        Index Close(int descriptor);
+        Index Unlink(int directory, const char* name, int flags);
+        Index MakeDirectory(int directory, const char* name, unsigned int mode);
+        Index Read(int descriptor, void* data, std::size_t size, std::uint64_t offset);
+        Index Write(int descriptor, const void* data, std::size_t size, std::uint64_t offset);
+
+        // The next operation added starts after the last one completes, whether or not it succeeded.
+        void Link() noexcept;
+        // Runs every operation added since the last Clear and waits for all of them.
+        void Submit();
+        void Clear() noexcept;
+
+        // The operation's return value, or the negated errno when it failed.
+        int GetResult(Index index) const noexcept;
+        std::size_t GetSize() const noexcept;
+
+    private:
+
+        enum class Opcode : std::uint8_t
+        {
+            STAT,
+            OPEN,
+            CLOSE,
+            UNLINK,
+            MAKE_DIRECTORY,
+            READ,
+            WRITE,
+        };
+
+        struct Request
+        {
+            Opcode opcode;
+            bool linked{ false };
+            int descriptor{ -1 };
+            int flags{ 0 };
+            unsigned int mode{ 0 };
+            const char* name{ nullptr };
+            void* data{ nullptr };
+            std::size_t size{ 0 };
+            std::uint64_t offset{ 0 };
+        };
+
+        Index Add(const Request& request);
+        void SubmitRing(std::size_t first, std::size_t last);
+        void SubmitThreads(std::size_t first, std::size_t last);
+        static int Execute(const Request& request) noexcept;
+
+        std::vector<Request> requests;
+        std::vector<int> results;
+        std::size_t submitted{ 0 };
+
+    };
+
+    // Accepts "auto", "uring" or "threads". Auto, and an empty name, use io_uring when the kernel supports every operation.
+    void SetBackend(std::string_view name);
+    Backend GetBackend() noexcept;
+    // Starts the worker pool and probes io_uring ahead of the first batch, for a server that should answer warm.
+    void Prepare();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+
+class ArgumentParser;
+
+// Shared throttle for bulk data and metadata operations, configured from --bwlimit, --iops-limit, --ionice and --latency-target,
+// plus the block size and large file settings used by the copy path.
+namespace fsc_io
+{
+    struct IoLimits
+    {
+        std::uint64_t bytesPerSecond{ 0 };
+        std::uint64_t operationsPerSecond{ 0 };
+        std::chrono::nanoseconds latencyTarget{ 0 };
+    };
+
+    // Files at or above the threshold are copied without leaving their data in the page cache.
+    struct CopySettings
+    {
+        std::size_t blockSize{ 1 << 20 };
+        std::uint64_t largeFileThreshold{ std::uint64_t{ 256 } << 20 };
+        bool directIo{ false };
+    };
+
+    class TokenBucket
+    {
+    public:
+
+        void Reset(std::uint64_t tokensPerSecond, std::uint64_t burst) noexcept;
+        std::chrono::nanoseconds Take(std::uint64_t amount, std::chrono::steady_clock::time_point now) noexcept;
+        bool IsLimited() const noexcept { return rate > 0; }
+
+    private:
+
+        double rate{ 0.0 };
+        double capacity{ 0.0 };
+        double tokens{ 0.0 };
+        std::chrono::steady_clock::time_point last{};
+
+    };
+
+    class IoScheduler
+    {
+    public:
+
+        // Waits for operation tokens and records the average operation latency for the adaptive mode when it ends. A batch of
+        // operations submitted together takes all of its tokens at once.
+        class Operation
+        {
+        public:
+
+            explicit Operation(IoScheduler& ioScheduler, std::uint64_t bytes = 0, std::uint64_t operations = 1);
+            ~Operation();
+            Operation(const Operation&) = delete;
+            Operation& operator=(const Operation&) = delete;
+
+        private:
+
+            IoScheduler& scheduler;
+            std::chrono::steady_clock::time_point start;
+            std::uint64_t count;
+
+        };
+
+        void Configure(const IoLimits& ioLimits);
+        bool IsThrottled() const noexcept;
+
+    private:
+
+        void Acquire(std::uint64_t bytes, std::uint64_t operations);
+        void RecordLatency(std::chrono::nanoseconds latency);
+
+        mutable std::mutex mutex;
+        IoLimits limits;
+        TokenBucket byteBucket;
+        TokenBucket operationBucket;
+        double averageLatency{ 0.0 };
+        std::chrono::nanoseconds adaptiveDelay{ 0 };
+
+    };
+
+    IoScheduler& GetIoScheduler() noexcept;
+    const CopySettings& GetCopySettings() noexcept;
+    void ConfigureFromArguments(const ArgumentParser& argumentParser);
+    void SetIoPriority(std::string_view priority);
+    // Accepts a count with an optional us, ms or s suffix, milliseconds by default.
+    std::chrono::nanoseconds ParseDuration(std::string_view flagName, std::string_view text);
+}
\ No newline at end of file
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <optional>
+#include <filesystem>
+
+#if defined(__linux__)
+struct statx;
+#endif
+
+// Paths are resolved once per command: the canonical form is computed a single time and later operations run relative to
+// handles on the path and its parent directory (*at() syscalls), with metadata fetched once and cached on the resolved path.
+namespace fsc_path
+{
+    enum class FileType : std::uint8_t
+    {
+        NONE,
+        REGULAR,
+        DIRECTORY,
+        SYMLINK,
+        OTHER,
+    };
+
+    struct Metadata
+    {
+        FileType type{ FileType::NONE };
+        std::uint64_t size{ 0 };
+        std::uint64_t inode{ 0 };
+        std::uint64_t device{ 0 };
+        std::uint64_t links{ 0 };
+        std::uint32_t mode{ 0 };
+        std::uint32_t user{ 0 };
+        std::uint32_t group{ 0 };
+        std::int64_t modifiedSeconds{ 0 };
+        std::uint32_t modifiedNanoseconds{ 0 };
+    };
+
+    class FileDescriptor
+    {
+    public:
+
+        FileDescriptor() noexcept = default;
+        explicit FileDescriptor(int fileDescriptor) noexcept : descriptor{ fileDescriptor } {}
+        ~FileDescriptor();
+        FileDescriptor(FileDescriptor&& other) noexcept;
+        FileDescriptor& operator=(FileDescriptor&& other) noexcept;
+        FileDescriptor(const FileDescriptor&) = delete;
+        FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+        int Get() const noexcept { return descriptor; }
+        bool IsValid() const noexcept { return descriptor >= 0; }
+        int Release() noexcept;
+
+    private:
+
+        int descriptor{ -1 };
+
+    };
+
+    // Returns no value when the entry does not exist, throws for any other error.
+    std::optional<Metadata> StatAt(int directory, const char* name, bool followSymlinks);
+    std::optional<Metadata> Stat(int descriptor);
+    // How many descriptors a pipelined walk may hold open at once, a quarter of the soft RLIMIT_NOFILE.
+    std::size_t GetDescriptorBudget() noexcept;
+#if defined(__linux__)
+    // For statx results gathered elsewhere, such as a batched stat.
+    Metadata ToMetadata(const struct statx& information) noexcept;
+#endif
+
+    class ResolvedPath
+    {
+    public:
+
+        explicit ResolvedPath(const std::filesystem::path& path);
+
+        ResolvedPath Child(const std::string& childName) const;
+        ResolvedPath Sibling(const std::string& siblingName) const;
+
+        bool Exists() const noexcept;
+        bool IsDirectory() const noexcept;
+        const Metadata& GetMetadata() const noexcept;
+        const std::filesystem::path& GetPath() const noexcept;
+        const std::string& GetName() const noexcept;
+        int GetParentDescriptor() const noexcept;
+        int GetDescriptor() const noexcept;
+
+    private:
+
+        ResolvedPath() = default;
+        static ResolvedPath OpenAt(int directory, const std::filesystem::path& directoryPath, const std::string& entryName);
+
+        std::filesystem::path path;
+        std::string name;
+        FileDescriptor parent;
+        FileDescriptor handle;
+        Metadata metadata;
+
+    };
+}
\ No newline at end of file
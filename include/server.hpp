@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+namespace fsc_server
+{
+    std::string GetDefaultSocketPath();
+    void Serve(const std::string& socketPath);
+    bool ForwardToServer(int argc, char* argv[]);
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// SHA-256 as specified in FIPS 180-4, the strong hash content is addressed by.
+namespace fsc_hash
+{
+    using Digest = std::array<std::uint8_t, 32>;
+
+    class Sha256
+    {
+    public:
+
+        Sha256() noexcept;
+
+        void Update(const void* data, std::size_t size) noexcept;
+        Digest Finish() noexcept;
+
+        static Digest Hash(const void* data, std::size_t size) noexcept;
+
+    private:
+
+        void Transform(const std::uint8_t* block) noexcept;
+
+        std::array<std::uint32_t, 8> state;
+        std::array<std::uint8_t, 64> buffer{};
+        std::size_t buffered{ 0 };
+        std::uint64_t length{ 0 };
+
+    };
+
+    std::string ToHex(const Digest& digest);
+}
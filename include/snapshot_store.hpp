@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <filesystem>
+
+#include "path_layer.hpp"
+
+// Local content addressed snapshots. Files are split into content defined chunks that are stored once under their SHA-256,
+// and a snapshot is a compact manifest of the tree listing the chunks of every file. A store is laid out as
+//   <store>/chunks/<first two hex digits>/<sha256>
+//   <store>/snapshots/<id>
+// so a new snapshot only writes the chunks that changed since any earlier one.
+namespace fsc_snapshot
+{
+    struct SnapshotResult
+    {
+        std::string id;
+        std::uint64_t entries{ 0 };
+        std::uint64_t files{ 0 };
+        // Files whose size, modification time and inode match the previous snapshot of the same source are not read again.
+        std::uint64_t unchangedFiles{ 0 };
+        std::uint64_t chunks{ 0 };
+        std::uint64_t newChunks{ 0 };
+        std::uint64_t newBytes{ 0 };
+    };
+
+    struct RestoreOptions
+    {
+        bool overwrite{ false };
+    };
+
+    struct RestoreResult
+    {
+        std::string id;
+        std::uint64_t entries{ 0 };
+        std::uint64_t bytes{ 0 };
+    };
+
+    SnapshotResult Snapshot(const fsc_path::ResolvedPath& source, const std::filesystem::path& store);
+    // An empty id restores the latest snapshot in the store.
+    RestoreResult Restore(const std::filesystem::path& store, std::string_view id, const fsc_path::ResolvedPath& destination, const RestoreOptions& options);
+}
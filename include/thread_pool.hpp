@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Fixed size pool of worker threads, tasks run in submission order and their results or exceptions come back as futures.
+namespace fsc_threads
+{
+    class ThreadPool
+    {
+    public:
+
+        explicit ThreadPool(std::size_t threadCount = GetDefaultThreadCount());
+        ~ThreadPool();
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        template<typename Function>
+        std::future<std::invoke_result_t<Function>> Submit(Function&& function)
+        {
+            using Result = std::invoke_result_t<Function>;
+            auto task{ std::make_shared<std::packaged_task<Result()>>(std::forward<Function>(function)) };
+            std::future<Result> result{ task->get_future() };
+            Post([task]() { (*task)(); });
+            return result;
+        }
+
+        void Post(std::function<void()> task);
+        std::size_t GetThreadCount() const noexcept;
+
+        // Storage latency rather than CPU bounds most tasks, so the default oversubscribes small machines.
+        static std::size_t GetDefaultThreadCount() noexcept;
+
+    private:
+
+        void Work();
+
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable available;
+        std::deque<std::function<void()>> tasks;
+        bool stopping{ false };
+
+    };
+
+    // Runs the per-target work of commands. Created on first use and kept for the life of the process, so a server reuses
+    // its threads across requests.
+    ThreadPool& GetSharedPool();
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <filesystem>
+
+#include "path_layer.hpp"
+#include "exclude_rules.hpp"
+
+// In-memory tree for features that need a whole walk at once (sorted listings, diffs, sync planning). Entries are stored
+// as parallel columns indexed by EntryIndex, names are interned once in an arena and full paths are only rebuilt on request.
+namespace fsc_tree
+{
+    using EntryIndex = std::uint32_t;
+    using NameId = std::uint64_t;
+
+    constexpr EntryIndex noEntry{ std::numeric_limits<EntryIndex>::max() };
+
+    class NameArena
+    {
+    public:
+
+        NameId Intern(std::string_view name);
+        std::string_view Get(NameId id) const noexcept;
+        std::size_t GetMemoryUsage() const noexcept;
+
+    private:
+
+        static constexpr std::size_t blockSize{ 1 << 20 };
+
+        NameId Append(std::string_view name);
+        void Grow();
+
+        std::vector<std::unique_ptr<char[]>> blocks;
+        std::size_t blockUsed{ blockSize };
+        // Open addressing table of NameId + 1, zero marks an empty slot.
+        std::vector<NameId> slots;
+        std::size_t count{ 0 };
+
+    };
+
+    struct BuildOptions
+    {
+        bool recursive{ true };
+        bool sortByName{ false };
+        // Size, modification time and link count need a stat per entry, type and inode come from the directory itself.
+        bool metadata{ true };
+    };
+
+    class TreeModel
+    {
+    public:
+
+        static TreeModel Build(const fsc_path::ResolvedPath& root, const BuildOptions& options);
+
+        std::size_t GetSize() const noexcept;
+        EntryIndex GetRoot() const noexcept;
+
+        EntryIndex GetParent(EntryIndex index) const noexcept;
+        std::string_view GetName(EntryIndex index) const noexcept;
+        fsc_path::FileType GetType(EntryIndex index) const noexcept;
+        std::uint64_t GetFileSize(EntryIndex index) const noexcept;
+        std::int64_t GetModified(EntryIndex index) const noexcept;
+        std::uint64_t GetInode(EntryIndex index) const noexcept;
+        std::uint32_t GetMode(EntryIndex index) const noexcept;
+        // Children of a directory are stored contiguously, [first, first + count).
+        EntryIndex GetFirstChild(EntryIndex index) const noexcept;
+        std::uint32_t GetChildCount(EntryIndex index) const noexcept;
+
+        std::filesystem::path GetPath(EntryIndex index) const;
+        std::string GetRelativePath(EntryIndex index) const;
+        std::size_t GetMemoryUsage() const noexcept;
+
+    private:
+
+        EntryIndex Add(EntryIndex parent, NameId name, const fsc_path::Metadata& metadata);
+        void BuildDirectory(int directory, EntryIndex index, const BuildOptions& options, const fsc_exclude::Scope& scope);
+
+        std::filesystem::path rootPath;
+        NameArena arena;
+        std::vector<EntryIndex> parents;
+        std::vector<NameId> names;
+        std::vector<fsc_path::FileType> types;
+        std::vector<std::uint64_t> sizes;
+        std::vector<std::int64_t> modified;
+        std::vector<std::uint64_t> inodes;
+        std::vector<std::uint32_t> modes;
+        std::vector<EntryIndex> firstChildren;
+        std::vector<std::uint32_t> childCounts;
+
+    };
+}
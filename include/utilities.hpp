@@ -1,13 +1,22 @@
 #pragma once
 
 #include <string>
+#include <ostream>
+#include <optional>
 #include <filesystem>
 
+#include "path_layer.hpp"
+
 class ArgumentParser;
 
 namespace fsc_utilities
 {
     bool PromptConfirmation(const std::string& prompt);
-    std::string ReadFile(std::filesystem::path path);
-    bool ValidateMove(std::filesystem::path target, std::filesystem::path destination, bool overwriteFlag, bool silentPromptFlag);
+    // Copies the file to the stream through a fixed buffer, so memory use does not grow with the file.
+    void StreamFile(const std::filesystem::path& path, std::ostream& output);
+    void ValidateDestination(const fsc_path::ResolvedPath& destination);
+    // Checks the target and prompts before overwriting, returns the destination item or no value if the prompt was declined.
+    std::optional<fsc_path::ResolvedPath> ValidateMove(const fsc_path::ResolvedPath& target, const fsc_path::ResolvedPath& destination, bool overwriteFlag, bool silentPromptFlag);
+    // ValidateMove for a destination that already passed ValidateDestination.
+    std::optional<fsc_path::ResolvedPath> ValidateMoveTarget(const fsc_path::ResolvedPath& target, const fsc_path::ResolvedPath& destination, bool overwriteFlag, bool silentPromptFlag);
 }
\ No newline at end of file
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+
+#include "path_layer.hpp"
+
+// Continuous one way mirroring. After an initial sync, changes below the source are read from inotify, coalesced over a
+// debounce window and replayed onto the destination: renames as renames, everything else by mirroring only the entries
+// that changed. When the kernel drops events the whole tree is compared again.
+namespace fsc_watch
+{
+    struct WatchOptions
+    {
+        // Changes are replayed once no event arrived for this long, and at least every ten windows during a steady stream.
+        std::chrono::milliseconds debounce{ 200 };
+    };
+
+    // Runs until the source is removed or the process is interrupted.
+    void Watch(const fsc_path::ResolvedPath& source, const fsc_path::ResolvedPath& destinationDirectory, const std::string& destinationName, const WatchOptions& options);
+}
@@ -0,0 +1,1158 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <future>
+#include <optional>
+#include <utility>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+#include <stdexcept>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+
+#include "archive.hpp"
+#include "thread_pool.hpp"
+#include "io_scheduler.hpp"
+#include "instrumentation.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace fsc_archive
+{
+#if defined(__unix__) || defined(__APPLE__)
+    namespace
+    {
+        constexpr std::size_t recordSize{ 512 };
+        // Files up to this size are read ahead (pack) or written behind (unpack) on the pool, larger ones are streamed in place.
+        constexpr std::uint64_t smallFileLimit{ 1 << 20 };
+        constexpr std::size_t maxPendingEntries{ 4096 };
+        constexpr std::uint64_t maxPendingBytes{ 64 << 20 };
+        constexpr std::size_t streamBufferSize{ 1 << 20 };
+        constexpr std::uint64_t maxOctalId{ 07777777 };
+
+        using SharedDescriptor = std::shared_ptr<fsc_path::FileDescriptor>;
+
+        std::error_code LastError() noexcept
+        {
+            return std::error_code{ errno, std::generic_category() };
+        }
+
+        SharedDescriptor OpenDirectory(int directory, const char* name, const std::filesystem::path& path)
+        {
+            FSC_COUNT(SYSCALLS, 1);
+            SharedDescriptor descriptor{ std::make_shared<fsc_path::FileDescriptor>(openat(directory, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) };
+            if (!descriptor->IsValid())
+            {
+                throw std::filesystem::filesystem_error{ "Failed to open directory", path, LastError() };
+            }
+            return descriptor;
+        }
+
+        struct Header
+        {
+            char name[100];
+            char mode[8];
+            char user[8];
+            char group[8];
+            char size[12];
+            char modified[12];
+            char checksum[8];
+            char type;
+            char linkName[100];
+            char magic[6];
+            char version[2];
+            char userName[32];
+            char groupName[32];
+            char deviceMajor[8];
+            char deviceMinor[8];
+            char prefix[155];
+            char padding[12];
+        };
+        static_assert(sizeof(Header) == recordSize);
+
+        constexpr char regularType{ '0' };
+        constexpr char hardLinkType{ '1' };
+        constexpr char symlinkType{ '2' };
+        constexpr char directoryType{ '5' };
+        constexpr char contiguousType{ '7' };
+        constexpr char paxType{ 'x' };
+        constexpr char paxGlobalType{ 'g' };
+        constexpr char longNameType{ 'L' };
+        constexpr char longLinkType{ 'K' };
+
+        // Fills the field with width - 1 octal digits and a terminating zero, returns false if the value does not fit.
+        bool WriteOctal(char* field, std::size_t width, std::uint64_t value) noexcept
+        {
+            field[width - 1] = '\0';
+            for (std::size_t i{ width - 1 }; i > 0; --i)
+            {
+                field[i - 1] = static_cast<char>('0' + (value & 7));
+                value >>= 3;
+            }
+            return value == 0;
+        }
+
+        // Octal, or the base-256 encoding GNU tar uses for values that do not fit.
+        std::uint64_t ReadNumber(const char* field, std::size_t width) noexcept
+        {
+            std::uint64_t value{ 0 };
+            if (static_cast<unsigned char>(field[0]) & 0x80)
+            {
+                for (std::size_t i{ 1 }; i < width; ++i)
+                {
+                    value = (value << 8) | static_cast<unsigned char>(field[i]);
+                }
+                return value;
+            }
+            std::size_t i{ 0 };
+            while (i < width && field[i] == ' ')
+            {
+                ++i;
+            }
+            for (; i < width && field[i] >= '0' && field[i] <= '7'; ++i)
+            {
+                value = (value << 3) | static_cast<std::uint64_t>(field[i] - '0');
+            }
+            return value;
+        }
+
+        std::string ReadString(const char* field, std::size_t width)
+        {
+            return std::string{ field, strnlen(field, width) };
+        }
+
+        std::uint32_t Checksum(const Header& header) noexcept
+        {
+            const unsigned char* bytes{ reinterpret_cast<const unsigned char*>(&header) };
+            std::uint32_t sum{ 0 };
+            for (std::size_t i{ 0 }; i < recordSize; ++i)
+            {
+                bool inChecksum{ i >= offsetof(Header, checksum) && i < offsetof(Header, checksum) + sizeof(header.checksum) };
+                sum += inChecksum ? static_cast<std::uint32_t>(' ') : bytes[i];
+            }
+            return sum;
+        }
+
+        std::uint64_t PaddingFor(std::uint64_t size) noexcept
+        {
+            return (recordSize - size % recordSize) % recordSize;
+        }
+
+        // "<length> <key>=<value>\n" where the length counts its own digits.
+        void AppendPaxRecord(std::string& records, std::string_view key, std::string_view value)
+        {
+            std::size_t length{ key.size() + value.size() + 3 };
+            std::size_t total{ length + std::to_string(length).size() };
+            total = length + std::to_string(total).size();
+            records += std::to_string(total) + " " + std::string{ key } + "=" + std::string{ value } + "\n";
+        }
+
+        class StreamWriter
+        {
+        public:
+
+            explicit StreamWriter(int outputDescriptor) : output{ outputDescriptor }
+            {
+                buffer.reserve(streamBufferSize);
+            }
+
+            void Write(const char* data, std::size_t size)
+            {
+                if (buffer.size() + size > streamBufferSize)
+                {
+                    Flush();
+                }
+                if (size >= streamBufferSize)
+                {
+                    WriteAll(data, size);
+                }
+                else
+                {
+                    buffer.insert(buffer.end(), data, data + size);
+                }
+                written += size;
+            }
+
+            void WriteZeros(std::uint64_t size)
+            {
+                static constexpr char zeros[recordSize]{};
+                while (size > 0)
+                {
+                    std::size_t chunk{ static_cast<std::size_t>(std::min<std::uint64_t>(size, recordSize)) };
+                    Write(zeros, chunk);
+                    size -= chunk;
+                }
+            }
+
+            void Pad()
+            {
+                WriteZeros(PaddingFor(written));
+            }
+
+            void Flush()
+            {
+                WriteAll(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+
+            std::uint64_t GetWritten() const noexcept
+            {
+                return written;
+            }
+
+        private:
+
+            void WriteAll(const char* data, std::size_t size)
+            {
+                while (size > 0)
+                {
+                    ssize_t result{ write(output, data, size) };
+                    FSC_COUNT(SYSCALLS, 1);
+                    if (result < 0 && errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if (result <= 0)
+                    {
+                        throw std::runtime_error{ std::string{ "Failed to write archive: " } + std::strerror(errno) };
+                    }
+                    data += result;
+                    size -= static_cast<std::size_t>(result);
+                }
+            }
+
+            int output;
+            std::vector<char> buffer;
+            std::uint64_t written{ 0 };
+
+        };
+
+        class StreamReader
+        {
+        public:
+
+            explicit StreamReader(int inputDescriptor) : input{ inputDescriptor }, buffer(streamBufferSize) {}
+
+            // Returns false if the stream ended before the first byte, a stream that ends part way through is an error.
+            bool Read(char* data, std::size_t size)
+            {
+                std::size_t copied{ 0 };
+                while (copied < size)
+                {
+                    if (position == available && !Fill())
+                    {
+                        if (copied == 0)
+                        {
+                            return false;
+                        }
+                        throw std::runtime_error{ "Unexpected end of archive." };
+                    }
+                    std::size_t chunk{ std::min(size - copied, available - position) };
+                    std::memcpy(data + copied, buffer.data() + position, chunk);
+                    position += chunk;
+                    copied += chunk;
+                }
+                return true;
+            }
+
+            void Skip(std::uint64_t size)
+            {
+                while (size > 0)
+                {
+                    if (position == available && !Fill())
+                    {
+                        throw std::runtime_error{ "Unexpected end of archive." };
+                    }
+                    std::size_t chunk{ static_cast<std::size_t>(std::min<std::uint64_t>(size, available - position)) };
+                    position += chunk;
+                    size -= chunk;
+                }
+            }
+
+            // Consumes trailing padding so the writing side of a pipe never sees a closed reader.
+            void Drain()
+            {
+                while (Fill())
+                {
+                }
+            }
+
+        private:
+
+            bool Fill()
+            {
+                while (true)
+                {
+                    ssize_t result{ read(input, buffer.data(), buffer.size()) };
+                    FSC_COUNT(SYSCALLS, 1);
+                    if (result < 0 && errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if (result < 0)
+                    {
+                        throw std::runtime_error{ std::string{ "Failed to read archive: " } + std::strerror(errno) };
+                    }
+                    position = 0;
+                    available = static_cast<std::size_t>(result);
+                    return result > 0;
+                }
+            }
+
+            int input;
+            std::vector<char> buffer;
+            std::size_t position{ 0 };
+            std::size_t available{ 0 };
+
+        };
+
+        std::size_t ReadAt(int descriptor, char* data, std::size_t size, std::uint64_t offset, const std::string& path)
+        {
+            std::size_t received{ 0 };
+            while (received < size)
+            {
+                ssize_t result{ pread(descriptor, data + received, size - received, static_cast<off_t>(offset + received)) };
+                FSC_COUNT(SYSCALLS, 1);
+                if (result < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (result < 0)
+                {
+                    FSC_COUNT(ERRORS, 1);
+                    throw std::filesystem::filesystem_error{ "Failed to read file", path, LastError() };
+                }
+                if (result == 0)
+                {
+                    break;
+                }
+                received += static_cast<std::size_t>(result);
+            }
+            return received;
+        }
+
+        void WriteAt(int descriptor, const char* data, std::size_t size, const std::string& path)
+        {
+            while (size > 0)
+            {
+                ssize_t result{ write(descriptor, data, size) };
+                FSC_COUNT(SYSCALLS, 1);
+                if (result < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (result < 0)
+                {
+                    FSC_COUNT(ERRORS, 1);
+                    throw std::filesystem::filesystem_error{ "Failed to write file", path, LastError() };
+                }
+                data += result;
+                size -= static_cast<std::size_t>(result);
+            }
+        }
+
+        struct PackEntry
+        {
+            std::string path;
+            std::string linkTarget;
+            char type{ regularType };
+            fsc_path::Metadata metadata;
+            SharedDescriptor directory;
+            std::string name;
+            std::future<std::vector<char>> contents;
+            // Counted against the descriptor budget while the entry is in the window.
+            bool holdsDescriptor{ false };
+        };
+
+        // Walks on the calling thread and keeps a window of entries whose small file contents are read ahead on the pool,
+        // entries leave the window in walk order so the archive is deterministic.
+        class Packer
+        {
+        public:
+
+            explicit Packer(int output) : writer{ output }, maxPendingDescriptors{ std::min(maxPendingEntries, fsc_path::GetDescriptorBudget()) } {}
+
+            void AddRoot(const fsc_path::ResolvedPath& source)
+            {
+                FSC_COUNT(SYSCALLS, 1);
+                SharedDescriptor parent{ std::make_shared<fsc_path::FileDescriptor>(fcntl(source.GetParentDescriptor(), F_DUPFD_CLOEXEC, 0)) };
+                if (!parent->IsValid())
+                {
+                    throw std::filesystem::filesystem_error{ "Failed to open parent directory", source.GetPath(), LastError() };
+                }
+                std::optional<fsc_path::Metadata> metadata{ fsc_path::StatAt(parent->Get(), source.GetName().c_str(), false) };
+                if (!metadata)
+                {
+                    throw std::filesystem::filesystem_error{ "Failed to pack", source.GetPath(), std::make_error_code(std::errc::no_such_file_or_directory) };
+                }
+                Add(parent, source.GetName(), source.GetName(), *metadata);
+            }
+
+            PackResult Finish()
+            {
+                while (!pending.empty())
+                {
+                    EmitFront();
+                }
+                writer.WriteZeros(recordSize * 2);
+                writer.Flush();
+                result.bytes = writer.GetWritten();
+                return result;
+            }
+
+        private:
+
+            void Walk(const SharedDescriptor& directory, const std::string& path)
+            {
+                std::vector<std::string> names;
+                {
+                    FSC_COUNT(SYSCALLS, 1);
+                    int descriptor{ openat(directory->Get(), ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+                    DIR* stream{ descriptor >= 0 ? fdopendir(descriptor) : nullptr };
+                    if (stream == nullptr)
+                    {
+                        std::error_code error{ LastError() };
+                        if (descriptor >= 0)
+                        {
+                            close(descriptor);
+                        }
+                        throw std::filesystem::filesystem_error{ "Failed to read directory", path, error };
+                    }
+                    while (dirent* entry{ readdir(stream) })
+                    {
+                        std::string_view name{ entry->d_name };
+                        if (name != "." && name != "..")
+                        {
+                            names.emplace_back(name);
+                        }
+                    }
+                    closedir(stream);
+                }
+                FSC_COUNT(ENTRIES, names.size());
+                std::sort(names.begin(), names.end());
+
+                for (const std::string& name : names)
+                {
+                    std::optional<fsc_path::Metadata> metadata{ fsc_path::StatAt(directory->Get(), name.c_str(), false) };
+                    if (metadata)
+                    {
+                        Add(directory, name, path + "/" + name, *metadata);
+                    }
+                }
+            }
+
+            void Add(const SharedDescriptor& directory, const std::string& name, std::string path, const fsc_path::Metadata& metadata)
+            {
+                PackEntry entry;
+                entry.metadata = metadata;
+                switch (metadata.type)
+                {
+                case fsc_path::FileType::DIRECTORY:
+                {
+                    entry.type = directoryType;
+                    entry.path = path + "/";
+                    entry.metadata.size = 0;
+                    Push(std::move(entry));
+                    Walk(OpenDirectory(directory->Get(), name.c_str(), path), path);
+                    return;
+                }
+                case fsc_path::FileType::SYMLINK:
+                {
+                    char target[PATH_MAX];
+                    FSC_COUNT(SYSCALLS, 1);
+                    ssize_t length{ readlinkat(directory->Get(), name.c_str(), target, sizeof(target)) };
+                    if (length < 0)
+                    {
+                        throw std::filesystem::filesystem_error{ "Failed to read link", path, LastError() };
+                    }
+                    entry.type = symlinkType;
+                    entry.linkTarget.assign(target, static_cast<std::size_t>(length));
+                    entry.metadata.size = 0;
+                    break;
+                }
+                case fsc_path::FileType::REGULAR:
+                {
+                    if (metadata.links > 1)
+                    {
+                        auto [link, inserted]{ hardLinks.try_emplace(std::make_pair(metadata.device, metadata.inode), path) };
+                        if (!inserted)
+                        {
+                            entry.type = hardLinkType;
+                            entry.linkTarget = link->second;
+                            entry.metadata.size = 0;
+                            break;
+                        }
+                    }
+                    entry.type = regularType;
+                    // The directory stays open for as long as an entry in the window still has to open a file in it.
+                    entry.holdsDescriptor = directory != lastDirectory;
+                    lastDirectory = directory;
+                    if (metadata.size > 0 && metadata.size <= smallFileLimit)
+                    {
+                        entry.contents = pool.Submit([directory, name, path, size = metadata.size]()
+                        {
+                            FSC_TRACE_SCOPE("read ahead");
+                            FSC_COUNT(SYSCALLS, 1);
+                            fsc_path::FileDescriptor file{ openat(directory->Get(), name.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC) };
+                            if (!file.IsValid())
+                            {
+                                throw std::filesystem::filesystem_error{ "Failed to open file", path, LastError() };
+                            }
+                            std::vector<char> data(static_cast<std::size_t>(size));
+                            fsc_io::IoScheduler::Operation operation{ fsc_io::GetIoScheduler(), size };
+                            data.resize(ReadAt(file.Get(), data.data(), data.size(), 0, path));
+                            return data;
+                        });
+                    }
+                    else
+                    {
+                        entry.directory = directory;
+                        entry.name = name;
+                    }
+                    break;
+                }
+                default:
+                {
+                    std::cerr << "Skipping special file \"" + path + "\"." << std::endl;
+                    return;
+                }
+                }
+                entry.path = std::move(path);
+                Push(std::move(entry));
+            }
+
+            void Push(PackEntry entry)
+            {
+                if (entry.contents.valid())
+                {
+                    pendingBytes += entry.metadata.size;
+                }
+                if (entry.holdsDescriptor)
+                {
+                    ++pendingDescriptors;
+                }
+                pending.push_back(std::move(entry));
+                FSC_QUEUE_DEPTH(pending.size());
+                while (pending.size() > maxPendingEntries || pendingBytes > maxPendingBytes || pendingDescriptors > maxPendingDescriptors)
+                {
+                    EmitFront();
+                }
+            }
+
+            void EmitFront()
+            {
+                PackEntry entry{ std::move(pending.front()) };
+                pending.pop_front();
+                if (entry.contents.valid())
+                {
+                    pendingBytes -= entry.metadata.size;
+                }
+                if (entry.holdsDescriptor)
+                {
+                    --pendingDescriptors;
+                }
+
+                WriteHeader(entry);
+                if (entry.type == regularType && entry.metadata.size > 0)
+                {
+                    WriteContents(entry);
+                    writer.Pad();
+                }
+                ++result.entries;
+            }
+
+            void WriteHeader(const PackEntry& entry)
+            {
+                Header header{};
+                std::string records;
+
+                const std::string& path{ entry.path };
+                if (path.size() <= sizeof(header.name))
+                {
+                    std::memcpy(header.name, path.data(), path.size());
+                }
+                else
+                {
+                    // ustar splits long paths at a separator into a 155 byte prefix and a 100 byte name.
+                    std::size_t split{ path.find('/', path.size() - sizeof(header.name) - 1) };
+                    if (split != std::string::npos && split <= sizeof(header.prefix) && split + 1 < path.size())
+                    {
+                        std::memcpy(header.prefix, path.data(), split);
+                        std::memcpy(header.name, path.data() + split + 1, path.size() - split - 1);
+                    }
+                    else
+                    {
+                        AppendPaxRecord(records, "path", path);
+                        std::memcpy(header.name, path.data(), sizeof(header.name));
+                    }
+                }
+
+                if (entry.linkTarget.size() > sizeof(header.linkName))
+                {
+                    AppendPaxRecord(records, "linkpath", entry.linkTarget);
+                }
+                std::memcpy(header.linkName, entry.linkTarget.data(), std::min(entry.linkTarget.size(), sizeof(header.linkName)));
+
+                if (!WriteOctal(header.size, sizeof(header.size), entry.metadata.size))
+                {
+                    AppendPaxRecord(records, "size", std::to_string(entry.metadata.size));
+                    WriteOctal(header.size, sizeof(header.size), 0);
+                }
+                if (entry.metadata.user > maxOctalId)
+                {
+                    AppendPaxRecord(records, "uid", std::to_string(entry.metadata.user));
+                }
+                if (entry.metadata.group > maxOctalId)
+                {
+                    AppendPaxRecord(records, "gid", std::to_string(entry.metadata.group));
+                }
+
+                WriteOctal(header.mode, sizeof(header.mode), entry.metadata.mode & 07777);
+                WriteOctal(header.user, sizeof(header.user), entry.metadata.user > maxOctalId ? 0 : entry.metadata.user);
+                WriteOctal(header.group, sizeof(header.group), entry.metadata.group > maxOctalId ? 0 : entry.metadata.group);
+                WriteOctal(header.modified, sizeof(header.modified), static_cast<std::uint64_t>(std::max<std::int64_t>(entry.metadata.modifiedSeconds, 0)));
+                header.type = entry.type;
+                std::memcpy(header.magic, "ustar", 6);
+                std::memcpy(header.version, "00", 2);
+
+                if (!records.empty())
+                {
+                    Header extended{};
+                    constexpr std::string_view extendedName{ "././@PaxHeader" };
+                    std::memcpy(extended.name, extendedName.data(), extendedName.size());
+                    WriteOctal(extended.mode, sizeof(extended.mode), 0644);
+                    WriteOctal(extended.user, sizeof(extended.user), 0);
+                    WriteOctal(extended.group, sizeof(extended.group), 0);
+                    WriteOctal(extended.size, sizeof(extended.size), records.size());
+                    WriteOctal(extended.modified, sizeof(extended.modified), 0);
+                    extended.type = paxType;
+                    std::memcpy(extended.magic, "ustar", 6);
+                    std::memcpy(extended.version, "00", 2);
+                    WriteOctal(extended.checksum, 7, Checksum(extended));
+                    extended.checksum[7] = ' ';
+                    writer.Write(reinterpret_cast<const char*>(&extended), recordSize);
+                    writer.Write(records.data(), records.size());
+                    writer.Pad();
+                }
+
+                WriteOctal(header.checksum, 7, Checksum(header));
+                header.checksum[7] = ' ';
+                writer.Write(reinterpret_cast<const char*>(&header), recordSize);
+            }
+
+            // The header already promised metadata.size bytes, a file that changed while packing is cut or zero padded to it.
+            void WriteContents(PackEntry& entry)
+            {
+                std::uint64_t size{ entry.metadata.size };
+                std::uint64_t copied{ 0 };
+                if (entry.contents.valid())
+                {
+                    std::vector<char> data{ entry.contents.get() };
+                    copied = std::min<std::uint64_t>(data.size(), size);
+                    writer.Write(data.data(), static_cast<std::size_t>(copied));
+                }
+                else
+                {
+                    FSC_COUNT(SYSCALLS, 1);
+                    fsc_path::FileDescriptor file{ openat(entry.directory->Get(), entry.name.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC) };
+                    if (!file.IsValid())
+                    {
+                        throw std::filesystem::filesystem_error{ "Failed to open file", entry.path, LastError() };
+                    }
+                    std::vector<char> buffer(fsc_io::GetCopySettings().blockSize);
+                    while (copied < size)
+                    {
+                        std::size_t wanted{ static_cast<std::size_t>(std::min<std::uint64_t>(buffer.size(), size - copied)) };
+                        fsc_io::IoScheduler::Operation operation{ fsc_io::GetIoScheduler(), wanted };
+                        std::size_t received{ ReadAt(file.Get(), buffer.data(), wanted, copied, entry.path) };
+                        if (received == 0)
+                        {
+                            break;
+                        }
+                        writer.Write(buffer.data(), received);
+                        copied += received;
+                    }
+                }
+
+                if (copied < size)
+                {
+                    std::cerr << "File \"" + entry.path + "\" shrank while packing, padded with zeros." << std::endl;
+                    writer.WriteZeros(size - copied);
+                }
+                FSC_COUNT(BYTES, size);
+            }
+
+            StreamWriter writer;
+            fsc_threads::ThreadPool pool;
+            std::deque<PackEntry> pending;
+            std::uint64_t pendingBytes{ 0 };
+            // Entries are counted when their directory differs from the previous one's, an upper bound on the open handles.
+            std::size_t pendingDescriptors{ 0 };
+            std::size_t maxPendingDescriptors;
+            SharedDescriptor lastDirectory;
+            std::map<std::pair<std::uint64_t, std::uint64_t>, std::string> hardLinks;
+            PackResult result;
+
+        };
+
+        struct ArchiveEntry
+        {
+            std::string path;
+            std::string linkTarget;
+            char type{ regularType };
+            std::uint64_t size{ 0 };
+            std::uint32_t mode{ 0 };
+            std::int64_t modified{ 0 };
+        };
+
+        // Splits an archive path into components, rejecting absolute paths and ".." so nothing lands outside the destination.
+        std::vector<std::string> SplitArchivePath(const std::string& path)
+        {
+            if (!path.empty() && path[0] == '/')
+            {
+                throw std::runtime_error{ "Archive entry \"" + path + "\" is an absolute path." };
+            }
+            std::vector<std::string> components;
+            std::size_t start{ 0 };
+            while (start <= path.size())
+            {
+                std::size_t end{ std::min(path.find('/', start), path.size()) };
+                std::string component{ path.substr(start, end - start) };
+                if (component == "..")
+                {
+                    throw std::runtime_error{ "Archive entry \"" + path + "\" points outside the destination." };
+                }
+                if (!component.empty() && component != ".")
+                {
+                    components.push_back(std::move(component));
+                }
+                start = end + 1;
+            }
+            return components;
+        }
+
+        std::string JoinComponents(const std::vector<std::string>& components, std::size_t count)
+        {
+            std::string path;
+            for (std::size_t i{ 0 }; i < count; ++i)
+            {
+                if (i > 0)
+                {
+                    path += '/';
+                }
+                path += components[i];
+            }
+            return path;
+        }
+
+        struct DirectoryFixup
+        {
+            std::vector<std::string> components;
+            std::uint32_t mode;
+            std::int64_t modified;
+        };
+
+        // Creates entries relative to a stack of open directory handles that follows the archive's walk order, file contents
+        // are written behind on the pool. Directory permissions and times are applied last, once nothing is written below them.
+        class Unpacker
+        {
+        public:
+
+            Unpacker(const fsc_path::ResolvedPath& destination, int input, const UnpackOptions& unpackOptions) :
+                reader{ input }, options{ unpackOptions }, destinationPath{ destination.GetPath() },
+                maxPendingWrites{ std::min(maxPendingEntries, fsc_path::GetDescriptorBudget()) }
+            {
+                root = OpenDirectory(destination.GetDescriptor(), ".", destinationPath);
+            }
+
+            PackResult Run()
+            {
+                ArchiveEntry entry;
+                while (ReadEntry(entry))
+                {
+                    Extract(entry);
+                }
+                reader.Drain();
+
+                while (!pending.empty())
+                {
+                    WaitFront();
+                }
+                for (auto fixup{ fixups.rbegin() }; fixup != fixups.rend(); ++fixup)
+                {
+                    // Through a handle of the directory itself, a symlink that replaced it is not followed.
+                    timespec times[2]{ { 0, UTIME_OMIT }, { static_cast<time_t>(fixup->modified), 0 } };
+                    SharedDescriptor parent{ OpenParent(fixup->components) };
+                    FSC_COUNT(SYSCALLS, 3);
+                    fsc_path::FileDescriptor directory{ openat(parent->Get(), fixup->components.back().c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) };
+                    if (!directory.IsValid())
+                    {
+                        throw std::filesystem::filesystem_error{ "Failed to open directory", destinationPath / JoinComponents(fixup->components, fixup->components.size()), LastError() };
+                    }
+                    fchmod(directory.Get(), fixup->mode);
+                    futimens(directory.Get(), times);
+                }
+                return result;
+            }
+
+        private:
+
+            bool ReadEntry(ArchiveEntry& entry)
+            {
+                std::string paxPath;
+                std::string paxLink;
+                std::optional<std::uint64_t> paxSize;
+                std::optional<std::int64_t> paxModified;
+
+                while (true)
+                {
+                    Header header;
+                    if (!reader.Read(reinterpret_cast<char*>(&header), recordSize))
+                    {
+                        return false;
+                    }
+                    const char* bytes{ reinterpret_cast<const char*>(&header) };
+                    if (std::all_of(bytes, bytes + recordSize, [](char byte) { return byte == '\0'; }))
+                    {
+                        return false;
+                    }
+                    if (ReadNumber(header.checksum, sizeof(header.checksum)) != Checksum(header))
+                    {
+                        throw std::runtime_error{ "Invalid archive header." };
+                    }
+
+                    std::uint64_t size{ ReadNumber(header.size, sizeof(header.size)) };
+                    if (header.type == paxType || header.type == longNameType || header.type == longLinkType)
+                    {
+                        std::string data(static_cast<std::size_t>(size), '\0');
+                        reader.Read(data.data(), data.size());
+                        reader.Skip(PaddingFor(size));
+                        if (header.type == longNameType)
+                        {
+                            paxPath = data.c_str();
+                        }
+                        else if (header.type == longLinkType)
+                        {
+                            paxLink = data.c_str();
+                        }
+                        else
+                        {
+                            ParsePaxRecords(data, paxPath, paxLink, paxSize, paxModified);
+                        }
+                        continue;
+                    }
+                    if (header.type == paxGlobalType)
+                    {
+                        reader.Skip(size + PaddingFor(size));
+                        continue;
+                    }
+
+                    entry.type = header.type;
+                    entry.size = paxSize.value_or(size);
+                    entry.mode = static_cast<std::uint32_t>(ReadNumber(header.mode, sizeof(header.mode)) & 07777);
+                    entry.modified = paxModified.value_or(static_cast<std::int64_t>(ReadNumber(header.modified, sizeof(header.modified))));
+                    if (!paxPath.empty())
+                    {
+                        entry.path = std::move(paxPath);
+                    }
+                    else
+                    {
+                        std::string prefix{ ReadString(header.prefix, sizeof(header.prefix)) };
+                        std::string name{ ReadString(header.name, sizeof(header.name)) };
+                        entry.path = prefix.empty() || std::memcmp(header.magic, "ustar", 5) != 0 ? name : prefix + "/" + name;
+                    }
+                    entry.linkTarget = !paxLink.empty() ? std::move(paxLink) : ReadString(header.linkName, sizeof(header.linkName));
+                    return true;
+                }
+            }
+
+            static void ParsePaxRecords(const std::string& data, std::string& path, std::string& link, std::optional<std::uint64_t>& size, std::optional<std::int64_t>& modified)
+            {
+                std::size_t position{ 0 };
+                while (position < data.size())
+                {
+                    std::size_t space{ data.find(' ', position) };
+                    if (space == std::string::npos)
+                    {
+                        break;
+                    }
+                    std::size_t length{ std::stoull(data.substr(position, space - position)) };
+                    if (length == 0 || position + length > data.size())
+                    {
+                        throw std::runtime_error{ "Invalid pax extended header." };
+                    }
+                    std::string record{ data.substr(space + 1, position + length - space - 2) };
+                    std::size_t equals{ record.find('=') };
+                    if (equals != std::string::npos)
+                    {
+                        std::string key{ record.substr(0, equals) };
+                        std::string value{ record.substr(equals + 1) };
+                        if (key == "path") { path = value; }
+                        else if (key == "linkpath") { link = value; }
+                        else if (key == "size") { size = std::stoull(value); }
+                        else if (key == "mtime") { modified = std::stoll(value); }
+                    }
+                    position += length;
+                }
+            }
+
+            // Reuses the handles shared with the previous entry's directory and opens or creates only the rest.
+            const SharedDescriptor& OpenParent(const std::vector<std::string>& components)
+            {
+                std::size_t depth{ components.size() - 1 };
+                std::size_t common{ 0 };
+                while (common < directories.size() && common < depth && directories[common].first == components[common])
+                {
+                    ++common;
+                }
+                directories.resize(common);
+
+                for (std::size_t i{ common }; i < depth; ++i)
+                {
+                    const SharedDescriptor& parent{ i == 0 ? root : directories[i - 1].second };
+                    const char* name{ components[i].c_str() };
+                    FSC_COUNT(SYSCALLS, 1);
+                    int descriptor{ openat(parent->Get(), name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) };
+                    if (descriptor < 0 && errno == ENOENT)
+                    {
+                        FSC_COUNT(SYSCALLS, 2);
+                        if (mkdirat(parent->Get(), name, 0755) != 0 && errno != EEXIST)
+                        {
+                            throw std::filesystem::filesystem_error{ "Failed to create directory", destinationPath / JoinComponents(components, i + 1), LastError() };
+                        }
+                        descriptor = openat(parent->Get(), name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                    }
+                    if (descriptor < 0)
+                    {
+                        throw std::filesystem::filesystem_error{ "Failed to open directory", destinationPath / JoinComponents(components, i + 1), LastError() };
+                    }
+                    directories.emplace_back(components[i], std::make_shared<fsc_path::FileDescriptor>(descriptor));
+                }
+                return depth == 0 ? root : directories[depth - 1].second;
+            }
+
+            // Existing entries are replaced with -o, otherwise creation fails the whole unpack.
+            bool RemoveExisting(int directory, const std::string& name, const std::string& path)
+            {
+                if (!options.overwrite)
+                {
+                    throw std::runtime_error{ "Item \"" + path + "\" already exists, use flag \"-o\" to overwrite." };
+                }
+                FSC_COUNT(SYSCALLS, 1);
+                return unlinkat(directory, name.c_str(), 0) == 0;
+            }
+
+            void Extract(const ArchiveEntry& entry)
+            {
+                std::vector<std::string> components{ SplitArchivePath(entry.path) };
+                bool hasData{ entry.type == regularType || entry.type == '\0' || entry.type == contiguousType };
+                if (components.empty())
+                {
+                    reader.Skip(entry.size + PaddingFor(entry.size));
+                    return;
+                }
+
+                SharedDescriptor parent{ OpenParent(components) };
+                const std::string& name{ components.back() };
+                std::string path{ JoinComponents(components, components.size()) };
+                switch (entry.type)
+                {
+                case directoryType:
+                {
+                    FSC_COUNT(SYSCALLS, 1);
+                    if (mkdirat(parent->Get(), name.c_str(), 0700) != 0 && errno != EEXIST)
+                    {
+                        throw std::filesystem::filesystem_error{ "Failed to create directory", destinationPath / path, LastError() };
+                    }
+                    fixups.push_back(DirectoryFixup{ components, entry.mode, entry.modified });
+                    break;
+                }
+                case symlinkType:
+                {
+                    FSC_COUNT(SYSCALLS, 1);
+                    while (symlinkat(entry.linkTarget.c_str(), parent->Get(), name.c_str()) != 0)
+                    {
+                        if (errno != EEXIST || !RemoveExisting(parent->Get(), name, (destinationPath / path).string()))
+                        {
+                            throw std::filesystem::filesystem_error{ "Failed to create link", destinationPath / path, LastError() };
+                        }
+                    }
+                    break;
+                }
+                case hardLinkType:
+                {
+                    std::vector<std::string> targetComponents{ SplitArchivePath(entry.linkTarget) };
+                    if (targetComponents.empty())
+                    {
+                        throw std::runtime_error{ "Archive entry \"" + entry.path + "\" links to an empty path." };
+                    }
+                    // Entries are created on this thread, so the target exists even while its contents are still being written.
+                    std::string targetParent{ JoinComponents(targetComponents, targetComponents.size() - 1) };
+                    fsc_path::FileDescriptor targetDirectory{ fcntl(root->Get(), F_DUPFD_CLOEXEC, 0) };
+                    for (std::size_t i{ 0 }; i + 1 < targetComponents.size(); ++i)
+                    {
+                        FSC_COUNT(SYSCALLS, 1);
+                        targetDirectory = fsc_path::FileDescriptor{ openat(targetDirectory.Get(), targetComponents[i].c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) };
+                        if (!targetDirectory.IsValid())
+                        {
+                            throw std::filesystem::filesystem_error{ "Failed to open directory", destinationPath / targetParent, LastError() };
+                        }
+                    }
+                    FSC_COUNT(SYSCALLS, 1);
+                    while (linkat(targetDirectory.Get(), targetComponents.back().c_str(), parent->Get(), name.c_str(), 0) != 0)
+                    {
+                        if (errno != EEXIST || !RemoveExisting(parent->Get(), name, (destinationPath / path).string()))
+                        {
+                            throw std::filesystem::filesystem_error{ "Failed to create link", destinationPath / path, LastError() };
+                        }
+                    }
+                    break;
+                }
+                default:
+                {
+                    if (!hasData)
+                    {
+                        std::cerr << "Skipping unsupported archive entry \"" + entry.path + "\"." << std::endl;
+                        reader.Skip(entry.size + PaddingFor(entry.size));
+                        return;
+                    }
+                    ExtractFile(entry, parent, name, destinationPath / path);
+                    break;
+                }
+                }
+                if (!hasData)
+                {
+                    reader.Skip(entry.size + PaddingFor(entry.size));
+                }
+                ++result.entries;
+            }
+
+            void ExtractFile(const ArchiveEntry& entry, const SharedDescriptor& parent, const std::string& name, const std::filesystem::path& path)
+            {
+                int flags{ O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC | (options.overwrite ? O_TRUNC : O_EXCL) };
+                FSC_COUNT(SYSCALLS, 1);
+                int descriptor{ openat(parent->Get(), name.c_str(), flags, 0600) };
+                // A symlink or directory in the way is replaced rather than written through.
+                if (descriptor < 0 && (errno == ELOOP || errno == EISDIR || errno == EEXIST) && RemoveExisting(parent->Get(), name, path.string()))
+                {
+                    FSC_COUNT(SYSCALLS, 1);
+                    descriptor = openat(parent->Get(), name.c_str(), flags, 0600);
+                }
+                if (descriptor < 0)
+                {
+                    throw std::filesystem::filesystem_error{ "Failed to create file", path, LastError() };
+                }
+                auto file{ std::make_shared<fsc_path::FileDescriptor>(descriptor) };
+                timespec times[2]{ { 0, UTIME_OMIT }, { static_cast<time_t>(entry.modified), 0 } };
+
+                if (entry.size <= smallFileLimit)
+                {
+                    std::vector<char> data(static_cast<std::size_t>(entry.size));
+                    reader.Read(data.data(), data.size());
+                    reader.Skip(PaddingFor(entry.size));
+                    pendingBytes += entry.size;
+                    pending.emplace_back(pool.Submit([file, data = std::move(data), path, mode = entry.mode, times]()
+                    {
+                        FSC_TRACE_SCOPE("write behind");
+                        fsc_io::IoScheduler::Operation operation{ fsc_io::GetIoScheduler(), data.size() };
+                        WriteAt(file->Get(), data.data(), data.size(), path.string());
+                        FSC_COUNT(SYSCALLS, 2);
+                        fchmod(file->Get(), mode);
+                        futimens(file->Get(), times);
+                    }), entry.size);
+                    FSC_QUEUE_DEPTH(pending.size());
+                    while (pending.size() > maxPendingWrites || pendingBytes > maxPendingBytes)
+                    {
+                        WaitFront();
+                    }
+                }
+                else
+                {
+                    std::vector<char> buffer(fsc_io::GetCopySettings().blockSize);
+                    for (std::uint64_t remaining{ entry.size }; remaining > 0;)
+                    {
+                        std::size_t chunk{ static_cast<std::size_t>(std::min<std::uint64_t>(remaining, buffer.size())) };
+                        reader.Read(buffer.data(), chunk);
+                        fsc_io::IoScheduler::Operation operation{ fsc_io::GetIoScheduler(), chunk };
+                        WriteAt(file->Get(), buffer.data(), chunk, path.string());
+                        remaining -= chunk;
+                    }
+                    reader.Skip(PaddingFor(entry.size));
+                    FSC_COUNT(SYSCALLS, 2);
+                    fchmod(file->Get(), entry.mode);
+                    futimens(file->Get(), times);
+                }
+                result.bytes += entry.size;
+                FSC_COUNT(BYTES, entry.size);
+            }
+
+            void WaitFront()
+            {
+                auto [write, size]{ std::move(pending.front()) };
+                pending.pop_front();
+                pendingBytes -= size;
+                write.get();
+            }
+
+            StreamReader reader;
+            UnpackOptions options;
+            std::filesystem::path destinationPath;
+            SharedDescriptor root;
+            std::vector<std::pair<std::string, SharedDescriptor>> directories;
+            std::vector<DirectoryFixup> fixups;
+            fsc_threads::ThreadPool pool;
+            std::deque<std::pair<std::future<void>, std::uint64_t>> pending;
+            std::uint64_t pendingBytes{ 0 };
+            // Every queued write holds its output file open.
+            std::size_t maxPendingWrites;
+            PackResult result;
+
+        };
+    }
+
+    PackResult Pack(const fsc_path::ResolvedPath& source)
+    {
+        if (isatty(STDOUT_FILENO))
+        {
+            throw std::runtime_error{ "Refusing to write an archive to a terminal, redirect the output." };
+        }
+        FSC_TRACE_SCOPE("pack");
+        Packer packer{ STDOUT_FILENO };
+        packer.AddRoot(source);
+        return packer.Finish();
+    }
+
+    PackResult Unpack(const fsc_path::ResolvedPath& destination, const UnpackOptions& options)
+    {
+        if (isatty(STDIN_FILENO))
+        {
+            throw std::runtime_error{ "Refusing to read an archive from a terminal, redirect the input." };
+        }
+        FSC_TRACE_SCOPE("unpack");
+        Unpacker unpacker{ destination, STDIN_FILENO, options };
+        return unpacker.Run();
+    }
+#else
+    PackResult Pack(const fsc_path::ResolvedPath&)
+    {
+        throw std::runtime_error{ "Command \"pack\" is not supported on this platform." };
+    }
+
+    PackResult Unpack(const fsc_path::ResolvedPath&, const UnpackOptions&)
+    {
+        throw std::runtime_error{ "Command \"unpack\" is not supported on this platform." };
+    }
+#endif
+}
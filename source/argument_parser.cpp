@@ -1,11 +1,23 @@
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
 #include <stdexcept>
 #include <algorithm>
+#include <span>
 
 #include "argument_parser.hpp"
 #include "command_list.hpp"
 #include "command_structure.hpp"
 
+namespace
+{
+    bool IsPositional(std::string_view argument) noexcept
+    {
+        return argument.empty() || argument[0] != '-';
+    }
+}
+
 ArgumentParser::ArgumentParser(int argc, char* argv[], const CommandList& commandList)
 {
     if (argc == 1)
@@ -13,108 +25,239 @@ ArgumentParser::ArgumentParser(int argc, char* argv[], const CommandList& comman
         throw std::runtime_error{ "No command provided, see \"help\"." };
     }
 
-    command = argv[1];
-
-    if (!commandList.CommandStructureExists(command))
+    commandStructure = commandList.FindCommandStructure(argv[1]);
+    globalFlags = commandList.GetGlobalFlags();
+    if (commandStructure == nullptr)
     {
         throw std::runtime_error{ "Unknown command, see \"help\"." };
     }
+    if (commandStructure->parameters.size() > maxParameters)
+    {
+        throw std::logic_error{ "Command \"" + std::string{ commandStructure->name } + "\" has too many parameters." };
+    }
 
-    const CommandStructure& commandStructure{ commandList.GetCommandStructure(command) };
-    std::size_t parameterIndex{ 0 };
-    std::size_t argumentsReceived{ 0 };
+    std::size_t argumentsRequired{ 0 };
+    for (const Parameter& parameter : commandStructure->parameters)
+    {
+        if (parameter.requirement == ParameterRequirement::REQUIRED)
+        {
+            argumentsRequired += 1;
+        }
+    }
 
-    for (std::size_t i{ 2 }; i < static_cast<std::size_t>(argc); ++i)
+    rawArguments = std::span<char*>{ argv, static_cast<std::size_t>(argc) }.subspan(2);
+    std::size_t positionalCount{ 0 };
+    for (const char* rawArgument : rawArguments)
     {
-        std::string argument{ argv[i] };
-        if (commandStructure.parameters.size() > parameterIndex)
+        std::string_view argument{ rawArgument };
+        if (IsPositional(argument))
         {
-            if (argument[0] != '-')
-            {
-                arguments[commandStructure.parameters[parameterIndex].name] = argument;
-                argumentsReceived += 1;
-            }
-            else
+            positionalCount += 1;
+        }
+        else
+        {
+            // Flags may only follow once every required parameter has an argument.
+            if (positionalCount < argumentsRequired)
             {
-                if (commandStructure.parameters[parameterIndex].requirement == ParameterRequirement::OPTIONAL)
-                {
-                    AddFlag(argument, commandStructure);
-                }
-                else
+                const Parameter& expected{ commandStructure->parameters[std::min(positionalCount, commandStructure->parameters.size() - 1)] };
+                if (expected.requirement == ParameterRequirement::REQUIRED)
                 {
-                    throw std::runtime_error{ "Expected parameter \"" + commandStructure.parameters[parameterIndex].name + "\", instead got flag \"" + argument + "\"." };
+                    throw std::runtime_error{ "Expected parameter \"" + std::string{ expected.name } + "\", instead got flag \"" + std::string{ argument } + "\"." };
                 }
             }
-            parameterIndex += 1;
+            AddFlag(argument);
         }
-        else
+    }
+    AssignArguments(positionalCount);
+
+    std::string errorMessage;
+    for (std::size_t i{ 0 }; i < commandStructure->parameters.size(); ++i)
+    {
+        if (commandStructure->parameters[i].requirement == ParameterRequirement::REQUIRED && arguments[i] == nullptr)
         {
-            AddFlag(argument, commandStructure);
+            errorMessage += std::string{ commandStructure->parameters[i].name } + " ";
         }
     }
+    if (!errorMessage.empty())
+    {
+        throw std::runtime_error{ "Missing arguments: " + errorMessage };
+    }
+}
 
-    std::size_t argumentsRequired{ 0 };
-    for (const Parameter& parameter : commandStructure.parameters)
+std::string_view ArgumentParser::GetCommand() const noexcept
+{
+    return commandStructure->name;
+}
+
+const CommandStructure& ArgumentParser::GetCommandStructure() const noexcept
+{
+    return *commandStructure;
+}
+
+bool ArgumentParser::HasArgument(std::string_view parameterName) const noexcept
+{
+    std::size_t index{ FindParameter(parameterName) };
+    return index < maxParameters && arguments[index] != nullptr;
+}
+
+std::string_view ArgumentParser::GetArgument(std::string_view parameterName) const noexcept
+{
+    if (!HasArgument(parameterName))
     {
-        if (parameter.requirement == ParameterRequirement::REQUIRED)
+        return {};
+    }
+    return arguments[FindParameter(parameterName)];
+}
+
+std::vector<std::string_view> ArgumentParser::GetFlagValues(FlagId flag) const
+{
+    std::vector<std::string_view> values;
+    for (std::string_view argument : rawArguments)
+    {
+        std::size_t separator{ argument.find('=') };
+        if (!IsPositional(argument) && separator != std::string_view::npos && argument.substr(0, separator) == GetFlagName(flag))
         {
-            argumentsRequired += 1;
+            values.push_back(argument.substr(separator + 1));
         }
     }
+    return values;
+}
 
-    if (argumentsReceived < argumentsRequired)
+std::vector<std::string_view> ArgumentParser::GetArguments(std::string_view parameterName) const
+{
+    std::size_t index{ FindParameter(parameterName) };
+    if (index < maxParameters && commandStructure->parameters[index].repeated)
     {
-        std::string errorMessage;
-        errorMessage += "Missing arguments: ";
-        for (std::size_t i{ argumentsReceived }; i < argumentsRequired;)
+        std::vector<std::string_view> repeatedArguments;
+        repeatedArguments.reserve(repeatedCount);
+        for (std::size_t i{ repeatedBegin }; repeatedArguments.size() < repeatedCount; ++i)
         {
-            if (commandStructure.parameters[i].requirement == ParameterRequirement::REQUIRED)
+            if (IsPositional(rawArguments[i]))
             {
-                errorMessage += commandStructure.parameters[i].name + " ";
-                ++i;
+                repeatedArguments.emplace_back(rawArguments[i]);
             }
         }
-        throw std::runtime_error{ errorMessage };
+        return repeatedArguments;
+    }
+    if (!HasArgument(parameterName))
+    {
+        return {};
     }
+    return { GetArgument(parameterName) };
 }
 
-std::string ArgumentParser::GetCommand() const noexcept
+std::size_t ArgumentParser::FindParameter(std::string_view parameterName) const noexcept
 {
-    return command;
+    for (std::size_t i{ 0 }; i < commandStructure->parameters.size(); ++i)
+    {
+        if (commandStructure->parameters[i].name == parameterName)
+        {
+            return i;
+        }
+    }
+    return maxParameters;
 }
 
-bool ArgumentParser::HasArgument(const std::string& parameterName) const noexcept
+void ArgumentParser::AddFlag(std::string_view argument)
 {
-    return arguments.contains(parameterName);
-}
+    std::size_t separator{ argument.find('=') };
+    std::string_view name{ argument.substr(0, separator) };
 
-std::string ArgumentParser::GetArgument(const std::string& parameterName) const noexcept
-{
-    return arguments.at(parameterName);
-}
+    auto Accept = [&](const Flag& flag)
+    {
+        if (flag.takesValue)
+        {
+            if (separator == std::string_view::npos)
+            {
+                throw std::runtime_error{ "Flag \"" + std::string{ name } + "\" requires a value, use \"" + std::string{ name } + "=<value>\"." };
+            }
+            flagValues[static_cast<std::size_t>(flag.id)] = argument.substr(separator + 1);
+        }
+        else if (separator != std::string_view::npos)
+        {
+            throw std::runtime_error{ "Flag \"" + std::string{ name } + "\" does not take a value." };
+        }
+        flags |= std::uint64_t{ 1 } << static_cast<std::size_t>(flag.id);
+    };
 
-bool ArgumentParser::HasFlag(const std::string& targetFlagName) const noexcept
-{
-    auto it{ std::find_if(flags.begin(), flags.end(),
-        [&targetFlagName](const std::string& flagName)
+    for (std::span<const Flag> table : { commandStructure->flags, globalFlags })
+    {
+        for (const Flag& flag : table)
         {
-            return targetFlagName == flagName;
+            if (flag.name == name)
+            {
+                Accept(flag);
+                return;
+            }
         }
-    ) };
-    return it != flags.end();
+    }
+    throw std::runtime_error{ "Command \"" + std::string{ commandStructure->name } + "\" does not accept flag \"" + std::string{ argument } + "\"." };
 }
 
-void ArgumentParser::AddFlag(const std::string& argument, const CommandStructure& commandStructure)
+// Parameters before and after the repeated one take their arguments first, the repeated parameter gets the rest.
+void ArgumentParser::AssignArguments(std::size_t positionalCount)
 {
-    auto it{ std::find_if(commandStructure.flags.begin(), commandStructure.flags.end(),
-        [&argument](const Flag& flag)
+    std::span<const Parameter> parameters{ commandStructure->parameters };
+    std::size_t repeatedIndex{ parameters.size() };
+    for (std::size_t i{ 0 }; i < parameters.size(); ++i)
+    {
+        if (parameters[i].repeated)
+        {
+            if (repeatedIndex != parameters.size())
+            {
+                throw std::logic_error{ "Command \"" + std::string{ commandStructure->name } + "\" has more than one repeated parameter." };
+            }
+            repeatedIndex = i;
+        }
+    }
+
+    std::size_t cursor{ 0 };
+    auto NextPositional = [&]() noexcept
+    {
+        while (!IsPositional(rawArguments[cursor]))
+        {
+            ++cursor;
+        }
+        return cursor++;
+    };
+
+    if (repeatedIndex == parameters.size())
+    {
+        for (std::size_t i{ 0 }; i < positionalCount; ++i)
+        {
+            std::size_t position{ NextPositional() };
+            if (i < parameters.size())
+            {
+                arguments[i] = rawArguments[position];
+            }
+            else
+            {
+                AddFlag(rawArguments[position]);
+            }
+        }
+        return;
+    }
+
+    std::size_t next{ 0 };
+    for (std::size_t i{ 0 }; i < repeatedIndex && next < positionalCount; ++i, ++next)
+    {
+        arguments[i] = rawArguments[NextPositional()];
+    }
+    // With too few arguments the repeated parameter still takes one, so the missing ones are reported in order.
+    std::size_t trailing{ parameters.size() - repeatedIndex - 1 };
+    std::size_t available{ positionalCount - next };
+    repeatedCount = available > trailing ? available - trailing : std::min<std::size_t>(available, 1);
+    for (std::size_t i{ 0 }; i < repeatedCount; ++i, ++next)
+    {
+        std::size_t position{ NextPositional() };
+        if (i == 0)
         {
-            return flag.name == argument;
+            repeatedBegin = position;
+            arguments[repeatedIndex] = rawArguments[position];
         }
-    ) };
-    if (it == commandStructure.flags.end())
+    }
+    for (std::size_t i{ repeatedIndex + 1 }; i < parameters.size() && next < positionalCount; ++i, ++next)
     {
-        throw std::runtime_error{ "Command \"" + commandStructure.name + "\" does not accept flag \"" + argument + "\"." }; 
+        arguments[i] = rawArguments[NextPositional()];
     }
-    flags.push_back(argument);
-}
\ No newline at end of file
+}
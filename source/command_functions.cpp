@@ -3,15 +3,357 @@
 #include <stdexcept>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <fstream>
+#include <optional>
+#include <algorithm>
+#include <set>
+#include <future>
+#include <functional>
+#include <chrono>
 
 #include "command_structure.hpp"
 #include "command_list.hpp"
 #include "commands.hpp"
 #include "utilities.hpp"
+#include "server.hpp"
+#include "instrumentation.hpp"
+#include "file_operations.hpp"
+#include "path_layer.hpp"
+#include "tree_model.hpp"
+#include "archive.hpp"
+#include "snapshot_store.hpp"
+#include "watcher.hpp"
+#include "io_scheduler.hpp"
+#include "thread_pool.hpp"
+#include "glob.hpp"
+#include "exclude_rules.hpp"
 
 namespace fsc
 {
+    namespace
+    {
+        // Outcomes of a command run on several targets. Operations run on the thread pool, streamed operations on the calling
+        // thread, and every target is reported in argument order; a single target reports its failure as the command's error,
+        // like a single argument command.
+        class Batch
+        {
+        public:
+
+            void Fail(std::string target, std::string error)
+            {
+                items.push_back(Item{ std::move(target), {}, {}, {}, std::move(error) });
+            }
+
+            void Report(std::string target, std::string message)
+            {
+                items.push_back(Item{ std::move(target), {}, {}, std::move(message), {} });
+            }
+
+            void Add(std::string target, std::function<std::string()> operation)
+            {
+                items.push_back(Item{ std::move(target), std::move(operation), {}, {}, {} });
+            }
+
+            // Runs on the calling thread when the target's turn to report comes, for operations that write their own output.
+            void Stream(std::string target, std::function<void()> operation)
+            {
+                items.push_back(Item{ std::move(target), {}, std::move(operation), {}, {} });
+            }
+
+            void Run()
+            {
+                std::vector<std::future<std::string>> results(items.size());
+                fsc_threads::ThreadPool& pool{ fsc_threads::GetSharedPool() };
+                for (std::size_t i{ 0 }; i < items.size(); ++i)
+                {
+                    if (items[i].operation)
+                    {
+                        results[i] = pool.Submit(items[i].operation);
+                    }
+                }
+
+                std::size_t failed{ 0 };
+                for (std::size_t i{ 0 }; i < items.size(); ++i)
+                {
+                    Item& item{ items[i] };
+                    try
+                    {
+                        if (results[i].valid())
+                        {
+                            item.message = results[i].get();
+                        }
+                        else if (item.stream)
+                        {
+                            item.stream();
+                        }
+                    }
+                    catch (const std::exception& error)
+                    {
+                        item.error = error.what();
+                    }
+
+                    if (item.error.empty())
+                    {
+                        std::cout << item.message << std::endl;
+                    }
+                    else if (items.size() == 1)
+                    {
+                        throw std::runtime_error{ item.error };
+                    }
+                    else
+                    {
+                        FSC_COUNT(ERRORS, 1);
+                        std::cerr << "\"" + item.target + "\": " + item.error << std::endl;
+                        ++failed;
+                    }
+                }
+
+                if (failed > 0)
+                {
+                    throw std::runtime_error{ std::to_string(failed) + " of " + std::to_string(items.size()) + " targets failed." };
+                }
+            }
+
+            bool IsEmpty() const noexcept
+            {
+                return items.empty();
+            }
+
+        private:
+
+            struct Item
+            {
+                std::string target;
+                std::function<std::string()> operation;
+                std::function<void()> stream;
+                std::string message;
+                std::string error;
+            };
+
+            std::vector<Item> items;
+
+        };
+
+        // Expands the arguments of a repeated parameter, patterns without matches are recorded as failed targets.
+        std::vector<std::filesystem::path> ExpandTargets(const ArgumentParser& argumentParser, std::string_view parameterName, Batch& batch)
+        {
+            std::vector<std::string_view> arguments{ argumentParser.GetArguments(parameterName) };
+            std::vector<std::filesystem::path> targets;
+            for (fsc_glob::Expansion& expansion : fsc_glob::Expand(arguments))
+            {
+                if (expansion.paths.empty())
+                {
+                    batch.Fail(std::string{ expansion.argument }, "No matches for \"" + std::string{ expansion.argument } + "\".");
+                }
+                for (std::filesystem::path& path : expansion.paths)
+                {
+                    targets.push_back(std::move(path));
+                }
+            }
+            return targets;
+        }
+
+        // Targets inside another target of the same batch must not be operated on concurrently with it.
+        std::optional<std::filesystem::path> FindAncestor(const std::set<std::filesystem::path>& targets, const std::filesystem::path& path)
+        {
+            for (std::filesystem::path parent{ path.parent_path() }; parent.has_relative_path(); parent = parent.parent_path())
+            {
+                if (targets.count(parent) > 0)
+                {
+                    return parent;
+                }
+            }
+            return std::nullopt;
+        }
+
+        enum class DeleteKind
+        {
+            FILE,
+            EMPTY_DIRECTORY,
+            TREE,
+            CONTENTS,
+        };
+
+        DeleteKind ValidateDelete(const fsc_path::ResolvedPath& path, bool recursiveFlag, bool contentsFlag)
+        {
+            if (!path.Exists())
+            {
+                throw std::runtime_error{ "Path does not exists." };
+            }
+            if (!path.IsDirectory())
+            {
+                return DeleteKind::FILE;
+            }
+            if (fsc_operations::IsEmptyDirectory(path))
+            {
+                return DeleteKind::EMPTY_DIRECTORY;
+            }
+            if (!recursiveFlag)
+            {
+                throw std::runtime_error{ "Directory is not empty, use -r flag." };
+            }
+            return contentsFlag ? DeleteKind::CONTENTS : DeleteKind::TREE;
+        }
+
+        std::string DeletePath(const fsc_path::ResolvedPath& path, DeleteKind kind)
+        {
+            std::error_code error;
+            {
+                FSC_TRACE_SCOPE("remove");
+                if (kind == DeleteKind::CONTENTS)
+                {
+                    fsc_operations::RemoveContents(path, error);
+                }
+                else
+                {
+                    fsc_operations::RemoveTree(path, error);
+                }
+            }
+            if (error)
+            {
+                FSC_COUNT(ERRORS, 1);
+                throw std::runtime_error{ "Error: " + error.message() };
+            }
+
+            switch (kind)
+            {
+            case DeleteKind::FILE: return "Deleted file \"" + path.GetPath().string() + "\".";
+            case DeleteKind::EMPTY_DIRECTORY: return "Deleted directory \"" + path.GetPath().string() + "\".";
+            case DeleteKind::CONTENTS: return "Deleted contents of directory \"" + path.GetPath().string() + "\".";
+            default:
+                // Directories holding excluded entries are left in place.
+                if (std::filesystem::exists(std::filesystem::symlink_status(path.GetPath())))
+                {
+                    return "Deleted directory contents except excluded entries \"" + path.GetPath().string() + "\".";
+                }
+                return "Deleted directory and contents \"" + path.GetPath().string() + "\".";
+            }
+        }
+
+        void ReadPath(const fsc_path::ResolvedPath& path)
+        {
+            if (!path.Exists())
+            {
+                throw std::runtime_error{ "Path does not exist." };
+            }
+
+            if (path.IsDirectory())
+            {
+                throw std::runtime_error{ "Specified path is not a file." };
+            }
+
+            fsc_utilities::StreamFile(path.GetPath(), std::cout);
+        }
+
+        std::string ClonePath(const fsc_path::ResolvedPath& target, const fsc_path::ResolvedPath& destination, const fsc_path::ResolvedPath&)
+        {
+            try
+            {
+                FSC_TRACE_SCOPE("copy");
+                fsc_operations::CopyTree(target, destination, target.GetName());
+                return "Cloned \"" + target.GetName() + "\" to \"" + destination.GetPath().string() + "\".";
+            }
+            catch (const std::filesystem::filesystem_error& error)
+            {
+                throw std::runtime_error{ std::string{ "Error: " } + error.what() };
+            }
+        }
+
+        std::string MovePath(const fsc_path::ResolvedPath& target, const fsc_path::ResolvedPath& destination, const fsc_path::ResolvedPath& item)
+        {
+            try
+            {
+                std::error_code error;
+                {
+                    FSC_TRACE_SCOPE("rename");
+                    fsc_operations::Rename(target, item, error);
+                }
+                if (error)
+                {
+                    FSC_TRACE_SCOPE("copy");
+                    fsc_operations::CopyTree(target, destination, target.GetName());
+                    error.clear();
+                    fsc_operations::RemoveTree(target, error);
+                    if (error)
+                    {
+                        throw std::filesystem::filesystem_error{ "Failed to remove moved target", target.GetPath(), error };
+                    }
+                }
+                return "Moved \"" + target.GetName() + "\" to \"" + destination.GetPath().string() + "\".";
+            }
+            catch (const std::filesystem::filesystem_error& error)
+            {
+                throw std::runtime_error{ std::string{ "Error: " } + error.what() };
+            }
+        }
+
+        // The destination is validated once, then every target against it. Duplicate names and nested targets fail and all
+        // prompts are answered before anything runs.
+        template<typename Operation>
+        void RunMoveBatch(const ArgumentParser& argumentParser, Operation operation)
+        {
+            Batch batch;
+            std::vector<std::filesystem::path> targetPaths{ ExpandTargets(argumentParser, "target", batch) };
+            fsc_path::ResolvedPath destination{ argumentParser.GetArgument("destination") };
+            if (batch.IsEmpty() && targetPaths.size() == 1)
+            {
+                fsc_path::ResolvedPath target{ targetPaths.front() };
+                std::optional<fsc_path::ResolvedPath> item{ fsc_utilities::ValidateMove(target, destination, argumentParser.HasFlag(FlagId::OVERWRITE), argumentParser.HasFlag(FlagId::SILENT)) };
+                if (item)
+                {
+                    std::cout << operation(target, destination, *item) << std::endl;
+                }
+                return;
+            }
+            fsc_utilities::ValidateDestination(destination);
+
+            std::vector<fsc_path::ResolvedPath> targets;
+            std::vector<fsc_path::ResolvedPath> items;
+            targets.reserve(targetPaths.size());
+            items.reserve(targetPaths.size());
+            std::set<std::filesystem::path> resolvedPaths;
+            std::set<std::string> names;
+            {
+                FSC_TRACE_SCOPE("validate");
+                for (const std::filesystem::path& targetPath : targetPaths)
+                {
+                    targets.emplace_back(targetPath);
+                    resolvedPaths.insert(targets.back().GetPath());
+                }
+                for (std::size_t i{ 0 }; i < targets.size(); ++i)
+                {
+                    const fsc_path::ResolvedPath& target{ targets[i] };
+                    std::string targetName{ targetPaths[i].string() };
+                    try
+                    {
+                        if (std::optional<std::filesystem::path> ancestor{ FindAncestor(resolvedPaths, target.GetPath()) })
+                        {
+                            throw std::runtime_error{ "Target is inside another target \"" + ancestor->string() + "\"." };
+                        }
+                        if (!names.insert(target.GetName()).second)
+                        {
+                            throw std::runtime_error{ "Another target is also named \"" + target.GetName() + "\"." };
+                        }
+                        std::optional<fsc_path::ResolvedPath> item{ fsc_utilities::ValidateMoveTarget(target, destination, argumentParser.HasFlag(FlagId::OVERWRITE), argumentParser.HasFlag(FlagId::SILENT)) };
+                        if (!item)
+                        {
+                            batch.Report(std::move(targetName), "Skipped \"" + target.GetName() + "\".");
+                            continue;
+                        }
+                        items.push_back(std::move(*item));
+                        batch.Add(std::move(targetName), [&target, &destination, &destinationItem = items.back(), operation]() { return operation(target, destination, destinationItem); });
+                    }
+                    catch (const std::exception& error)
+                    {
+                        batch.Fail(std::move(targetName), error.what());
+                    }
+                }
+            }
+            batch.Run();
+        }
+    }
+
     void Help(const ArgumentParser& argumentParser)
     {
         auto OutputCommandStructure = [](const CommandStructure& commandStructure)
@@ -23,7 +365,7 @@ namespace fsc
             {
                 for (const Parameter& parameter : commandStructure.parameters)
                 {
-                    std::cout << "    (" << parameter.name << ") purpose: " << parameter.purpose << " required: ";
+                    std::cout << "    (" << parameter.name << (parameter.repeated ? "..." : "") << ") purpose: " << parameter.purpose << " required: ";
                     if (parameter.requirement == ParameterRequirement::REQUIRED)
                     {
                         std::cout << "true";
@@ -46,7 +388,7 @@ namespace fsc
             {
                 for (const Flag& flag : commandStructure.flags)
                 {
-                    std::cout << "    " << flag.name << " (" + flag.purpose << ")\n";
+                    std::cout << "    " << flag.name << " (" << flag.purpose << ")\n";
                 }
             }
             else
@@ -59,24 +401,32 @@ namespace fsc
         const CommandList& commandList{ fsc::GetCommandList() };
         if (argumentParser.HasArgument("command"))
         {
-            std::string command{ argumentParser.GetArgument("command") };
-            if (commandList.CommandStructureExists(command))
+            std::string_view command{ argumentParser.GetArgument("command") };
+            const CommandStructure* commandStructure{ commandList.FindCommandStructure(command) };
+            if (commandStructure != nullptr)
             {
-                OutputCommandStructure(commandList.GetCommandStructure(command));
+                OutputCommandStructure(*commandStructure);
             }
             else
             {
-                throw std::runtime_error{ "Cannot help with unknown command \"" + command + "\"." };
+                throw std::runtime_error{ "Cannot help with unknown command \"" + std::string{ command } + "\"." };
             }
         }
         else
         {
             std::cout << "Command structure: fsc <command> <parameters> <flags>\n";
-            const std::vector<CommandStructure>& allCommandStructures{ commandList.GetCommandStructures() };
-            for (const CommandStructure& commandStructure : allCommandStructures)
+            for (const CommandStructure& commandStructure : commandList.GetCommandStructures())
             {
                 OutputCommandStructure(commandStructure);
             }
+
+            std::cout << "\n";
+            std::cout << "Global flags:" << "\n";
+            for (const Flag& flag : commandList.GetGlobalFlags())
+            {
+                std::cout << "    " << flag.name << " (" << flag.purpose << ")\n";
+            }
+            std::cout << std::flush;
         }
     }
 
@@ -89,8 +439,8 @@ namespace fsc
         }
         path = std::filesystem::absolute(path);
 
-        bool fileFlag{ argumentParser.HasFlag("-f") };
-        bool directoryFlag{ argumentParser.HasFlag("-d") };
+        bool fileFlag{ argumentParser.HasFlag(FlagId::FILES) };
+        bool directoryFlag{ argumentParser.HasFlag(FlagId::DIRECTORY) };
         
         if (fileFlag && directoryFlag)
         {
@@ -122,7 +472,7 @@ namespace fsc
                 throw std::runtime_error{ "Error creating file." };
             }
 
-            if (!argumentParser.HasFlag("-n"))
+            if (!argumentParser.HasFlag(FlagId::NO_GUARDS))
             {
                 if (path.extension() == ".hpp" || path.extension() == ".inl" || path.extension() == ".ipp" || path.extension() == ".tpp" || path.extension() == ".hxx")
                 {
@@ -159,89 +509,103 @@ namespace fsc
 
     void Delete(const ArgumentParser& argumentParser)
     {
-        std::filesystem::path path{ argumentParser.GetArgument("path") };
-        if (!std::filesystem::exists(path))
-        {
-            throw std::runtime_error{ "Path does not exists." };
-        }
-        path = std::filesystem::canonical(path).make_preferred();
-
-        if (std::filesystem::is_directory(path))
-        {
-            if (std::filesystem::is_empty(path))
+        bool recursiveFlag{ argumentParser.HasFlag(FlagId::RECURSIVE) };
+        bool contentsFlag{ argumentParser.HasFlag(FlagId::CONTENTS) };
+        Batch batch;
+        std::vector<std::filesystem::path> targetPaths{ ExpandTargets(argumentParser, "path", batch) };
+        if (batch.IsEmpty() && targetPaths.size() == 1)
+        {
+            fsc_path::ResolvedPath path{ targetPaths.front() };
+            DeleteKind kind{ ValidateDelete(path, recursiveFlag, contentsFlag) };
+            if ((kind == DeleteKind::TREE || kind == DeleteKind::CONTENTS) && !argumentParser.HasFlag(FlagId::SILENT))
             {
-                std::error_code error;
-                std::filesystem::remove(path, error);
-                if (error)
+                std::string promptMessage;
+                if (kind == DeleteKind::CONTENTS)
                 {
-                    throw std::runtime_error{ "Error: " + error.message() };
+                    promptMessage = "Delete contents of directory? \"" + path.GetPath().string() + "\"";
                 }
-                std::cout << "Deleted directory \"" + path.string() + "\"." << std::endl;
-            }
-            else
-            {
-                if (!argumentParser.HasFlag("-r"))
+                else
                 {
-                    throw std::runtime_error{ "Directory is not empty, use -r flag." };
+                    promptMessage = "Delete directory and contents? \"" + path.GetPath().string() + "\"";
                 }
-
-                if (!argumentParser.HasFlag("-s"))
+                if (!fsc_utilities::PromptConfirmation(promptMessage))
                 {
-                    std::string promptMessage;
-                    if (argumentParser.HasFlag("-c"))
-                    {
-                        promptMessage = "Delete contents of directory? \"" + path.string() + "\"";
-                    }
-                    else
-                    {
-                        promptMessage = "Delete directory and contents? \"" + path.string() + "\"";
-                    }
-                    if (!fsc_utilities::PromptConfirmation(promptMessage))
-                    {
-                        return;
-                    }
+                    return;
                 }
+            }
+            std::cout << DeletePath(path, kind) << std::endl;
+            return;
+        }
 
-                std::error_code error;
-                if (argumentParser.HasFlag("-c"))
+        // Everything is validated before the single prompt, so nothing is deleted when any confirmation is declined.
+        struct Planned
+        {
+            fsc_path::ResolvedPath path;
+            DeleteKind kind{ DeleteKind::FILE };
+            std::string error;
+            // Names the same entry as an earlier target, which deletes it.
+            bool duplicate{ false };
+        };
+
+        std::vector<Planned> targets;
+        targets.reserve(targetPaths.size());
+        std::set<std::filesystem::path> resolvedPaths;
+        std::size_t planned{ 0 };
+        std::size_t withContents{ 0 };
+        {
+            FSC_TRACE_SCOPE("validate");
+            for (const std::filesystem::path& targetPath : targetPaths)
+            {
+                Planned& target{ targets.emplace_back(Planned{ fsc_path::ResolvedPath{ targetPath }, DeleteKind::FILE, {}, false }) };
+                try
                 {
-                    for (auto& entry : std::filesystem::directory_iterator(path))
+                    target.kind = ValidateDelete(target.path, recursiveFlag, contentsFlag);
+                    target.duplicate = !resolvedPaths.insert(target.path.GetPath()).second;
+                    if (!target.duplicate)
                     {
-                        std::filesystem::remove_all(entry.path(), error);
-                        if (error)
-                        {
-                            break;
-                        }
+                        ++planned;
+                        withContents += target.kind == DeleteKind::TREE || target.kind == DeleteKind::CONTENTS ? 1 : 0;
                     }
                 }
-                else
+                catch (const std::exception& error)
                 {
-                    std::filesystem::remove_all(path, error);
-                }
-                if (error)
-                {
-                    throw std::runtime_error{ "Error: " + error.message() };
-                }
-                if (argumentParser.HasFlag("-c"))
-                {
-                    std::cout << "Deleted contents of directory \"" + path.string() + "\"." << std::endl;
-                }
-                else
-                {
-                    std::cout << "Deleted directory and contents \"" + path.string() + "\"." << std::endl;
+                    target.error = error.what();
                 }
             }
         }
-        else
+
+        if (withContents > 0 && !argumentParser.HasFlag(FlagId::SILENT))
         {
-            std::error_code error;
-            std::filesystem::remove(path, error);
-            if (error)
+            std::string promptMessage{ "Delete " + std::to_string(planned) + " targets including the contents of " + std::to_string(withContents) + " directories?" };
+            if (!fsc_utilities::PromptConfirmation(promptMessage))
             {
-                throw std::runtime_error{ "Error: " + error.message() };
+                return;
+            }
+        }
+
+        for (std::size_t i{ 0 }; i < targets.size(); ++i)
+        {
+            const Planned& target{ targets[i] };
+            std::string targetName{ targetPaths[i].string() };
+            std::optional<std::filesystem::path> ancestor{ FindAncestor(resolvedPaths, target.path.GetPath()) };
+            if (!target.error.empty())
+            {
+                batch.Fail(std::move(targetName), target.error);
+            }
+            else if (ancestor)
+            {
+                batch.Report(std::move(targetName), "Deleted with \"" + ancestor->string() + "\".");
+            }
+            else if (target.duplicate)
+            {
+                batch.Report(std::move(targetName), "Deleted with \"" + target.path.GetPath().string() + "\".");
+            }
+            else
+            {
+                batch.Add(std::move(targetName), [&target]() { return DeletePath(target.path, target.kind); });
             }
-            std::cout << "Deleted file \"" + path.string() + "\"." << std::endl;
         }
+        batch.Run();
     }
 
     void List(const ArgumentParser& argumentParser)
@@ -256,58 +620,118 @@ namespace fsc
             path = std::filesystem::current_path();
         }
 
-        if (!std::filesystem::exists(path))
+        fsc_path::ResolvedPath resolvedPath{ path };
+        if (!resolvedPath.Exists())
         {
             throw std::runtime_error{ "Path does not exist." };
         }
-        path = std::filesystem::canonical(path).make_preferred();
+        path = resolvedPath.GetPath();
+        path.make_preferred();
 
-        if (!std::filesystem::is_directory(path))
+        if (!resolvedPath.IsDirectory())
         {
             throw std::runtime_error{ "Specified path is a file." };
         }
 
-        bool filesOnly{ argumentParser.HasFlag("-f") };
-        bool directoriesOnly{ argumentParser.HasFlag("-d") };
+        bool filesOnly{ argumentParser.HasFlag(FlagId::FILES) };
+        bool directoriesOnly{ argumentParser.HasFlag(FlagId::DIRECTORY) };
         
         if (filesOnly && directoriesOnly)
         {
             throw std::runtime_error{ "Flags \"-f\" and \"-d\" cannot be used at the same time." };
         }
 
-        auto ListPath = [filesOnly, directoriesOnly](std::filesystem::path path)
+        auto PrintEntry = [filesOnly, directoriesOnly](bool isDirectory, std::string_view name)
         {
-            if (std::filesystem::is_directory(path))
+            if (isDirectory)
             {
                 if (!filesOnly)
                 {
-                    std::cout << "D: " + path.filename().string() << "\n";
+                    std::cout << "D: " << name << "\n";
                 }
             }
             else
             {
                 if (!directoriesOnly)
                 {
-                    std::cout << "F: " + path.filename().string() << "\n";
+                    std::cout << "F: " << name << "\n";
                 }
             }
         };
 
+        auto ListPath = [&PrintEntry](const std::filesystem::directory_entry& entry)
+        {
+            FSC_COUNT(ENTRIES, 1);
+            PrintEntry(entry.is_directory(), entry.path().filename().string());
+        };
+
         try
         {
-            if (argumentParser.HasFlag("-r"))
+            if (argumentParser.HasFlag(FlagId::SORTED))
             {
-                for (const auto& entry : std::filesystem::recursive_directory_iterator(path))
+                fsc_tree::BuildOptions options;
+                options.recursive = argumentParser.HasFlag(FlagId::RECURSIVE);
+                options.sortByName = true;
+                options.metadata = false;
+                fsc_tree::TreeModel tree{ fsc_tree::TreeModel::Build(resolvedPath, options) };
+
+                FSC_TRACE_SCOPE("walk");
+                std::vector<fsc_tree::EntryIndex> pending;
+                auto PushChildren = [&tree, &pending](fsc_tree::EntryIndex index)
+                {
+                    std::uint32_t count{ tree.GetChildCount(index) };
+                    for (std::uint32_t child{ count }; child > 0; --child)
+                    {
+                        pending.push_back(tree.GetFirstChild(index) + child - 1);
+                    }
+                };
+                PushChildren(tree.GetRoot());
+                while (!pending.empty())
                 {
-                    ListPath(entry.path());    
+                    fsc_tree::EntryIndex index{ pending.back() };
+                    pending.pop_back();
+                    // Symbolic links are listed by their target, as in the unsorted listing, but never descended into.
+                    fsc_path::FileType type{ tree.GetType(index) };
+                    std::error_code error;
+                    bool isDirectory{ type == fsc_path::FileType::DIRECTORY || (type == fsc_path::FileType::SYMLINK && std::filesystem::is_directory(tree.GetPath(index), error)) };
+                    PrintEntry(isDirectory, tree.GetName(index));
+                    PushChildren(index);
                 }
             }
             else
             {
-               for (const auto& entry : std::filesystem::directory_iterator(path))
+                FSC_TRACE_SCOPE("walk");
+                fsc_exclude::Scope scope{ fsc_exclude::Open(resolvedPath) };
+                if (argumentParser.HasFlag(FlagId::RECURSIVE))
+                {
+                    // The scope of each open directory, indexed by the depth of its entries.
+                    std::vector<fsc_exclude::Scope> scopes{ scope };
+                    for (std::filesystem::recursive_directory_iterator entry{ path }; entry != std::filesystem::recursive_directory_iterator{}; ++entry)
+                    {
+                        scopes.resize(static_cast<std::size_t>(entry.depth()) + 1);
+                        bool isDirectory{ entry->is_directory() && !entry->is_symlink() };
+                        if (scopes.back().IsExcluded(entry->path().filename().string(), isDirectory))
+                        {
+                            entry.disable_recursion_pending();
+                            continue;
+                        }
+                        ListPath(*entry);
+                        if (isDirectory)
+                        {
+                            scopes.push_back(scopes.back().Enter(entry->path()));
+                        }
+                    }
+                }
+                else
                 {
-                    ListPath(entry.path());    
-                } 
+                   for (const auto& entry : std::filesystem::directory_iterator(path))
+                    {
+                        if (!scope.IsExcluded(entry.path().filename().string(), entry.is_directory() && !entry.is_symlink()))
+                        {
+                            ListPath(entry);
+                        }
+                    } 
+                }
             }
             std::cout << std::flush;
         }
@@ -319,43 +743,94 @@ namespace fsc
 
     void Read(const ArgumentParser& argumentParser)
     {
-        std::filesystem::path path{ argumentParser.GetArgument("path") };
-        if (!std::filesystem::exists(path))
+        Batch batch;
+        std::vector<std::filesystem::path> targetPaths{ ExpandTargets(argumentParser, "path", batch) };
+        // Files are streamed one at a time in argument order, only one of them is open and none is held in memory.
+        for (const std::filesystem::path& targetPath : targetPaths)
         {
-            throw std::runtime_error{ "Path does not exist." };
+            batch.Stream(targetPath.string(), [&targetPath]() { ReadPath(fsc_path::ResolvedPath{ targetPath }); });
         }
+        batch.Run();
+    }
 
-        if (std::filesystem::is_directory(path))
-        {
-            throw std::runtime_error{ "Specified path is not a file." };
-        }
+    void Clone(const ArgumentParser& argumentParser)
+    {
+        RunMoveBatch(argumentParser, ClonePath);
+    }
 
-        std::cout << fsc_utilities::ReadFile(path) << std::endl;
+    void Move(const ArgumentParser& argumentParser)
+    {
+        RunMoveBatch(argumentParser, MovePath);
     }
 
-    void Clone(const ArgumentParser& argumentParser)
+    void Rename(const ArgumentParser& argumentParser)
     {
-        std::filesystem::path target{ argumentParser.GetArgument("target") };
-        std::filesystem::path destination{ argumentParser.GetArgument("destination") };
-        bool validated{ fsc_utilities::ValidateMove(target, destination, argumentParser.HasFlag("-o"), argumentParser.HasFlag("-s")) };
-        if (!validated)
+        fsc_path::ResolvedPath target{ argumentParser.GetArgument("target") };
+        std::string newName{ argumentParser.GetArgument("new name") };
+
+        if (!target.Exists())
         {
-            return;
+            throw std::runtime_error{ "Target does not exist." };
         }
-        target = std::filesystem::canonical(target);
-        destination = std::filesystem::canonical(destination);
 
-        try
+        fsc_path::ResolvedPath newPath{ target.Sibling(newName) };
+        if (newPath.Exists())
         {
-            if (std::filesystem::is_directory(target))
+            if (!argumentParser.HasFlag(FlagId::OVERWRITE))
             {
-                std::filesystem::copy(target, destination / target.filename(), std::filesystem::copy_options::recursive | std::filesystem::copy_options::overwrite_existing);
+                throw std::runtime_error{ "Item with name \"" + newName + "\" already exists. Use flag \"-o\" to overwrite." };
             }
-            else
+            else if (!argumentParser.HasFlag(FlagId::SILENT))
             {
-                std::filesystem::copy(target, destination, std::filesystem::copy_options::recursive | std::filesystem::copy_options::overwrite_existing);
+                if (!fsc_utilities::PromptConfirmation("Overwrite item? \"" + newPath.GetPath().string() + "\"."))
+                {
+                    return;
+                }
             }
-            std::cout << "Cloned \"" + target.filename().string() + "\" to \"" + destination.string() + "\"." << std::endl;
+        }
+
+        std::error_code error;
+        {
+            FSC_TRACE_SCOPE("rename");
+            fsc_operations::Rename(target, newPath, error);
+        }
+        if (error)
+        {
+            throw std::runtime_error{ "Error: " + error.message() };
+        }
+        std::cout << "Renamed \"" + target.GetPath().string() + "\" to " + newPath.GetName() << "\".";
+    }
+
+    void Version(const ArgumentParser&)
+    {
+        std::cout << "fsc version: 1.0.0" << std::endl;
+    }
+
+    void Serve(const ArgumentParser& argumentParser)
+    {
+        std::string socketPath;
+        if (argumentParser.HasArgument("socket"))
+        {
+            socketPath = argumentParser.GetArgument("socket");
+        }
+        else
+        {
+            socketPath = fsc_server::GetDefaultSocketPath();
+        }
+        fsc_server::Serve(socketPath);
+    }
+
+    void Pack(const ArgumentParser& argumentParser)
+    {
+        fsc_path::ResolvedPath source{ argumentParser.GetArgument("path") };
+        if (!source.Exists())
+        {
+            throw std::runtime_error{ "Path does not exist." };
+        }
+
+        try
+        {
+            fsc_archive::Pack(source);
         }
         catch (const std::filesystem::filesystem_error& error)
         {
@@ -363,35 +838,34 @@ namespace fsc
         }
     }
 
-    void Move(const ArgumentParser& argumentParser)
+    void Unpack(const ArgumentParser& argumentParser)
     {
-        std::filesystem::path target{ argumentParser.GetArgument("target") };
-        std::filesystem::path destination{ argumentParser.GetArgument("destination") };
-        bool validated{ fsc_utilities::ValidateMove(target, destination, argumentParser.HasFlag("-o"), argumentParser.HasFlag("-s")) };
-        if (!validated)
+        std::filesystem::path path;
+        if (argumentParser.HasArgument("destination"))
         {
-            return;
+            path = argumentParser.GetArgument("destination");
+        }
+        else
+        {
+            path = std::filesystem::current_path();
+        }
+
+        fsc_path::ResolvedPath destination{ path };
+        if (!destination.Exists())
+        {
+            throw std::runtime_error{ "Destination does not exist." };
+        }
+        if (!destination.IsDirectory())
+        {
+            throw std::runtime_error{ "Destination is not a directory." };
         }
-        target = std::filesystem::canonical(target);
-        destination = std::filesystem::canonical(destination);
 
         try
         {
-            std::error_code error;
-            std::filesystem::rename(target, destination, error);
-            if (error)
-            {
-                if (std::filesystem::is_directory(target))
-                {
-                    std::filesystem::copy(target, destination / target.filename(), std::filesystem::copy_options::recursive | std::filesystem::copy_options::overwrite_existing);
-                }
-                else
-                {
-                    std::filesystem::copy(target, destination, std::filesystem::copy_options::recursive | std::filesystem::copy_options::overwrite_existing);
-                }
-                std::filesystem::remove_all(target);
-            }
-            std::cout << "Moved \"" + target.filename().string() + "\" to \"" + destination.string() + "\"." << std::endl;
+            fsc_archive::UnpackOptions options;
+            options.overwrite = argumentParser.HasFlag(FlagId::OVERWRITE);
+            fsc_archive::PackResult result{ fsc_archive::Unpack(destination, options) };
+            std::cout << "Unpacked " << result.entries << " entries to \"" + destination.GetPath().string() + "\"." << std::endl;
         }
         catch (const std::filesystem::filesystem_error& error)
         {
@@ -399,49 +873,92 @@ namespace fsc
         }
     }
 
-    void Rename(const ArgumentParser& argumentParser)
+    void Snapshot(const ArgumentParser& argumentParser)
     {
-        std::filesystem::path target{ argumentParser.GetArgument("target") };
-        std::string newName{ argumentParser.GetArgument("new name") };
+        fsc_path::ResolvedPath source{ argumentParser.GetArgument("path") };
+        if (!source.Exists())
+        {
+            throw std::runtime_error{ "Path does not exist." };
+        }
 
-        if (!std::filesystem::exists(target))
+        try
         {
-            throw std::runtime_error{ "Target does not exist." };
+            fsc_snapshot::SnapshotResult result{ fsc_snapshot::Snapshot(source, argumentParser.GetArgument("store")) };
+            std::cout << "Snapshot \"" + result.id + "\" of \"" + source.GetPath().string() + "\": " << result.files << " files, " << result.unchangedFiles << " unchanged, "
+                << result.newChunks << " of " << result.chunks << " chunks new (" << result.newBytes << " bytes)." << std::endl;
         }
-        target = std::filesystem::canonical(target);
+        catch (const std::filesystem::filesystem_error& error)
+        {
+            throw std::runtime_error{ std::string{ "Error: " } + error.what() };
+        }
+    }
 
-        std::filesystem::path newPath{ target.parent_path() / newName };
-        bool itemWithNameAlreadyExists{ std::filesystem::exists(newPath) };
+    void Restore(const ArgumentParser& argumentParser)
+    {
+        fsc_path::ResolvedPath destination{ argumentParser.GetArgument("destination") };
+        if (!destination.Exists())
+        {
+            throw std::runtime_error{ "Destination does not exist." };
+        }
+        if (!destination.IsDirectory())
+        {
+            throw std::runtime_error{ "Destination is not a directory." };
+        }
 
-        if (itemWithNameAlreadyExists)
+        std::string id;
+        if (argumentParser.HasArgument("snapshot"))
         {
-            newPath = std::filesystem::canonical(newPath);
-            if (!argumentParser.HasFlag("-o"))
-            {
-                throw std::runtime_error{ "Item with name \"" + newName + "\" already exists. Use flag \"-o\" to overwrite." };
-            }
-            else if (!argumentParser.HasFlag("-s"))
-            {
-                if (!fsc_utilities::PromptConfirmation("Overwrite item? \"" + std::filesystem::canonical(newPath).string() + "\"."))
-                {
-                    return;
-                }
-            }
+            id = argumentParser.GetArgument("snapshot");
         }
 
         try
         {
-            std::filesystem::rename(target, newPath); 
-            std::cout << "Renamed \"" + target.string() + "\" to " + newPath.filename().string() << "\".";
+            fsc_snapshot::RestoreOptions options;
+            options.overwrite = argumentParser.HasFlag(FlagId::OVERWRITE);
+            fsc_snapshot::RestoreResult result{ fsc_snapshot::Restore(argumentParser.GetArgument("store"), id, destination, options) };
+            std::cout << "Restored snapshot \"" + result.id + "\" to \"" + destination.GetPath().string() + "\" (" << result.entries << " entries)." << std::endl;
         }
-        catch (const std::runtime_error& error)
+        catch (const std::filesystem::filesystem_error& error)
         {
             throw std::runtime_error{ std::string{ "Error: " } + error.what() };
         }
     }
 
-    void Version(const ArgumentParser&)
+    void Watch(const ArgumentParser& argumentParser)
     {
-        std::cout << "fsc version: 1.0.0" << std::endl;
+        fsc_path::ResolvedPath target{ argumentParser.GetArgument("target") };
+        fsc_path::ResolvedPath destination{ argumentParser.GetArgument("destination") };
+        if (target.Exists() && !target.IsDirectory())
+        {
+            throw std::runtime_error{ "Target is not a directory." };
+        }
+
+        // A mirror inside its own target would keep copying itself.
+        std::filesystem::path nested{ destination.GetPath().lexically_relative(target.GetPath()) };
+        if (!nested.empty() && *nested.begin() != "..")
+        {
+            throw std::runtime_error{ "Destination is inside the target." };
+        }
+
+        std::optional<fsc_path::ResolvedPath> item{ fsc_utilities::ValidateMove(target, destination, argumentParser.HasFlag(FlagId::OVERWRITE), argumentParser.HasFlag(FlagId::SILENT)) };
+        if (!item)
+        {
+            return;
+        }
+
+        fsc_watch::WatchOptions options;
+        if (argumentParser.HasFlag(FlagId::DEBOUNCE))
+        {
+            options.debounce = std::chrono::duration_cast<std::chrono::milliseconds>(fsc_io::ParseDuration("--debounce", argumentParser.GetFlagValue(FlagId::DEBOUNCE)));
+        }
+
+        try
+        {
+            fsc_watch::Watch(target, destination, target.GetName(), options);
+        }
+        catch (const std::filesystem::filesystem_error& error)
+        {
+            throw std::runtime_error{ std::string{ "Error: " } + error.what() };
+        }
     }
-}
\ No newline at end of file
+}
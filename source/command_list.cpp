@@ -1,45 +1,47 @@
-#include <vector>
 #include <string>
-#include <algorithm>
+#include <string_view>
+#include <span>
 #include <stdexcept>
 
 #include "command_list.hpp"
 #include "command_structure.hpp"
 
-void CommandList::AddCommandStructure(CommandStructure commandStructure) noexcept
+std::span<const CommandStructure> CommandList::GetCommandStructures() const noexcept
 {
-    commandStructures.push_back(commandStructure);
+    return commandStructures;
 }
 
-const std::vector<CommandStructure>& CommandList::GetCommandStructures() const noexcept
+std::span<const Flag> CommandList::GetGlobalFlags() const noexcept
 {
-    return commandStructures;
+    return globalFlags;
 }
 
-bool CommandList::CommandStructureExists(const std::string& commandName) const noexcept
+const CommandStructure* CommandList::FindCommandStructure(std::string_view commandName) const noexcept
 {
-    try
+    std::uint8_t slot{ slots[Hash(commandName, seed) % slotCount] };
+    if (slot == 0)
     {
-        GetCommandStructure(commandName);
+        return nullptr;
     }
-    catch (const std::runtime_error& error)
+    const CommandStructure& commandStructure{ commandStructures[slot - 1u] };
+    if (commandStructure.name != commandName)
     {
-        return false;
+        return nullptr;
     }
-    return true;
+    return &commandStructure;
+}
+
+bool CommandList::CommandStructureExists(std::string_view commandName) const noexcept
+{
+    return FindCommandStructure(commandName) != nullptr;
 }
 
-CommandStructure CommandList::GetCommandStructure(const std::string& commandName) const
+const CommandStructure& CommandList::GetCommandStructure(std::string_view commandName) const
 {
-    auto it{ std::find_if(commandStructures.begin(), commandStructures.end(),
-        [commandName](const CommandStructure& commandStructure)
-        {
-            return commandStructure.name == commandName;
-        }
-    ) };
-    if (it == commandStructures.end())
+    const CommandStructure* commandStructure{ FindCommandStructure(commandName) };
+    if (commandStructure == nullptr)
     {
-        throw std::runtime_error{ "Failed to get command stucture of command: \"" + commandName + "\"." };
+        throw std::runtime_error{ "Failed to get command stucture of command: \"" + std::string{ commandName } + "\"." };
     }
-    return *it;
+    return *commandStructure;
 }
\ No newline at end of file
@@ -1,144 +1,183 @@
-#include <iostream>
+#include <array>
+#include <span>
 #include <string>
-#include <vector>
-#include <functional>
 
 #include "commands.hpp"
 #include "command_list.hpp"
 #include "command_structure.hpp"
 #include "command_functions.hpp"
 #include "argument_parser.hpp"
+#include "instrumentation.hpp"
+#include "io_scheduler.hpp"
+#include "io_batch.hpp"
+#include "exclude_rules.hpp"
 
 namespace fsc
 {
-    CommandList commandList;
-
-    void InitializeCommands() noexcept
+    namespace
     {
-        commandList.AddCommandStructure(
-            CommandStructure{
-                "help",
-                std::vector<Parameter>{
-                    Parameter{ "command", ParameterRequirement::OPTIONAL, "Shows help for a specific command." },
-                },
-                std::vector<Flag>{},
-                std::function<void(const ArgumentParser&)>{ Help }
-            }
-        );
-
-        commandList.AddCommandStructure(
-            CommandStructure{
-                "create",
-                std::vector<Parameter>{
-                    Parameter{ "path", ParameterRequirement::REQUIRED, "Path to create." },
-                },
-                std::vector<Flag>{
-                    Flag{ "-f", "Specifies that the path is a file, otherwise auto detect." },
-                    Flag{ "-d", "Specifies that the path is a directory, otherwise auto detect." },
-                    Flag{ "-n", "Prevents automatic header guards for C and C++ related files." }
-                },
-                std::function<void(const ArgumentParser&)>{ Create }
-            }
-        );
-
-        commandList.AddCommandStructure(
-            CommandStructure{
-                "delete",
-                std::vector<Parameter>{
-                    Parameter{ "path", ParameterRequirement::REQUIRED, "Path to delete." },
-                },
-                std::vector<Flag>{
-                    Flag{ "-r", "Recursively delete contents." },
-                    Flag{ "-s", "Silence confirmation prompt." },
-                    Flag{ "-c", "Delete contents only, requires \"-r\" flag." }
-                },
-                std::function<void(const ArgumentParser&)>{ Delete }
-            }
-        );
-
-        commandList.AddCommandStructure(
-            CommandStructure{
-                "list",
-                std::vector<Parameter>{
-                    Parameter{ "path", ParameterRequirement::OPTIONAL, "Path to list." },
-                },
-                std::vector<Flag>{
-                    Flag{ "-r", "List path recursively." },
-                    Flag{ "-f", "list files only." },
-                    Flag{ "-d", "List directories only." }
-                },
-                std::function<void(const ArgumentParser&)>{ List }
-            }
-        );
-
-        commandList.AddCommandStructure(
-            CommandStructure{
-                "read",
-                std::vector<Parameter>{
-                    Parameter{ "path", ParameterRequirement::REQUIRED, "File to read." },
-                },
-                std::vector<Flag>{},
-                std::function<void(const ArgumentParser&)>{ Read }          
-            }
-        );
-
-        commandList.AddCommandStructure(
-            CommandStructure{
-                "clone",
-                std::vector<Parameter>{
-                    Parameter{ "target", ParameterRequirement::REQUIRED, "Target to clone." },
-                    Parameter{ "destination", ParameterRequirement::REQUIRED, "Clone destination." }
-                },
-                std::vector<Flag>{
-                    Flag{ "-o", "Overwrite existing item in destination if clone has the same name." },
-                    Flag{ "-s", "Silence overwrite prompt." }
-                },
-                std::function<void(const ArgumentParser&)>{ Clone }          
-            }
-        );
-
-        commandList.AddCommandStructure(
-            CommandStructure{
-                "move",
-                std::vector<Parameter>{
-                    Parameter{ "target", ParameterRequirement::REQUIRED, "Target to move." },
-                    Parameter{ "destination", ParameterRequirement::REQUIRED, "Target destination." }
-                },
-                std::vector<Flag>{
-                    Flag{ "-o", "Overwrite existing item in destination if target has the same name." },
-                    Flag{ "-s", "Silence overwrite prompt." }
-                },
-                std::function<void(const ArgumentParser&)>{ Move }          
-            }
-        );
-
-        commandList.AddCommandStructure(
-            CommandStructure{
-                "rename",
-                std::vector<Parameter>{
-                    Parameter{ "target", ParameterRequirement::REQUIRED, "Target to rename." },
-                    Parameter{ "new name", ParameterRequirement::REQUIRED, "New name." }
-                },
-                std::vector<Flag>{
-                    Flag{ "-o", "Overwrite existing item in destination if target has the same name." },
-                    Flag{ "-s", "Silence overwrite prompt." }
-                },
-                std::function<void(const ArgumentParser&)>{ Rename }          
-            }
-        );
-
-        commandList.AddCommandStructure(
-            CommandStructure{
-                "version",
-                std::vector<Parameter>{},
-                std::vector<Flag>{},
-                std::function<void(const ArgumentParser&)>{ Version }          
-            }
-        );
+        constexpr std::array helpParameters{
+            Parameter{ "command", ParameterRequirement::OPTIONAL, "Shows help for a specific command." },
+        };
+
+        constexpr std::array createParameters{
+            Parameter{ "path", ParameterRequirement::REQUIRED, "Path to create." },
+        };
+        constexpr std::array createFlags{
+            Flag{ FlagId::FILES, "Specifies that the path is a file, otherwise auto detect." },
+            Flag{ FlagId::DIRECTORY, "Specifies that the path is a directory, otherwise auto detect." },
+            Flag{ FlagId::NO_GUARDS, "Prevents automatic header guards for C and C++ related files." }
+        };
+
+        constexpr std::array deleteParameters{
+            Parameter{ "path", ParameterRequirement::REQUIRED, "Paths or patterns to delete.", true },
+        };
+        constexpr std::array deleteFlags{
+            Flag{ FlagId::RECURSIVE, "Recursively delete contents." },
+            Flag{ FlagId::SILENT, "Silence confirmation prompt." },
+            Flag{ FlagId::CONTENTS, "Delete contents only, requires \"-r\" flag." }
+        };
+
+        constexpr std::array listParameters{
+            Parameter{ "path", ParameterRequirement::OPTIONAL, "Path to list." },
+        };
+        constexpr std::array listFlags{
+            Flag{ FlagId::RECURSIVE, "List path recursively." },
+            Flag{ FlagId::FILES, "list files only." },
+            Flag{ FlagId::DIRECTORY, "List directories only." },
+            Flag{ FlagId::SORTED, "Sort entries by name, the listing is built in memory first." }
+        };
+
+        constexpr std::array readParameters{
+            Parameter{ "path", ParameterRequirement::REQUIRED, "Files or patterns to read.", true },
+        };
+
+        constexpr std::array cloneParameters{
+            Parameter{ "target", ParameterRequirement::REQUIRED, "Targets or patterns to clone.", true },
+            Parameter{ "destination", ParameterRequirement::REQUIRED, "Clone destination." }
+        };
+        constexpr std::array cloneFlags{
+            Flag{ FlagId::OVERWRITE, "Overwrite existing item in destination if clone has the same name." },
+            Flag{ FlagId::SILENT, "Silence overwrite prompt." }
+        };
+
+        constexpr std::array moveParameters{
+            Parameter{ "target", ParameterRequirement::REQUIRED, "Targets or patterns to move.", true },
+            Parameter{ "destination", ParameterRequirement::REQUIRED, "Target destination." }
+        };
+        constexpr std::array moveFlags{
+            Flag{ FlagId::OVERWRITE, "Overwrite existing item in destination if target has the same name." },
+            Flag{ FlagId::SILENT, "Silence overwrite prompt." }
+        };
+
+        constexpr std::array renameParameters{
+            Parameter{ "target", ParameterRequirement::REQUIRED, "Target to rename." },
+            Parameter{ "new name", ParameterRequirement::REQUIRED, "New name." }
+        };
+        constexpr std::array renameFlags{
+            Flag{ FlagId::OVERWRITE, "Overwrite existing item in destination if target has the same name." },
+            Flag{ FlagId::SILENT, "Silence overwrite prompt." }
+        };
+
+        constexpr std::array serveParameters{
+            Parameter{ "socket", ParameterRequirement::OPTIONAL, "Unix socket to listen on, defaults to $FSC_SOCKET." }
+        };
+
+        constexpr std::array packParameters{
+            Parameter{ "path", ParameterRequirement::REQUIRED, "File or directory to write to standard output as a tar archive." }
+        };
+
+        constexpr std::array unpackParameters{
+            Parameter{ "destination", ParameterRequirement::OPTIONAL, "Directory to extract the tar archive on standard input into." }
+        };
+        constexpr std::array unpackFlags{
+            Flag{ FlagId::OVERWRITE, "Overwrite existing items with the same name." }
+        };
+
+        constexpr std::array snapshotParameters{
+            Parameter{ "path", ParameterRequirement::REQUIRED, "File or directory to snapshot." },
+            Parameter{ "store", ParameterRequirement::REQUIRED, "Snapshot store directory, created if it does not exist." }
+        };
+
+        constexpr std::array restoreParameters{
+            Parameter{ "store", ParameterRequirement::REQUIRED, "Snapshot store directory." },
+            Parameter{ "destination", ParameterRequirement::REQUIRED, "Directory to restore the snapshot into." },
+            Parameter{ "snapshot", ParameterRequirement::OPTIONAL, "Snapshot id, defaults to the latest snapshot." }
+        };
+        constexpr std::array restoreFlags{
+            Flag{ FlagId::OVERWRITE, "Overwrite existing items with the same name." }
+        };
+
+        constexpr std::array watchParameters{
+            Parameter{ "target", ParameterRequirement::REQUIRED, "Directory to mirror." },
+            Parameter{ "destination", ParameterRequirement::REQUIRED, "Mirror destination." }
+        };
+        constexpr std::array watchFlags{
+            Flag{ FlagId::OVERWRITE, "Overwrite existing item in destination if target has the same name." },
+            Flag{ FlagId::SILENT, "Silence overwrite prompt." },
+            Flag{ FlagId::DEBOUNCE, "Wait for changes to settle this long before replaying them, defaults to 200ms, \"--debounce=<ms>\".", true }
+        };
+
+        constexpr std::array commandStructures{
+            CommandStructure{ "help", helpParameters, {}, Help },
+            CommandStructure{ "create", createParameters, createFlags, Create },
+            CommandStructure{ "delete", deleteParameters, deleteFlags, Delete },
+            CommandStructure{ "list", listParameters, listFlags, List },
+            CommandStructure{ "read", readParameters, {}, Read },
+            CommandStructure{ "clone", cloneParameters, cloneFlags, Clone },
+            CommandStructure{ "move", moveParameters, moveFlags, Move },
+            CommandStructure{ "rename", renameParameters, renameFlags, Rename },
+            CommandStructure{ "version", {}, {}, Version },
+            CommandStructure{ "serve", serveParameters, {}, Serve },
+            CommandStructure{ "pack", packParameters, {}, Pack },
+            CommandStructure{ "unpack", unpackParameters, unpackFlags, Unpack },
+            CommandStructure{ "snapshot", snapshotParameters, {}, Snapshot },
+            CommandStructure{ "restore", restoreParameters, restoreFlags, Restore },
+            CommandStructure{ "watch", watchParameters, watchFlags, Watch },
+        };
+
+        constexpr std::array globalFlags{
+            Flag{ FlagId::STATS, "Print timers and counters to standard error when the command finishes." },
+            Flag{ FlagId::TRACE, "Write a Chrome trace event JSON file, \"--trace=<file>\".", true },
+            Flag{ FlagId::BWLIMIT, "Limit bulk data transfer in bytes per second, accepts K, M and G suffixes, \"--bwlimit=<rate>\".", true },
+            Flag{ FlagId::IOPS_LIMIT, "Limit bulk data and metadata operations per second, \"--iops-limit=<rate>\".", true },
+            Flag{ FlagId::IONICE, "Set the I/O priority class: idle, best-effort[:0-7] or realtime[:0-7], \"--ionice=<class>\".", true },
+            Flag{ FlagId::LATENCY_TARGET, "Back off bulk operations while their average latency is above the target, \"--latency-target=<ms>\".", true },
+            Flag{ FlagId::BLOCK_SIZE, "Copy block size, rounded up to 4K, defaults to 1M, \"--block-size=<size>\".", true },
+            Flag{ FlagId::LARGE_FILE_THRESHOLD, "Copy files of this size or larger without filling the page cache, defaults to 256M, \"--large-file-threshold=<size>\".", true },
+            Flag{ FlagId::DIRECT_IO, "Copy large files with O_DIRECT where the file system supports it." },
+            Flag{ FlagId::IO_BACKEND, "Batched operations backend: auto, uring or threads, defaults to auto, \"--io-backend=<backend>\".", true },
+            Flag{ FlagId::EXCLUDE, "Skip entries matching a gitignore style pattern, may be repeated, \"--exclude=<pattern>\".", true },
+            Flag{ FlagId::EXCLUDE_FROM, "Read exclude patterns from a file, one per line, \"--exclude-from=<file>\".", true },
+            Flag{ FlagId::RESPECT_GITIGNORE, "Skip entries ignored by .gitignore files and .git directories." },
+        };
+
+        constexpr CommandList commandList{ commandStructures, globalFlags };
     }
 
     const CommandList& GetCommandList() noexcept
     {
         return commandList;
     }
+
+    void RunCommand(int argc, char* argv[])
+    {
+        ArgumentParser argumentParser{ argc, argv, commandList };
+        fsc_instrumentation::Enable(argumentParser.HasFlag(FlagId::STATS), std::string{ argumentParser.GetFlagValue(FlagId::TRACE) });
+        fsc_io::ConfigureFromArguments(argumentParser);
+        fsc_batch::SetBackend(argumentParser.GetFlagValue(FlagId::IO_BACKEND));
+        fsc_exclude::ConfigureFromArguments(argumentParser);
+        try
+        {
+            FSC_TRACE_SCOPE("command");
+            argumentParser.GetCommandStructure().func(argumentParser);
+        }
+        catch (...)
+        {
+            FSC_COUNT(ERRORS, 1);
+            fsc_instrumentation::Finish();
+            throw;
+        }
+        fsc_instrumentation::Finish();
+    }
 }
\ No newline at end of file
@@ -0,0 +1,454 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <cerrno>
+
+#include "exclude_rules.hpp"
+#include "argument_parser.hpp"
+#include "glob.hpp"
+#include "instrumentation.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fsc_exclude
+{
+    namespace
+    {
+        std::shared_ptr<const RuleSet> argumentRules;
+        bool respectIgnoreFiles{ false };
+
+        std::vector<std::string_view> Split(std::string_view path)
+        {
+            std::vector<std::string_view> components;
+            for (std::size_t start{ 0 }; start <= path.size();)
+            {
+                std::size_t end{ std::min(path.find('/', start), path.size()) };
+                if (end > start)
+                {
+                    components.push_back(path.substr(start, end - start));
+                }
+                start = end + 1;
+            }
+            return components;
+        }
+
+        // A trailing "**" needs at least one component, "build/**" matches what is inside build but not build itself.
+        bool MatchComponents(std::span<const std::string> pattern, std::span<const std::string_view> path) noexcept
+        {
+            if (pattern.empty())
+            {
+                return path.empty();
+            }
+            if (pattern.front() == "**")
+            {
+                if (pattern.size() == 1)
+                {
+                    return !path.empty();
+                }
+                for (std::size_t skipped{ 0 }; skipped <= path.size(); ++skipped)
+                {
+                    if (MatchComponents(pattern.subspan(1), path.subspan(skipped)))
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            return !path.empty() && fsc_glob::Match(pattern.front(), path.front(), true) && MatchComponents(pattern.subspan(1), path.subspan(1));
+        }
+
+        std::optional<std::string> ReadIgnoreFile(const std::filesystem::path& path)
+        {
+            FSC_COUNT(SYSCALLS, 1);
+            std::ifstream file{ path, std::ios::binary };
+            if (!file)
+            {
+                return std::nullopt;
+            }
+            std::ostringstream contents;
+            contents << file.rdbuf();
+            return contents.str();
+        }
+
+#if defined(__unix__) || defined(__APPLE__)
+        std::optional<std::string> ReadIgnoreFile(int directory, const std::string& name)
+        {
+            FSC_COUNT(SYSCALLS, 1);
+            fsc_path::FileDescriptor file{ openat(directory, name.c_str(), O_RDONLY | O_CLOEXEC) };
+            if (!file.IsValid())
+            {
+                return std::nullopt;
+            }
+            std::string contents;
+            char buffer[4096];
+            while (true)
+            {
+                FSC_COUNT(SYSCALLS, 1);
+                ssize_t received{ read(file.Get(), buffer, sizeof(buffer)) };
+                if (received < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (received <= 0)
+                {
+                    break;
+                }
+                contents.append(buffer, static_cast<std::size_t>(received));
+            }
+            return contents;
+        }
+#endif
+    }
+
+    // Follows .gitignore: "#" comments, "!" negation, a trailing "/" for directories only and a "/" anywhere else anchors
+    // the pattern to the directory of the rules.
+    void RuleSet::Add(std::string_view line)
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.remove_suffix(1);
+        }
+        while (!line.empty() && line.back() == ' ' && !(line.size() > 1 && line[line.size() - 2] == '\\'))
+        {
+            line.remove_suffix(1);
+        }
+        if (line.empty() || line.front() == '#')
+        {
+            return;
+        }
+
+        bool isNegated{ line.front() == '!' };
+        if (isNegated || line.starts_with("\\!") || line.starts_with("\\#"))
+        {
+            line.remove_prefix(1);
+        }
+        bool directoryOnly{ false };
+        while (!line.empty() && line.back() == '/')
+        {
+            directoryOnly = true;
+            line.remove_suffix(1);
+        }
+        bool isAnchored{ line.find('/') != std::string_view::npos };
+        if (isAnchored && line.front() == '/')
+        {
+            line.remove_prefix(1);
+        }
+        if (line.empty())
+        {
+            return;
+        }
+
+        RuleIndex index{ static_cast<RuleIndex>(negated.size()) };
+        negated.push_back(isNegated);
+        anchored = anchored || isAnchored;
+        auto IsLiteral = [](std::string_view text) { return !fsc_glob::HasWildcards(text) && text.find('\\') == std::string_view::npos; };
+        std::string pattern{ line };
+        if (IsLiteral(line))
+        {
+            RuleMap& rules{ isAnchored ? (directoryOnly ? directoryPaths : paths) : (directoryOnly ? directoryNames : names) };
+            rules[std::move(pattern)] = index;
+            return;
+        }
+        if (!isAnchored && !directoryOnly && line.size() > 2 && line.starts_with("*.") && IsLiteral(line.substr(1)))
+        {
+            extensions[pattern.substr(1)] = index;
+            return;
+        }
+
+        GlobRule rule{ index, directoryOnly, isAnchored, std::move(pattern), {} };
+        if (isAnchored)
+        {
+            for (std::string_view component : Split(rule.pattern))
+            {
+                rule.components.emplace_back(component);
+            }
+        }
+        globs.push_back(std::move(rule));
+    }
+
+    void RuleSet::AddLines(std::string_view text)
+    {
+        for (std::size_t start{ 0 }; start < text.size();)
+        {
+            std::size_t end{ std::min(text.find('\n', start), text.size()) };
+            Add(text.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+
+    bool RuleSet::IsEmpty() const noexcept
+    {
+        return negated.empty();
+    }
+
+    bool RuleSet::HasAnchored() const noexcept
+    {
+        return anchored;
+    }
+
+    std::optional<bool> RuleSet::Match(std::string_view relativePath, std::string_view name, bool directory) const
+    {
+        std::optional<RuleIndex> best;
+        auto Find = [&best](const RuleMap& rules, std::string_view key)
+        {
+            if (rules.empty())
+            {
+                return;
+            }
+            auto rule{ rules.find(key) };
+            if (rule != rules.end() && (!best || rule->second > *best))
+            {
+                best = rule->second;
+            }
+        };
+
+        Find(names, name);
+        if (directory)
+        {
+            Find(directoryNames, name);
+        }
+        if (!extensions.empty())
+        {
+            for (std::size_t dot{ name.find('.') }; dot != std::string_view::npos; dot = name.find('.', dot + 1))
+            {
+                Find(extensions, name.substr(dot));
+            }
+        }
+        if (anchored)
+        {
+            Find(paths, relativePath);
+            if (directory)
+            {
+                Find(directoryPaths, relativePath);
+            }
+        }
+
+        // Globs are in rule order, the search stops at the first one that could not beat the best match so far.
+        std::optional<std::vector<std::string_view>> components;
+        for (auto rule{ globs.rbegin() }; rule != globs.rend() && (!best || rule->index > *best); ++rule)
+        {
+            if (rule->directoryOnly && !directory)
+            {
+                continue;
+            }
+            bool matched;
+            if (rule->anchored)
+            {
+                if (!components)
+                {
+                    components = Split(relativePath);
+                }
+                matched = MatchComponents(rule->components, *components);
+            }
+            else
+            {
+                matched = fsc_glob::Match(rule->pattern, name, true);
+            }
+            if (matched)
+            {
+                best = rule->index;
+                break;
+            }
+        }
+
+        if (!best)
+        {
+            return std::nullopt;
+        }
+        return !negated[*best];
+    }
+
+    bool Scope::IsEmpty() const noexcept
+    {
+        return !arguments && ignoreFiles.empty() && !respectIgnoreFiles;
+    }
+
+    bool Scope::IsExcluded(std::string_view name, bool directory) const
+    {
+        if (respectIgnoreFiles && directory && name == ".git")
+        {
+            return true;
+        }
+        auto Check = [name, directory](const Active& active)
+        {
+            std::string path;
+            if (active.rules->HasAnchored())
+            {
+                path = active.prefix;
+                path += name;
+            }
+            return active.rules->Match(path, name, directory);
+        };
+
+        if (arguments)
+        {
+            if (std::optional<bool> excluded{ Check(*arguments) })
+            {
+                return *excluded;
+            }
+        }
+        for (auto active{ ignoreFiles.rbegin() }; active != ignoreFiles.rend(); ++active)
+        {
+            if (std::optional<bool> excluded{ Check(*active) })
+            {
+                return *excluded;
+            }
+        }
+        return false;
+    }
+
+    Scope Scope::Enter(std::string_view name, std::optional<std::string> ignoreFile) const
+    {
+        Scope scope{ *this };
+        auto Descend = [name](Active& active)
+        {
+            if (active.rules->HasAnchored())
+            {
+                active.prefix += name;
+                active.prefix += '/';
+            }
+        };
+        if (scope.arguments)
+        {
+            Descend(*scope.arguments);
+        }
+        for (Active& active : scope.ignoreFiles)
+        {
+            Descend(active);
+        }
+
+        if (ignoreFile)
+        {
+            auto rules{ std::make_shared<RuleSet>() };
+            rules->AddLines(*ignoreFile);
+            if (!rules->IsEmpty())
+            {
+                scope.ignoreFiles.push_back(Active{ std::move(rules), "" });
+            }
+        }
+        return scope;
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    Scope Scope::Enter(int parentDirectory, std::string_view name) const
+    {
+        if (IsEmpty())
+        {
+            return Scope{};
+        }
+        std::optional<std::string> ignoreFile;
+        if (respectIgnoreFiles)
+        {
+            ignoreFile = ReadIgnoreFile(parentDirectory, std::string{ name } + "/.gitignore");
+        }
+        return Enter(name, std::move(ignoreFile));
+    }
+#endif
+
+    Scope Scope::Enter(const std::filesystem::path& directory) const
+    {
+        if (IsEmpty())
+        {
+            return Scope{};
+        }
+        std::optional<std::string> ignoreFile;
+        if (respectIgnoreFiles)
+        {
+            ignoreFile = ReadIgnoreFile(directory / ".gitignore");
+        }
+        return Enter(directory.filename().string(), std::move(ignoreFile));
+    }
+
+    Scope Open(const fsc_path::ResolvedPath& root)
+    {
+        Scope scope;
+        scope.respectIgnoreFiles = respectIgnoreFiles;
+        if (argumentRules)
+        {
+            scope.arguments = Scope::Active{ argumentRules, "" };
+        }
+        if (!respectIgnoreFiles || !root.IsDirectory())
+        {
+            return scope;
+        }
+
+        // Inside a repository the ignore files of the parents apply as well, outside of one only those in the walked tree.
+        FSC_TRACE_SCOPE("ignore files");
+        std::vector<std::filesystem::path> directories{ root.GetPath() };
+        std::optional<std::filesystem::path> repository;
+        for (std::filesystem::path directory{ root.GetPath() };; directory = directory.parent_path())
+        {
+            std::error_code error;
+            FSC_COUNT(SYSCALLS, 1);
+            if (std::filesystem::exists(directory / ".git", error))
+            {
+                repository = directory;
+                break;
+            }
+            if (!directory.has_relative_path())
+            {
+                break;
+            }
+            directories.push_back(directory.parent_path());
+        }
+        if (!repository)
+        {
+            directories.resize(1);
+        }
+
+        auto Load = [&scope, &root](const std::filesystem::path& file, const std::filesystem::path& base)
+        {
+            if (std::optional<std::string> text{ ReadIgnoreFile(file) })
+            {
+                auto rules{ std::make_shared<RuleSet>() };
+                rules->AddLines(*text);
+                if (!rules->IsEmpty())
+                {
+                    std::filesystem::path relative{ root.GetPath().lexically_relative(base) };
+                    scope.ignoreFiles.push_back(Scope::Active{ std::move(rules), relative == "." ? "" : relative.generic_string() + "/" });
+                }
+            }
+        };
+        if (repository)
+        {
+            Load(*repository / ".git" / "info" / "exclude", *repository);
+        }
+        for (auto directory{ directories.rbegin() }; directory != directories.rend(); ++directory)
+        {
+            Load(*directory / ".gitignore", *directory);
+        }
+        return scope;
+    }
+
+    void ConfigureFromArguments(const ArgumentParser& argumentParser)
+    {
+        auto rules{ std::make_shared<RuleSet>() };
+        for (std::string_view pattern : argumentParser.GetFlagValues(FlagId::EXCLUDE))
+        {
+            rules->Add(pattern);
+        }
+        for (std::string_view file : argumentParser.GetFlagValues(FlagId::EXCLUDE_FROM))
+        {
+            std::optional<std::string> text{ ReadIgnoreFile(std::filesystem::path{ file }) };
+            if (!text)
+            {
+                throw std::runtime_error{ "Failed to read exclude file \"" + std::string{ file } + "\"." };
+            }
+            rules->AddLines(*text);
+        }
+        argumentRules = rules->IsEmpty() ? nullptr : std::move(rules);
+        respectIgnoreFiles = argumentParser.HasFlag(FlagId::RESPECT_GITIGNORE);
+    }
+}
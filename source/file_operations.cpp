@@ -0,0 +1,1176 @@
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <system_error>
+#include <cerrno>
+#include <cstdio>
+#include <optional>
+#include <string_view>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+#include <new>
+#include <cstdlib>
+#include <unordered_set>
+#include <algorithm>
+
+#include "file_operations.hpp"
+#include "path_layer.hpp"
+#include "io_scheduler.hpp"
+#include "instrumentation.hpp"
+#include "io_batch.hpp"
+#include "exclude_rules.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace fsc_operations
+{
+    namespace
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        std::error_code LastError() noexcept
+        {
+            return std::error_code{ errno, std::generic_category() };
+        }
+
+        // Files up to smallFileSize are copied smallFileChunk at a time through batches.
+        constexpr std::uint64_t smallFileSize{ 64 << 10 };
+        constexpr std::size_t smallFileChunk{ 64 };
+        constexpr std::size_t maxBatchSize{ 4096 };
+
+        struct DirectoryEntry
+        {
+            std::string name;
+            unsigned char type;
+        };
+
+        // Reads all entries up front so the directory can be modified while they are processed.
+        std::vector<DirectoryEntry> ReadDirectory(int directory, std::error_code& error)
+        {
+            std::vector<DirectoryEntry> entries;
+            int descriptor{ openat(directory, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+            FSC_COUNT(SYSCALLS, 1);
+            DIR* stream{ descriptor >= 0 ? fdopendir(descriptor) : nullptr };
+            if (stream == nullptr)
+            {
+                error = LastError();
+                if (descriptor >= 0)
+                {
+                    close(descriptor);
+                }
+                return entries;
+            }
+
+            errno = 0;
+            while (dirent* entry{ readdir(stream) })
+            {
+                std::string_view name{ entry->d_name };
+                if (name != "." && name != "..")
+                {
+                    entries.push_back(DirectoryEntry{ std::string{ name }, entry->d_type });
+                }
+            }
+            if (errno != 0)
+            {
+                error = LastError();
+            }
+            closedir(stream);
+            FSC_COUNT(ENTRIES, entries.size());
+            return entries;
+        }
+
+        // Keeps FIFOs, sockets and devices apart from regular files, unlike FileType.
+        unsigned char ToEntryType(const fsc_path::Metadata& metadata) noexcept
+        {
+            return static_cast<unsigned char>(IFTODT(metadata.mode));
+        }
+
+        // Opening a FIFO for reading blocks until a writer appears, so only regular files and directories are copied.
+        void CheckCopyable(unsigned char type, const std::filesystem::path& sourcePath)
+        {
+            if (type != DT_REG && type != DT_DIR)
+            {
+                throw std::filesystem::filesystem_error{ "Cannot copy special file", sourcePath, std::make_error_code(std::errc::invalid_argument) };
+            }
+        }
+
+        // Symlinks count as files like in git, entries of unknown type are only stat'ed when there are rules to check.
+        bool IsExcluded(const fsc_exclude::Scope& scope, int directory, const DirectoryEntry& entry)
+        {
+            if (scope.IsEmpty())
+            {
+                return false;
+            }
+            bool isDirectory{ entry.type == DT_DIR };
+            if (entry.type == DT_UNKNOWN)
+            {
+                std::optional<fsc_path::Metadata> metadata{ fsc_path::StatAt(directory, entry.name.c_str(), false) };
+                isDirectory = metadata && metadata->type == fsc_path::FileType::DIRECTORY;
+            }
+            return scope.IsExcluded(entry.name, isDirectory);
+        }
+
+        std::size_t ReadBlock(int input, char* data, std::size_t size, std::uint64_t offset, const std::filesystem::path& sourcePath)
+        {
+            std::size_t received{ 0 };
+            while (received < size)
+            {
+                ssize_t result{ pread(input, data + received, size - received, static_cast<off_t>(offset + received)) };
+                FSC_COUNT(SYSCALLS, 1);
+                if (result < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (result < 0)
+                {
+                    FSC_COUNT(ERRORS, 1);
+                    throw std::filesystem::filesystem_error{ "Failed to read file", sourcePath, LastError() };
+                }
+                if (result == 0)
+                {
+                    break;
+                }
+                received += static_cast<std::size_t>(result);
+            }
+            return received;
+        }
+
+        void WriteBlock(int output, const char* data, std::size_t size, const char* destinationName)
+        {
+            for (std::size_t written{ 0 }; written < size;)
+            {
+                ssize_t result{ write(output, data + written, size - written) };
+                FSC_COUNT(SYSCALLS, 1);
+                if (result < 0 && errno != EINTR)
+                {
+                    FSC_COUNT(ERRORS, 1);
+                    throw std::filesystem::filesystem_error{ "Failed to write file", destinationName, LastError() };
+                }
+                written += result > 0 ? static_cast<std::size_t>(result) : 0;
+            }
+        }
+
+        // Reserves the extents up front so a long copy does not fragment the destination, the size is left to the writes.
+        void Preallocate(int output, std::uint64_t size, const char* destinationName)
+        {
+#if defined(__linux__)
+            FSC_COUNT(SYSCALLS, 1);
+            if (fallocate(output, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size)) != 0 && errno != EOPNOTSUPP && errno != ENOSYS)
+            {
+                throw std::filesystem::filesystem_error{ "Failed to allocate file", destinationName, LastError() };
+            }
+#else
+            static_cast<void>(output);
+            static_cast<void>(size);
+            static_cast<void>(destinationName);
+#endif
+        }
+
+        // With dropCache the written range is pushed to disk behind the copy and both files' pages are dropped once clean,
+        // so a large copy does not evict the rest of the page cache.
+        void CopyBuffered(int input, int output, std::size_t blockSize, bool dropCache, const std::filesystem::path& sourcePath, const char* destinationName)
+        {
+            fsc_io::IoScheduler& scheduler{ fsc_io::GetIoScheduler() };
+#if defined(__linux__)
+            if (dropCache)
+            {
+                FSC_COUNT(SYSCALLS, 1);
+                posix_fadvise(input, 0, 0, POSIX_FADV_SEQUENTIAL);
+            }
+#endif
+            std::vector<char> buffer(blockSize);
+            std::uint64_t offset{ 0 };
+            while (true)
+            {
+                std::size_t received{ ReadBlock(input, buffer.data(), buffer.size(), offset, sourcePath) };
+                if (received == 0)
+                {
+                    break;
+                }
+
+                {
+                    fsc_io::IoScheduler::Operation operation{ scheduler, received };
+                    WriteBlock(output, buffer.data(), received, destinationName);
+                }
+                FSC_COUNT(BYTES, received);
+#if defined(__linux__)
+                if (dropCache)
+                {
+                    off_t position{ static_cast<off_t>(offset) };
+                    off_t length{ static_cast<off_t>(received) };
+                    FSC_COUNT(SYSCALLS, 2);
+                    sync_file_range(output, position, length, SYNC_FILE_RANGE_WRITE);
+                    posix_fadvise(input, position, length, POSIX_FADV_DONTNEED);
+                    if (offset >= blockSize)
+                    {
+                        off_t previous{ static_cast<off_t>(offset - blockSize) };
+                        FSC_COUNT(SYSCALLS, 2);
+                        sync_file_range(output, previous, static_cast<off_t>(blockSize), SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+                        posix_fadvise(output, previous, static_cast<off_t>(blockSize), POSIX_FADV_DONTNEED);
+                    }
+                }
+#endif
+                offset += received;
+            }
+#if defined(__linux__)
+            if (dropCache && offset > 0)
+            {
+                FSC_COUNT(SYSCALLS, 2);
+                fdatasync(output);
+                posix_fadvise(output, 0, 0, POSIX_FADV_DONTNEED);
+            }
+#else
+            static_cast<void>(dropCache);
+#endif
+        }
+
+#if defined(__linux__)
+        struct AlignedDeleter
+        {
+            void operator()(char* data) const noexcept { std::free(data); }
+        };
+
+        // Reads ahead into one aligned buffer while the other is written, both files opened with O_DIRECT.
+        // Returns false when the file system refuses O_DIRECT so the caller can use the buffered path instead.
+        bool CopyDirect(int sourceDirectory, const char* sourceName, int destinationDirectory, const char* destinationName, std::uint64_t size, std::size_t blockSize, const std::filesystem::path& sourcePath)
+        {
+            constexpr std::size_t alignment{ 4096 };
+            FSC_COUNT(SYSCALLS, 2);
+            fsc_path::FileDescriptor input{ openat(sourceDirectory, sourceName, O_RDONLY | O_DIRECT | O_CLOEXEC) };
+            if (!input.IsValid())
+            {
+                return false;
+            }
+            fsc_path::FileDescriptor output{ openat(destinationDirectory, destinationName, O_WRONLY | O_DIRECT | O_CLOEXEC) };
+            if (!output.IsValid())
+            {
+                return false;
+            }
+
+            std::array<std::unique_ptr<char, AlignedDeleter>, 2> buffers;
+            for (auto& buffer : buffers)
+            {
+                buffer.reset(static_cast<char*>(std::aligned_alloc(alignment, blockSize)));
+                if (!buffer)
+                {
+                    throw std::bad_alloc{};
+                }
+            }
+
+            struct Slot
+            {
+                std::size_t size{ 0 };
+                bool full{ false };
+            };
+            std::array<Slot, 2> slots;
+            std::mutex mutex;
+            std::condition_variable changed;
+            bool stopped{ false };
+            std::exception_ptr readError;
+
+            std::thread reader{ [&]()
+            {
+                FSC_TRACE_SCOPE("read ahead");
+                std::uint64_t offset{ 0 };
+                for (std::size_t block{ 0 };; ++block)
+                {
+                    Slot& slot{ slots[block % 2] };
+                    {
+                        std::unique_lock<std::mutex> lock{ mutex };
+                        changed.wait(lock, [&]() { return stopped || !slot.full; });
+                        if (stopped)
+                        {
+                            return;
+                        }
+                    }
+                    std::size_t received{ 0 };
+                    try
+                    {
+                        received = ReadBlock(input.Get(), buffers[block % 2].get(), blockSize, offset, sourcePath);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock{ mutex };
+                        readError = std::current_exception();
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock{ mutex };
+                        slot.size = received;
+                        slot.full = true;
+                    }
+                    changed.notify_all();
+                    if (received == 0)
+                    {
+                        return;
+                    }
+                    offset += received;
+                }
+            } };
+
+            auto Stop = [&]()
+            {
+                {
+                    std::lock_guard<std::mutex> lock{ mutex };
+                    stopped = true;
+                }
+                changed.notify_all();
+                reader.join();
+            };
+
+            try
+            {
+                fsc_io::IoScheduler& scheduler{ fsc_io::GetIoScheduler() };
+                for (std::size_t block{ 0 };; ++block)
+                {
+                    Slot& slot{ slots[block % 2] };
+                    std::size_t received;
+                    {
+                        std::unique_lock<std::mutex> lock{ mutex };
+                        changed.wait(lock, [&]() { return slot.full; });
+                        if (readError)
+                        {
+                            std::rethrow_exception(readError);
+                        }
+                        received = slot.size;
+                    }
+                    if (received == 0)
+                    {
+                        break;
+                    }
+
+                    {
+                        // The tail is written as a whole aligned block and the excess cut off afterwards.
+                        fsc_io::IoScheduler::Operation operation{ scheduler, received };
+                        WriteBlock(output.Get(), buffers[block % 2].get(), (received + alignment - 1) / alignment * alignment, destinationName);
+                    }
+                    FSC_COUNT(BYTES, received);
+                    {
+                        std::lock_guard<std::mutex> lock{ mutex };
+                        slot.full = false;
+                    }
+                    changed.notify_all();
+                }
+            }
+            catch (...)
+            {
+                Stop();
+                throw;
+            }
+            Stop();
+
+            FSC_COUNT(SYSCALLS, 1);
+            if (ftruncate(output.Get(), static_cast<off_t>(size)) != 0)
+            {
+                throw std::filesystem::filesystem_error{ "Failed to truncate file", destinationName, LastError() };
+            }
+            return true;
+        }
+#endif
+
+        void CopyFileAt(int sourceDirectory, const char* sourceName, int destinationDirectory, const char* destinationName, const std::filesystem::path& sourcePath)
+        {
+            const fsc_io::CopySettings& settings{ fsc_io::GetCopySettings() };
+            // O_NONBLOCK keeps the open from waiting on a FIFO that replaced the file, it has no effect on regular files.
+            FSC_COUNT(SYSCALLS, 3);
+            fsc_path::FileDescriptor input{ openat(sourceDirectory, sourceName, O_RDONLY | O_NONBLOCK | O_CLOEXEC) };
+            struct stat information{};
+            if (!input.IsValid() || fstat(input.Get(), &information) != 0)
+            {
+                throw std::filesystem::filesystem_error{ "Failed to open file", sourcePath, LastError() };
+            }
+            CheckCopyable(static_cast<unsigned char>(IFTODT(information.st_mode)), sourcePath);
+            fsc_path::FileDescriptor output{ openat(destinationDirectory, destinationName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, information.st_mode & 07777) };
+            if (!output.IsValid())
+            {
+                throw std::filesystem::filesystem_error{ "Failed to create file", destinationName, LastError() };
+            }
+
+            std::uint64_t size{ static_cast<std::uint64_t>(information.st_size) };
+            bool largeFile{ S_ISREG(information.st_mode) && size > 0 && size >= settings.largeFileThreshold };
+            if (largeFile)
+            {
+                FSC_TRACE_SCOPE("large file");
+                Preallocate(output.Get(), size, destinationName);
+#if defined(__linux__)
+                if (!settings.directIo || !CopyDirect(sourceDirectory, sourceName, destinationDirectory, destinationName, size, settings.blockSize, sourcePath))
+#endif
+                {
+                    CopyBuffered(input.Get(), output.Get(), settings.blockSize, true, sourcePath, destinationName);
+                }
+            }
+            else
+            {
+                CopyBuffered(input.Get(), output.Get(), settings.blockSize, false, sourcePath, destinationName);
+            }
+
+            FSC_COUNT(SYSCALLS, 1);
+            if (fchmod(output.Get(), information.st_mode & 07777) != 0)
+            {
+                throw std::filesystem::filesystem_error{ "Failed to set permissions", destinationName, LastError() };
+            }
+        }
+
+        // Small files are copied a chunk at a time in four batches: open and stat the sources, create the destinations while
+        // reading the sources, write, then close everything. Files that turn out larger, or that change while being read,
+        // take CopyFileAt instead.
+        void CopyFilesAt(int sourceDirectory, int destinationDirectory, const std::vector<const DirectoryEntry*>& files, const std::filesystem::path& sourceDirectoryPath)
+        {
+            if (files.empty())
+            {
+                return;
+            }
+#if defined(__linux__)
+            struct SmallFile
+            {
+                struct statx information;
+                fsc_path::FileDescriptor input;
+                fsc_path::FileDescriptor output;
+                std::vector<char> data;
+                std::size_t size;
+                bool batched;
+            };
+
+            auto Fail = [&sourceDirectoryPath](const char* message, const std::string& name, int result)
+            {
+                throw std::filesystem::filesystem_error{ message, sourceDirectoryPath / name, std::error_code{ -result, std::generic_category() } };
+            };
+
+            std::vector<SmallFile> chunk(files.size());
+            fsc_batch::Batch batch;
+            for (std::size_t i{ 0 }; i < files.size(); ++i)
+            {
+                batch.Open(sourceDirectory, files[i]->name.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+                batch.Stat(sourceDirectory, files[i]->name.c_str(), 0, &chunk[i].information);
+            }
+            batch.Submit();
+            for (std::size_t i{ 0 }; i < files.size(); ++i)
+            {
+                chunk[i].input = fsc_path::FileDescriptor{ batch.GetResult(2 * i) };
+                chunk[i].batched = batch.GetResult(2 * i + 1) == 0 && S_ISREG(chunk[i].information.stx_mode) && chunk[i].information.stx_size <= smallFileSize;
+            }
+            for (std::size_t i{ 0 }; i < files.size(); ++i)
+            {
+                if (!chunk[i].input.IsValid())
+                {
+                    Fail("Failed to open file", files[i]->name, batch.GetResult(2 * i));
+                }
+            }
+
+            // One byte more than the size, a full read means the file grew since the stat.
+            batch.Clear();
+            for (std::size_t i{ 0 }; i < files.size(); ++i)
+            {
+                if (chunk[i].batched)
+                {
+                    chunk[i].data.resize(chunk[i].information.stx_size + 1);
+                    batch.Open(destinationDirectory, files[i]->name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, chunk[i].information.stx_mode & 07777);
+                    batch.Read(chunk[i].input.Get(), chunk[i].data.data(), chunk[i].data.size(), 0);
+                }
+            }
+            batch.Submit();
+            for (std::size_t i{ 0 }, index{ 0 }; i < files.size(); ++i)
+            {
+                if (chunk[i].batched)
+                {
+                    int created{ batch.GetResult(index++) };
+                    int received{ batch.GetResult(index++) };
+                    chunk[i].output = fsc_path::FileDescriptor{ created };
+                    if (created < 0)
+                    {
+                        Fail("Failed to create file", files[i]->name, created);
+                    }
+                    if (received < 0)
+                    {
+                        Fail("Failed to read file", files[i]->name, received);
+                    }
+                    chunk[i].size = static_cast<std::size_t>(received);
+                    chunk[i].batched = chunk[i].size <= chunk[i].information.stx_size;
+                }
+            }
+
+            batch.Clear();
+            std::vector<std::size_t> written;
+            for (std::size_t i{ 0 }; i < files.size(); ++i)
+            {
+                if (chunk[i].batched && chunk[i].size > 0)
+                {
+                    batch.Write(chunk[i].output.Get(), chunk[i].data.data(), chunk[i].size, 0);
+                    written.push_back(i);
+                }
+            }
+            batch.Submit();
+            for (std::size_t index{ 0 }; index < written.size(); ++index)
+            {
+                SmallFile& file{ chunk[written[index]] };
+                int result{ batch.GetResult(index) };
+                if (result < 0)
+                {
+                    Fail("Failed to write file", files[written[index]]->name, result);
+                }
+                // A short write is rare enough to simply copy the file again.
+                file.batched = static_cast<std::size_t>(result) == file.size;
+            }
+            for (std::size_t i{ 0 }; i < files.size(); ++i)
+            {
+                FSC_COUNT(SYSCALLS, chunk[i].batched ? 1 : 0);
+                if (chunk[i].batched && fchmod(chunk[i].output.Get(), chunk[i].information.stx_mode & 07777) != 0)
+                {
+                    Fail("Failed to set permissions", files[i]->name, -errno);
+                }
+            }
+
+            // Close errors on the destination can report lost writes, on the source they are ignored.
+            batch.Clear();
+            std::vector<std::optional<fsc_batch::Batch::Index>> outputCloses(files.size());
+            for (std::size_t i{ 0 }; i < files.size(); ++i)
+            {
+                batch.Close(chunk[i].input.Release());
+                if (chunk[i].output.IsValid())
+                {
+                    outputCloses[i] = batch.Close(chunk[i].output.Release());
+                }
+            }
+            batch.Submit();
+            for (std::size_t i{ 0 }; i < files.size(); ++i)
+            {
+                if (outputCloses[i] && batch.GetResult(*outputCloses[i]) < 0)
+                {
+                    Fail("Failed to write file", files[i]->name, batch.GetResult(*outputCloses[i]));
+                }
+            }
+
+            for (std::size_t i{ 0 }; i < files.size(); ++i)
+            {
+                if (!chunk[i].batched)
+                {
+                    CopyFileAt(sourceDirectory, files[i]->name.c_str(), destinationDirectory, files[i]->name.c_str(), sourceDirectoryPath / files[i]->name);
+                }
+            }
+#else
+            for (const DirectoryEntry* file : files)
+            {
+                CopyFileAt(sourceDirectory, file->name.c_str(), destinationDirectory, file->name.c_str(), sourceDirectoryPath / file->name);
+            }
+#endif
+        }
+
+        // Follows symlinks like std::filesystem::copy with recursive | overwrite_existing. The scope applies to the entries of
+        // the source when it is a directory.
+        void CopyTreeAt(int sourceDirectory, const std::string& sourceName, int destinationDirectory, const std::string& destinationName, unsigned char type, const fsc_exclude::Scope& scope, const std::filesystem::path& sourcePath)
+        {
+            if (type == DT_UNKNOWN || type == DT_LNK)
+            {
+                std::optional<fsc_path::Metadata> metadata{ fsc_path::StatAt(sourceDirectory, sourceName.c_str(), true) };
+                if (!metadata)
+                {
+                    throw std::filesystem::filesystem_error{ "Failed to copy", sourcePath, std::make_error_code(std::errc::no_such_file_or_directory) };
+                }
+                type = ToEntryType(*metadata);
+            }
+            CheckCopyable(type, sourcePath);
+
+            if (type != DT_DIR)
+            {
+                CopyFileAt(sourceDirectory, sourceName.c_str(), destinationDirectory, destinationName.c_str(), sourcePath);
+                return;
+            }
+
+            FSC_COUNT(SYSCALLS, 1);
+            fsc_path::FileDescriptor source{ openat(sourceDirectory, sourceName.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+            struct stat information{};
+            if (!source.IsValid() || fstat(source.Get(), &information) != 0)
+            {
+                throw std::filesystem::filesystem_error{ "Failed to open directory", sourcePath, LastError() };
+            }
+
+            // Created and opened as one linked pair, the open also runs when the directory already existed.
+            fsc_path::FileDescriptor destination;
+            {
+                fsc_batch::Batch batch;
+                fsc_batch::Batch::Index created{ batch.MakeDirectory(destinationDirectory, destinationName.c_str(), information.st_mode & 07777) };
+                batch.Link();
+                fsc_batch::Batch::Index opened{ batch.Open(destinationDirectory, destinationName.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+                batch.Submit();
+                destination = fsc_path::FileDescriptor{ batch.GetResult(opened) };
+                if (batch.GetResult(created) < 0 && batch.GetResult(created) != -EEXIST)
+                {
+                    throw std::filesystem::filesystem_error{ "Failed to create directory", destinationName, std::error_code{ -batch.GetResult(created), std::generic_category() } };
+                }
+                if (!destination.IsValid())
+                {
+                    throw std::filesystem::filesystem_error{ "Failed to open directory", destinationName, std::error_code{ -batch.GetResult(opened), std::generic_category() } };
+                }
+            }
+
+            std::error_code error;
+            std::vector<DirectoryEntry> entries{ ReadDirectory(source.Get(), error) };
+            if (error)
+            {
+                throw std::filesystem::filesystem_error{ "Failed to read directory", sourcePath, error };
+            }
+            std::vector<const DirectoryEntry*> files;
+            for (const DirectoryEntry& entry : entries)
+            {
+                if (IsExcluded(scope, source.Get(), entry))
+                {
+                    continue;
+                }
+                if (entry.type == DT_REG)
+                {
+                    files.push_back(&entry);
+                    if (files.size() == smallFileChunk)
+                    {
+                        CopyFilesAt(source.Get(), destination.Get(), files, sourcePath);
+                        files.clear();
+                    }
+                    continue;
+                }
+                CopyTreeAt(source.Get(), entry.name, destination.Get(), entry.name, entry.type, scope.Enter(source.Get(), entry.name), sourcePath / entry.name);
+            }
+            CopyFilesAt(source.Get(), destination.Get(), files, sourcePath);
+        }
+
+        std::uintmax_t RemoveContentsAt(int directory, const fsc_exclude::Scope& scope, bool& kept, std::error_code& error);
+
+        // Never follows symlinks, a symlinked directory is removed as a link. A directory that keeps excluded entries stays.
+        std::uintmax_t RemoveTreeAt(int directory, const std::string& name, unsigned char type, const fsc_exclude::Scope& scope, std::error_code& error)
+        {
+            std::uintmax_t removed{ 0 };
+            if (type == DT_UNKNOWN)
+            {
+                std::optional<fsc_path::Metadata> metadata{ fsc_path::StatAt(directory, name.c_str(), false) };
+                if (!metadata)
+                {
+                    return removed;
+                }
+                type = ToEntryType(*metadata);
+            }
+
+            if (type == DT_DIR)
+            {
+                FSC_COUNT(SYSCALLS, 1);
+                fsc_path::FileDescriptor child{ openat(directory, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) };
+                if (!child.IsValid())
+                {
+                    error = LastError();
+                    return removed;
+                }
+                bool kept{ false };
+                removed += RemoveContentsAt(child.Get(), scope, kept, error);
+                if (error || kept)
+                {
+                    return removed;
+                }
+            }
+
+            fsc_io::IoScheduler::Operation operation{ fsc_io::GetIoScheduler() };
+            FSC_COUNT(SYSCALLS, 1);
+            if (unlinkat(directory, name.c_str(), type == DT_DIR ? AT_REMOVEDIR : 0) != 0)
+            {
+                if (errno != ENOENT)
+                {
+                    error = LastError();
+                    FSC_COUNT(ERRORS, 1);
+                }
+                return removed;
+            }
+            return removed + 1;
+        }
+
+        // Subdirectories are emptied first, then every entry of the directory is unlinked in batches.
+        std::uintmax_t RemoveContentsAt(int directory, const fsc_exclude::Scope& scope, bool& kept, std::error_code& error)
+        {
+            std::uintmax_t removed{ 0 };
+            std::vector<DirectoryEntry> entries{ ReadDirectory(directory, error) };
+            fsc_batch::Batch batch;
+            auto Flush = [&]()
+            {
+                batch.Submit();
+                for (std::size_t i{ 0 }; i < batch.GetSize(); ++i)
+                {
+                    int result{ batch.GetResult(i) };
+                    if (result == 0)
+                    {
+                        ++removed;
+                    }
+                    else if (result != -ENOENT && !error)
+                    {
+                        error = std::error_code{ -result, std::generic_category() };
+                    }
+                }
+                batch.Clear();
+            };
+
+            for (DirectoryEntry& entry : entries)
+            {
+                if (error)
+                {
+                    break;
+                }
+                if (entry.type == DT_UNKNOWN)
+                {
+                    std::optional<fsc_path::Metadata> metadata{ fsc_path::StatAt(directory, entry.name.c_str(), false) };
+                    if (!metadata)
+                    {
+                        continue;
+                    }
+                    entry.type = ToEntryType(*metadata);
+                }
+                if (IsExcluded(scope, directory, entry))
+                {
+                    kept = true;
+                    continue;
+                }
+                if (entry.type == DT_DIR)
+                {
+                    FSC_COUNT(SYSCALLS, 1);
+                    fsc_path::FileDescriptor child{ openat(directory, entry.name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) };
+                    if (!child.IsValid())
+                    {
+                        error = LastError();
+                        break;
+                    }
+                    bool childKept{ false };
+                    removed += RemoveContentsAt(child.Get(), scope.Enter(directory, entry.name), childKept, error);
+                    if (error)
+                    {
+                        break;
+                    }
+                    if (childKept)
+                    {
+                        kept = true;
+                        continue;
+                    }
+                }
+                batch.Unlink(directory, entry.name.c_str(), entry.type == DT_DIR ? AT_REMOVEDIR : 0);
+                if (batch.GetSize() >= maxBatchSize)
+                {
+                    Flush();
+                }
+            }
+            Flush();
+            return removed;
+        }
+
+        // A copy made after the source was last modified, with the same size, is taken to be current.
+        bool IsUpToDate(const fsc_path::Metadata& source, const fsc_path::Metadata& destination) noexcept
+        {
+            return destination.type == fsc_path::FileType::REGULAR && destination.size == source.size
+                && (destination.modifiedSeconds > source.modifiedSeconds || (destination.modifiedSeconds == source.modifiedSeconds && destination.modifiedNanoseconds >= source.modifiedNanoseconds));
+        }
+
+        void RemoveTreeChecked(int directory, const std::string& name, unsigned char type, const std::filesystem::path& path)
+        {
+            std::error_code error;
+            RemoveTreeAt(directory, name, type, fsc_exclude::Scope{}, error);
+            if (error)
+            {
+                throw std::filesystem::filesystem_error{ "Failed to remove", path, error };
+            }
+        }
+
+        // Follows source symlinks like CopyTreeAt. The regular files of a directory are checked in one batch of stats, and
+        // destination entries with no source entry of the same name are removed unless they are excluded.
+        void MirrorTreeAt(int sourceDirectory, const std::string& sourceName, int destinationDirectory, const std::string& destinationName, bool skipUnchanged, const fsc_exclude::Scope& scope, const std::filesystem::path& sourcePath)
+        {
+            std::optional<fsc_path::Metadata> source{ fsc_path::StatAt(sourceDirectory, sourceName.c_str(), true) };
+            std::optional<fsc_path::Metadata> destination{ fsc_path::StatAt(destinationDirectory, destinationName.c_str(), false) };
+            bool directory{ source && source->type == fsc_path::FileType::DIRECTORY };
+            if (destination && (!source || (destination->type == fsc_path::FileType::DIRECTORY) != directory || destination->type == fsc_path::FileType::SYMLINK))
+            {
+                RemoveTreeChecked(destinationDirectory, destinationName, DT_UNKNOWN, sourcePath);
+                destination.reset();
+            }
+            if (!source)
+            {
+                return;
+            }
+            if (!directory)
+            {
+                CheckCopyable(ToEntryType(*source), sourcePath);
+                if (!skipUnchanged || !destination || !IsUpToDate(*source, *destination))
+                {
+                    CopyFileAt(sourceDirectory, sourceName.c_str(), destinationDirectory, destinationName.c_str(), sourcePath);
+                }
+                return;
+            }
+
+            FSC_COUNT(SYSCALLS, 3);
+            fsc_path::FileDescriptor sourceHandle{ openat(sourceDirectory, sourceName.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+            if (!sourceHandle.IsValid())
+            {
+                throw std::filesystem::filesystem_error{ "Failed to open directory", sourcePath, LastError() };
+            }
+            if (!destination && mkdirat(destinationDirectory, destinationName.c_str(), source->mode & 07777) != 0 && errno != EEXIST)
+            {
+                throw std::filesystem::filesystem_error{ "Failed to create directory", destinationName, LastError() };
+            }
+            fsc_path::FileDescriptor destinationHandle{ openat(destinationDirectory, destinationName.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) };
+            if (!destinationHandle.IsValid())
+            {
+                throw std::filesystem::filesystem_error{ "Failed to open directory", destinationName, LastError() };
+            }
+
+            std::error_code error;
+            std::vector<DirectoryEntry> sourceEntries{ ReadDirectory(sourceHandle.Get(), error) };
+            std::vector<DirectoryEntry> destinationEntries{ ReadDirectory(destinationHandle.Get(), error) };
+            if (error)
+            {
+                throw std::filesystem::filesystem_error{ "Failed to read directory", sourcePath, error };
+            }
+            std::erase_if(sourceEntries, [&scope, &sourceHandle](const DirectoryEntry& entry) { return IsExcluded(scope, sourceHandle.Get(), entry); });
+            std::unordered_set<std::string_view> sourceNames;
+            for (const DirectoryEntry& entry : sourceEntries)
+            {
+                sourceNames.insert(entry.name);
+            }
+            for (const DirectoryEntry& entry : destinationEntries)
+            {
+                if (!sourceNames.contains(entry.name) && !IsExcluded(scope, destinationHandle.Get(), entry))
+                {
+                    RemoveTreeChecked(destinationHandle.Get(), entry.name, entry.type, sourcePath / entry.name);
+                }
+            }
+
+            std::vector<const DirectoryEntry*> files;
+            for (const DirectoryEntry& entry : sourceEntries)
+            {
+                if (entry.type == DT_REG)
+                {
+                    files.push_back(&entry);
+                    continue;
+                }
+                MirrorTreeAt(sourceHandle.Get(), entry.name, destinationHandle.Get(), entry.name, skipUnchanged, scope.Enter(sourceHandle.Get(), entry.name), sourcePath / entry.name);
+            }
+
+            for (std::size_t first{ 0 }; first < files.size(); first += smallFileChunk)
+            {
+                std::vector<const DirectoryEntry*> chunk{ files.begin() + static_cast<std::ptrdiff_t>(first), files.begin() + static_cast<std::ptrdiff_t>(std::min(files.size(), first + smallFileChunk)) };
+                std::vector<std::optional<fsc_path::Metadata>> sourceMetadata(chunk.size());
+                std::vector<std::optional<fsc_path::Metadata>> destinationMetadata(chunk.size());
+#if defined(__linux__)
+                std::vector<struct statx> information(chunk.size() * 2);
+                fsc_batch::Batch batch;
+                for (std::size_t i{ 0 }; i < chunk.size(); ++i)
+                {
+                    batch.Stat(sourceHandle.Get(), chunk[i]->name.c_str(), 0, &information[2 * i]);
+                    batch.Stat(destinationHandle.Get(), chunk[i]->name.c_str(), AT_SYMLINK_NOFOLLOW, &information[2 * i + 1]);
+                }
+                batch.Submit();
+                for (std::size_t i{ 0 }; i < chunk.size(); ++i)
+                {
+                    if (batch.GetResult(2 * i) == 0)
+                    {
+                        sourceMetadata[i] = fsc_path::ToMetadata(information[2 * i]);
+                    }
+                    if (batch.GetResult(2 * i + 1) == 0)
+                    {
+                        destinationMetadata[i] = fsc_path::ToMetadata(information[2 * i + 1]);
+                    }
+                }
+#else
+                for (std::size_t i{ 0 }; i < chunk.size(); ++i)
+                {
+                    sourceMetadata[i] = fsc_path::StatAt(sourceHandle.Get(), chunk[i]->name.c_str(), false);
+                    destinationMetadata[i] = fsc_path::StatAt(destinationHandle.Get(), chunk[i]->name.c_str(), false);
+                }
+#endif
+                std::vector<const DirectoryEntry*> changed;
+                for (std::size_t i{ 0 }; i < chunk.size(); ++i)
+                {
+                    // Removed since the directory was read, or changed type.
+                    if (!sourceMetadata[i] || sourceMetadata[i]->type != fsc_path::FileType::REGULAR)
+                    {
+                        MirrorTreeAt(sourceHandle.Get(), chunk[i]->name, destinationHandle.Get(), chunk[i]->name, skipUnchanged, scope.Enter(sourceHandle.Get(), chunk[i]->name), sourcePath / chunk[i]->name);
+                        continue;
+                    }
+                    if (destinationMetadata[i] && destinationMetadata[i]->type != fsc_path::FileType::REGULAR)
+                    {
+                        RemoveTreeChecked(destinationHandle.Get(), chunk[i]->name, DT_UNKNOWN, sourcePath / chunk[i]->name);
+                        destinationMetadata[i].reset();
+                    }
+                    if (!skipUnchanged || !destinationMetadata[i] || !IsUpToDate(*sourceMetadata[i], *destinationMetadata[i]))
+                    {
+                        changed.push_back(chunk[i]);
+                    }
+                }
+                CopyFilesAt(sourceHandle.Get(), destinationHandle.Get(), changed, sourcePath);
+            }
+        }
+#else
+        void CopyFile(const std::filesystem::path& source, const std::filesystem::path& destination)
+        {
+            fsc_io::IoScheduler& scheduler{ fsc_io::GetIoScheduler() };
+            std::ifstream input{ source, std::ios::binary };
+            if (!input)
+            {
+                throw std::filesystem::filesystem_error{ "Failed to open file", source, std::make_error_code(std::errc::io_error) };
+            }
+            std::ofstream output{ destination, std::ios::binary | std::ios::trunc };
+            if (!output)
+            {
+                throw std::filesystem::filesystem_error{ "Failed to create file", destination, std::make_error_code(std::errc::io_error) };
+            }
+
+            std::vector<char> buffer(fsc_io::GetCopySettings().blockSize);
+            while (true)
+            {
+                std::streamsize received{ input.rdbuf()->sgetn(buffer.data(), static_cast<std::streamsize>(buffer.size())) };
+                if (received <= 0)
+                {
+                    break;
+                }
+
+                fsc_io::IoScheduler::Operation operation{ scheduler, static_cast<std::uint64_t>(received) };
+                if (output.rdbuf()->sputn(buffer.data(), received) != received)
+                {
+                    FSC_COUNT(ERRORS, 1);
+                    throw std::filesystem::filesystem_error{ "Failed to write file", destination, std::make_error_code(std::errc::io_error) };
+                }
+                FSC_COUNT(BYTES, received);
+            }
+            output.close();
+            if (!output)
+            {
+                throw std::filesystem::filesystem_error{ "Failed to write file", destination, std::make_error_code(std::errc::io_error) };
+            }
+            std::filesystem::permissions(destination, std::filesystem::status(source).permissions());
+            FSC_COUNT(ENTRIES, 1);
+        }
+
+        void CopyTreePath(const std::filesystem::path& source, const std::filesystem::path& destination, const fsc_exclude::Scope& scope)
+        {
+            if (!std::filesystem::is_directory(source))
+            {
+                CopyFile(source, destination);
+                return;
+            }
+
+            {
+                fsc_io::IoScheduler::Operation operation{ fsc_io::GetIoScheduler() };
+                if (!std::filesystem::is_directory(destination))
+                {
+                    std::filesystem::create_directory(destination, source);
+                }
+            }
+            FSC_COUNT(ENTRIES, 1);
+
+            for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(source))
+            {
+                if (!scope.IsExcluded(entry.path().filename().string(), entry.is_directory() && !entry.is_symlink()))
+                {
+                    CopyTreePath(entry.path(), destination / entry.path().filename(), scope.Enter(entry.path()));
+                }
+            }
+        }
+
+        std::uintmax_t RemoveContentsPath(const std::filesystem::path& path, const fsc_exclude::Scope& scope, bool& kept, std::error_code& error);
+
+        std::uintmax_t RemoveTreePath(const std::filesystem::path& path, const fsc_exclude::Scope& scope, bool& kept, std::error_code& error)
+        {
+            std::uintmax_t removed{ 0 };
+            std::filesystem::file_status status{ std::filesystem::symlink_status(path, error) };
+            if (error)
+            {
+                return removed;
+            }
+            if (std::filesystem::is_directory(status))
+            {
+                bool childKept{ false };
+                removed += RemoveContentsPath(path, scope, childKept, error);
+                if (error || childKept)
+                {
+                    kept = kept || childKept;
+                    return removed;
+                }
+            }
+
+            fsc_io::IoScheduler::Operation operation{ fsc_io::GetIoScheduler() };
+            if (std::filesystem::remove(path, error))
+            {
+                removed += 1;
+                FSC_COUNT(ENTRIES, 1);
+            }
+            if (error)
+            {
+                FSC_COUNT(ERRORS, 1);
+            }
+            return removed;
+        }
+
+        std::uintmax_t RemoveContentsPath(const std::filesystem::path& path, const fsc_exclude::Scope& scope, bool& kept, std::error_code& error)
+        {
+            std::uintmax_t removed{ 0 };
+            std::filesystem::directory_iterator iterator{ path, error };
+            std::vector<std::filesystem::path> entries;
+            for (; !error && iterator != std::filesystem::directory_iterator{}; iterator.increment(error))
+            {
+                entries.push_back(iterator->path());
+            }
+            for (const std::filesystem::path& entry : entries)
+            {
+                if (error)
+                {
+                    break;
+                }
+                if (scope.IsExcluded(entry.filename().string(), std::filesystem::is_directory(std::filesystem::symlink_status(entry))))
+                {
+                    kept = true;
+                    continue;
+                }
+                removed += RemoveTreePath(entry, scope.Enter(entry), kept, error);
+            }
+            return removed;
+        }
+
+        void MirrorTreePath(const std::filesystem::path& source, const std::filesystem::path& destination, bool skipUnchanged, const fsc_exclude::Scope& scope)
+        {
+            std::error_code error;
+            bool kept{ false };
+            std::filesystem::file_status sourceStatus{ std::filesystem::status(source) };
+            std::filesystem::file_status destinationStatus{ std::filesystem::symlink_status(destination) };
+            bool directory{ std::filesystem::is_directory(sourceStatus) };
+            if (std::filesystem::exists(destinationStatus) && (!std::filesystem::exists(sourceStatus) || std::filesystem::is_directory(destinationStatus) != directory || std::filesystem::is_symlink(destinationStatus)))
+            {
+                RemoveTreePath(destination, fsc_exclude::Scope{}, kept, error);
+                if (error)
+                {
+                    throw std::filesystem::filesystem_error{ "Failed to remove", destination, error };
+                }
+                destinationStatus = std::filesystem::file_status{ std::filesystem::file_type::not_found };
+            }
+            if (!std::filesystem::exists(sourceStatus))
+            {
+                return;
+            }
+            if (!directory)
+            {
+                if (!skipUnchanged || !std::filesystem::exists(destinationStatus) || std::filesystem::file_size(source) != std::filesystem::file_size(destination)
+                    || std::filesystem::last_write_time(destination) < std::filesystem::last_write_time(source))
+                {
+                    CopyFile(source, destination);
+                }
+                return;
+            }
+
+            if (!std::filesystem::exists(destinationStatus))
+            {
+                fsc_io::IoScheduler::Operation operation{ fsc_io::GetIoScheduler() };
+                std::filesystem::create_directory(destination, source);
+            }
+            for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(destination))
+            {
+                std::string name{ entry.path().filename().string() };
+                if (!std::filesystem::exists(std::filesystem::symlink_status(source / name)) && !scope.IsExcluded(name, entry.is_directory() && !entry.is_symlink()))
+                {
+                    RemoveTreePath(entry.path(), fsc_exclude::Scope{}, kept, error);
+                    if (error)
+                    {
+                        throw std::filesystem::filesystem_error{ "Failed to remove", entry.path(), error };
+                    }
+                }
+            }
+            for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(source))
+            {
+                if (!scope.IsExcluded(entry.path().filename().string(), entry.is_directory() && !entry.is_symlink()))
+                {
+                    MirrorTreePath(entry.path(), destination / entry.path().filename(), skipUnchanged, scope.Enter(entry.path()));
+                }
+            }
+        }
+#endif
+    }
+
+    void CopyTree(const fsc_path::ResolvedPath& source, const fsc_path::ResolvedPath& destinationDirectory, const std::string& destinationName)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        CopyTreeAt(source.GetParentDescriptor(), source.GetName(), destinationDirectory.GetDescriptor(), destinationName, source.IsDirectory() ? DT_DIR : DT_REG, fsc_exclude::Open(source), source.GetPath());
+#else
+        CopyTreePath(source.GetPath(), destinationDirectory.GetPath() / destinationName, fsc_exclude::Open(source));
+#endif
+    }
+
+    void MirrorTree(const fsc_path::ResolvedPath& source, const fsc_path::ResolvedPath& destinationDirectory, const std::string& destinationName, bool skipUnchanged, const fsc_exclude::Scope& scope)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        MirrorTreeAt(source.GetParentDescriptor(), source.GetName(), destinationDirectory.GetDescriptor(), destinationName, skipUnchanged, scope, source.GetPath());
+#else
+        MirrorTreePath(source.GetPath(), destinationDirectory.GetPath() / destinationName, skipUnchanged, scope);
+#endif
+    }
+
+    std::uintmax_t RemoveTree(const fsc_path::ResolvedPath& path, std::error_code& error)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        return RemoveTreeAt(path.GetParentDescriptor(), path.GetName(), DT_UNKNOWN, fsc_exclude::Open(path), error);
+#else
+        bool kept{ false };
+        return RemoveTreePath(path.GetPath(), fsc_exclude::Open(path), kept, error);
+#endif
+    }
+
+    std::uintmax_t RemoveContents(const fsc_path::ResolvedPath& path, std::error_code& error)
+    {
+        bool kept{ false };
+#if defined(__unix__) || defined(__APPLE__)
+        return RemoveContentsAt(path.GetDescriptor(), fsc_exclude::Open(path), kept, error);
+#else
+        return RemoveContentsPath(path.GetPath(), fsc_exclude::Open(path), kept, error);
+#endif
+    }
+
+    bool IsEmptyDirectory(const fsc_path::ResolvedPath& path)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        FSC_COUNT(SYSCALLS, 1);
+        int descriptor{ openat(path.GetDescriptor(), ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+        DIR* stream{ descriptor >= 0 ? fdopendir(descriptor) : nullptr };
+        if (stream == nullptr)
+        {
+            std::error_code error{ LastError() };
+            if (descriptor >= 0)
+            {
+                close(descriptor);
+            }
+            throw std::filesystem::filesystem_error{ "Failed to read directory", path.GetPath(), error };
+        }
+        bool empty{ true };
+        while (dirent* entry{ readdir(stream) })
+        {
+            std::string_view name{ entry->d_name };
+            if (name != "." && name != "..")
+            {
+                empty = false;
+                break;
+            }
+        }
+        closedir(stream);
+        return empty;
+#else
+        return std::filesystem::is_empty(path.GetPath());
+#endif
+    }
+
+    void Rename(const fsc_path::ResolvedPath& source, const fsc_path::ResolvedPath& destination, std::error_code& error)
+    {
+        fsc_io::IoScheduler::Operation operation{ fsc_io::GetIoScheduler() };
+        FSC_COUNT(SYSCALLS, 1);
+#if defined(__unix__) || defined(__APPLE__)
+        if (renameat(source.GetParentDescriptor(), source.GetName().c_str(), destination.GetParentDescriptor(), destination.GetName().c_str()) != 0)
+        {
+            error = LastError();
+        }
+#else
+        std::filesystem::rename(source.GetPath(), destination.GetPath(), error);
+#endif
+    }
+}
\ No newline at end of file
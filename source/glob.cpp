@@ -0,0 +1,203 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <utility>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+
+#include "glob.hpp"
+#include "instrumentation.hpp"
+
+namespace fsc_glob
+{
+    namespace
+    {
+        // Matches one "[...]" class starting at pattern[position], moves position past it. A class without a closing
+        // bracket is matched as a literal "[".
+        bool MatchClass(std::string_view pattern, std::size_t& position, char character) noexcept
+        {
+            std::size_t index{ position + 1 };
+            bool negated{ index < pattern.size() && (pattern[index] == '!' || pattern[index] == '^') };
+            if (negated)
+            {
+                ++index;
+            }
+
+            bool matched{ false };
+            bool first{ true };
+            while (index < pattern.size() && (pattern[index] != ']' || first))
+            {
+                first = false;
+                char low{ pattern[index] };
+                if (low == '\\' && index + 1 < pattern.size())
+                {
+                    low = pattern[++index];
+                }
+                char high{ low };
+                if (index + 2 < pattern.size() && pattern[index + 1] == '-' && pattern[index + 2] != ']')
+                {
+                    high = pattern[index + 2];
+                    index += 2;
+                }
+                if (static_cast<unsigned char>(character) >= static_cast<unsigned char>(low) && static_cast<unsigned char>(character) <= static_cast<unsigned char>(high))
+                {
+                    matched = true;
+                }
+                ++index;
+            }
+
+            if (index >= pattern.size())
+            {
+                ++position;
+                return character == '[';
+            }
+            position = index + 1;
+            return matched != negated;
+        }
+    }
+
+    bool HasWildcards(std::string_view text) noexcept
+    {
+        return text.find_first_of("*?[") != std::string_view::npos;
+    }
+
+    // Iterative matching that backtracks to the most recent "*" only, linear in practice and never recursive.
+    bool Match(std::string_view pattern, std::string_view name, bool matchHidden) noexcept
+    {
+        if (!matchHidden && !name.empty() && name[0] == '.' && (pattern.empty() || pattern[0] != '.'))
+        {
+            return false;
+        }
+
+        std::size_t patternIndex{ 0 };
+        std::size_t nameIndex{ 0 };
+        std::size_t starPattern{ std::string_view::npos };
+        std::size_t starName{ 0 };
+        while (nameIndex < name.size())
+        {
+            if (patternIndex < pattern.size())
+            {
+                char current{ pattern[patternIndex] };
+                if (current == '*')
+                {
+                    starPattern = ++patternIndex;
+                    starName = nameIndex;
+                    continue;
+                }
+                if (current == '?')
+                {
+                    ++patternIndex;
+                    ++nameIndex;
+                    continue;
+                }
+                if (current == '[')
+                {
+                    std::size_t next{ patternIndex };
+                    if (MatchClass(pattern, next, name[nameIndex]))
+                    {
+                        patternIndex = next;
+                        ++nameIndex;
+                        continue;
+                    }
+                }
+                else
+                {
+                    if (current == '\\' && patternIndex + 1 < pattern.size())
+                    {
+                        current = pattern[patternIndex + 1];
+                        if (current == name[nameIndex])
+                        {
+                            patternIndex += 2;
+                            ++nameIndex;
+                            continue;
+                        }
+                    }
+                    else if (current == name[nameIndex])
+                    {
+                        ++patternIndex;
+                        ++nameIndex;
+                        continue;
+                    }
+                }
+            }
+            if (starPattern == std::string_view::npos)
+            {
+                return false;
+            }
+            patternIndex = starPattern;
+            nameIndex = ++starName;
+        }
+
+        while (patternIndex < pattern.size() && pattern[patternIndex] == '*')
+        {
+            ++patternIndex;
+        }
+        return patternIndex == pattern.size();
+    }
+
+    std::vector<Expansion> Expand(std::span<const std::string_view> arguments)
+    {
+        FSC_TRACE_SCOPE("expand");
+        std::vector<Expansion> expansions(arguments.size());
+        std::map<std::filesystem::path, std::vector<std::pair<std::size_t, std::string>>> patternsByParent;
+        for (std::size_t i{ 0 }; i < arguments.size(); ++i)
+        {
+            std::filesystem::path path{ arguments[i] };
+            expansions[i].argument = arguments[i];
+            std::error_code error;
+            if (HasWildcards(path.parent_path().string()) && !std::filesystem::exists(std::filesystem::symlink_status(path, error)))
+            {
+                throw std::runtime_error{ "Wildcards are only supported in the last path component, \"" + std::string{ arguments[i] } + "\"." };
+            }
+            std::string pattern{ path.filename().string() };
+            if (!HasWildcards(pattern) || HasWildcards(path.parent_path().string()))
+            {
+                expansions[i].paths.push_back(std::move(path));
+                continue;
+            }
+            expansions[i].pattern = true;
+            patternsByParent[path.parent_path()].emplace_back(i, std::move(pattern));
+        }
+
+        for (const auto& [parent, patterns] : patternsByParent)
+        {
+            std::error_code error;
+            std::filesystem::directory_iterator iterator{ parent.empty() ? std::filesystem::path{ "." } : parent, error };
+            if (error)
+            {
+                continue;
+            }
+            for (const std::filesystem::directory_entry& entry : iterator)
+            {
+                FSC_COUNT(ENTRIES, 1);
+                std::string name{ entry.path().filename().string() };
+                for (const auto& [index, pattern] : patterns)
+                {
+                    if (Match(pattern, name))
+                    {
+                        expansions[index].paths.push_back(parent / name);
+                    }
+                }
+            }
+            for (const auto& pattern : patterns)
+            {
+                std::sort(expansions[pattern.first].paths.begin(), expansions[pattern.first].paths.end());
+            }
+        }
+
+        // Like the shell, a pattern without matches that names an existing item literally refers to that item.
+        for (Expansion& expansion : expansions)
+        {
+            std::error_code error;
+            if (expansion.pattern && expansion.paths.empty() && std::filesystem::exists(std::filesystem::symlink_status(expansion.argument, error)))
+            {
+                expansion.paths.emplace_back(expansion.argument);
+                expansion.pattern = false;
+            }
+        }
+        return expansions;
+    }
+}
@@ -0,0 +1,357 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <cstdint>
+#include <stdexcept>
+#include <cstdio>
+#include <algorithm>
+
+#include "instrumentation.hpp"
+
+namespace fsc_instrumentation
+{
+#if defined(FSC_INSTRUMENTATION)
+    namespace
+    {
+        struct Event
+        {
+            const char* name;
+            std::int64_t start;
+            std::int64_t end;
+        };
+
+        struct QueueSample
+        {
+            std::int64_t time;
+            std::uint64_t depth;
+        };
+
+        struct ScopeTotal
+        {
+            const char* name{ nullptr };
+            std::uint64_t calls{ 0 };
+            std::int64_t total{ 0 };
+        };
+
+        // Enough for every distinct scope name, later names are dropped from the stats once it is full.
+        constexpr std::size_t maxScopes{ 64 };
+
+        // Only the owning thread writes its state, Finish reads it once the command has returned. Stats are aggregated in
+        // place, individual events and queue samples are only kept for --trace.
+        struct ThreadState
+        {
+            std::uint32_t id{ 0 };
+            std::vector<Event> events;
+            std::vector<QueueSample> queueSamples;
+            std::array<std::uint64_t, static_cast<std::size_t>(Counter::COUNT)> counters{};
+            std::array<ScopeTotal, maxScopes> scopes{};
+            std::int64_t busy{ 0 };
+            std::uint64_t maxQueueDepth{ 0 };
+        };
+
+        std::mutex threadsMutex;
+        std::vector<std::unique_ptr<ThreadState>> threads;
+        std::atomic<std::uint64_t> generation{ 0 };
+        std::int64_t enabledAt{ 0 };
+        bool statsRequested{ false };
+        bool traceRequested{ false };
+        std::string traceFile;
+
+        thread_local ThreadState* threadState{ nullptr };
+        thread_local std::uint64_t threadGeneration{ 0 };
+        // Open scopes of this thread, busy time is the time spent inside an outermost scope.
+        thread_local std::uint32_t scopeDepth{ 0 };
+
+        // Returns no state if it could not be allocated, the measurement is dropped then.
+        ThreadState* GetThreadState() noexcept
+        {
+            std::uint64_t currentGeneration{ generation.load(std::memory_order_acquire) };
+            if (threadState == nullptr || threadGeneration != currentGeneration)
+            {
+                try
+                {
+                    std::lock_guard<std::mutex> lock{ threadsMutex };
+                    threads.push_back(std::make_unique<ThreadState>());
+                    threadState = threads.back().get();
+                    threadState->id = static_cast<std::uint32_t>(threads.size() - 1);
+                    threadGeneration = currentGeneration;
+                }
+                catch (const std::bad_alloc&)
+                {
+                    return nullptr;
+                }
+            }
+            return threadState;
+        }
+
+        ScopeTotal* FindScope(ThreadState& state, const char* name) noexcept
+        {
+            std::size_t slot{ static_cast<std::size_t>(reinterpret_cast<std::uintptr_t>(name) >> 3) % maxScopes };
+            for (std::size_t probe{ 0 }; probe < maxScopes; ++probe, slot = (slot + 1) % maxScopes)
+            {
+                ScopeTotal& scope{ state.scopes[slot] };
+                if (scope.name == name || scope.name == nullptr)
+                {
+                    scope.name = name;
+                    return &scope;
+                }
+            }
+            return nullptr;
+        }
+
+        double ToMilliseconds(std::int64_t nanoseconds) noexcept
+        {
+            return static_cast<double>(nanoseconds) / 1e6;
+        }
+
+        double ToMicroseconds(std::int64_t nanoseconds) noexcept
+        {
+            return static_cast<double>(nanoseconds) / 1e3;
+        }
+
+        std::string_view CounterName(std::size_t counter) noexcept
+        {
+            switch (static_cast<Counter>(counter))
+            {
+            case Counter::SYSCALLS: return "syscalls";
+            case Counter::BYTES: return "bytes";
+            case Counter::ENTRIES: return "entries";
+            case Counter::ERRORS: return "errors";
+            default: return "unknown";
+            }
+        }
+
+        void PrintStats(std::int64_t finishedAt)
+        {
+            std::array<std::uint64_t, static_cast<std::size_t>(Counter::COUNT)> totals{};
+            std::uint64_t maxQueueDepth{ 0 };
+            std::map<std::string_view, ScopeTotal> scopes;
+
+            for (const std::unique_ptr<ThreadState>& thread : threads)
+            {
+                for (std::size_t i{ 0 }; i < totals.size(); ++i)
+                {
+                    totals[i] += thread->counters[i];
+                }
+                maxQueueDepth = std::max(maxQueueDepth, thread->maxQueueDepth);
+                for (const ScopeTotal& threadScope : thread->scopes)
+                {
+                    if (threadScope.name != nullptr)
+                    {
+                        ScopeTotal& scope{ scopes[threadScope.name] };
+                        scope.calls += threadScope.calls;
+                        scope.total += threadScope.total;
+                    }
+                }
+            }
+
+            std::int64_t wall{ finishedAt - enabledAt };
+            char line[256];
+            std::cerr << "Stats:\n";
+            std::snprintf(line, sizeof(line), "  %-24s %12.3f ms\n", "wall time", ToMilliseconds(wall));
+            std::cerr << line;
+            for (std::size_t i{ 0 }; i < totals.size(); ++i)
+            {
+                std::snprintf(line, sizeof(line), "  %-24s %12llu\n", std::string{ CounterName(i) }.c_str(), static_cast<unsigned long long>(totals[i]));
+                std::cerr << line;
+            }
+            std::snprintf(line, sizeof(line), "  %-24s %12llu\n", "max queue depth", static_cast<unsigned long long>(maxQueueDepth));
+            std::cerr << line;
+
+            std::cerr << "  Scopes:\n";
+            for (const auto& [name, scope] : scopes)
+            {
+                std::snprintf(line, sizeof(line), "    %-22s %12llu calls %12.3f ms\n", std::string{ name }.c_str(), static_cast<unsigned long long>(scope.calls), ToMilliseconds(scope.total));
+                std::cerr << line;
+            }
+
+            std::cerr << "  Threads:\n";
+            for (const std::unique_ptr<ThreadState>& thread : threads)
+            {
+                std::int64_t busy{ thread->busy };
+                double utilization{ wall > 0 ? 100.0 * static_cast<double>(busy) / static_cast<double>(wall) : 0.0 };
+                std::snprintf(line, sizeof(line), "    thread %-15u %12.3f ms busy %6.1f%%\n", thread->id, ToMilliseconds(busy), utilization);
+                std::cerr << line;
+            }
+            std::cerr << std::flush;
+        }
+
+        void WriteTrace()
+        {
+            std::ofstream file{ traceFile };
+            if (!file)
+            {
+                throw std::runtime_error{ "Failed to write trace file \"" + traceFile + "\"." };
+            }
+            // Microseconds with nanosecond precision, the default six significant digits would round long runs to milliseconds.
+            file << std::fixed << std::setprecision(3);
+
+            file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+            bool first{ true };
+            auto Separator = [&file, &first]()
+            {
+                if (!first)
+                {
+                    file << ",\n";
+                }
+                first = false;
+            };
+
+            for (const std::unique_ptr<ThreadState>& thread : threads)
+            {
+                Separator();
+                file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->id << ",\"args\":{\"name\":\"thread " << thread->id << "\"}}";
+                for (const Event& event : thread->events)
+                {
+                    Separator();
+                    file << "{\"name\":\"" << event.name << "\",\"cat\":\"fsc\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id
+                        << ",\"ts\":" << ToMicroseconds(event.start - enabledAt) << ",\"dur\":" << ToMicroseconds(event.end - event.start) << "}";
+                }
+                for (const QueueSample& sample : thread->queueSamples)
+                {
+                    Separator();
+                    file << "{\"name\":\"queue depth\",\"ph\":\"C\",\"pid\":1,\"tid\":" << thread->id
+                        << ",\"ts\":" << ToMicroseconds(sample.time - enabledAt) << ",\"args\":{\"depth\":" << sample.depth << "}}";
+                }
+            }
+            file << "\n]}\n";
+        }
+    }
+
+    void Enable(bool printStats, const std::string& tracePath)
+    {
+        {
+            std::lock_guard<std::mutex> lock{ threadsMutex };
+            threads.clear();
+            generation.fetch_add(1, std::memory_order_acq_rel);
+        }
+        statsRequested = printStats;
+        traceRequested = !tracePath.empty();
+        traceFile = tracePath;
+        enabledAt = Now();
+        enabled.store(printStats || !tracePath.empty(), std::memory_order_relaxed);
+    }
+
+    void Finish()
+    {
+        if (!enabled.exchange(false, std::memory_order_relaxed))
+        {
+            return;
+        }
+        std::int64_t finishedAt{ Now() };
+        std::lock_guard<std::mutex> lock{ threadsMutex };
+        if (statsRequested)
+        {
+            PrintStats(finishedAt);
+        }
+        if (!traceFile.empty())
+        {
+            WriteTrace();
+        }
+    }
+
+    void Add(Counter counter, std::uint64_t amount) noexcept
+    {
+        if (ThreadState* state{ GetThreadState() })
+        {
+            state->counters[static_cast<std::size_t>(counter)] += amount;
+        }
+    }
+
+    void RecordQueueDepth(std::uint64_t depth) noexcept
+    {
+        ThreadState* state{ GetThreadState() };
+        if (state == nullptr)
+        {
+            return;
+        }
+        state->maxQueueDepth = std::max(state->maxQueueDepth, depth);
+        if (traceRequested)
+        {
+            try
+            {
+                state->queueSamples.push_back(QueueSample{ Now(), depth });
+            }
+            catch (const std::bad_alloc&)
+            {
+            }
+        }
+    }
+
+    std::int64_t BeginScope() noexcept
+    {
+        ++scopeDepth;
+        return Now();
+    }
+
+    void RecordScope(const char* name, std::int64_t start, std::int64_t end) noexcept
+    {
+        --scopeDepth;
+        if (!enabled.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+        ThreadState* state{ GetThreadState() };
+        if (state == nullptr)
+        {
+            return;
+        }
+        if (ScopeTotal* scope{ FindScope(*state, name) })
+        {
+            scope->calls += 1;
+            scope->total += end - start;
+        }
+        if (scopeDepth == 0)
+        {
+            state->busy += end - start;
+        }
+        if (traceRequested)
+        {
+            try
+            {
+                state->events.push_back(Event{ name, start, end });
+            }
+            catch (const std::bad_alloc&)
+            {
+            }
+        }
+    }
+#else
+    void Enable(bool printStats, const std::string& tracePath)
+    {
+        if (printStats || !tracePath.empty())
+        {
+            throw std::runtime_error{ "fsc was built without instrumentation, \"--stats\" and \"--trace\" are unavailable." };
+        }
+    }
+
+    void Finish()
+    {
+    }
+
+    void Add(Counter, std::uint64_t) noexcept
+    {
+    }
+
+    void RecordQueueDepth(std::uint64_t) noexcept
+    {
+    }
+
+    std::int64_t BeginScope() noexcept
+    {
+        return Now();
+    }
+
+    void RecordScope(const char*, std::int64_t, std::int64_t) noexcept
+    {
+    }
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,546 @@
+#include <atomic>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "io_batch.hpp"
+#include "io_scheduler.hpp"
+#include "thread_pool.hpp"
+#include "instrumentation.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace fsc_batch
+{
+    namespace
+    {
+        // One ring's worth of operations, also the unit the scheduler throttles.
+        constexpr unsigned int ringEntries{ 256 };
+        // Below this size a pool hand off costs more than running the operations on the calling thread.
+        constexpr std::size_t inlineLimit{ 8 };
+
+        std::atomic<Backend> backend{ Backend::THREADS };
+
+        fsc_threads::ThreadPool& GetPool()
+        {
+            static fsc_threads::ThreadPool pool{ std::min<std::size_t>(fsc_threads::ThreadPool::GetDefaultThreadCount(), 16) };
+            return pool;
+        }
+
+#if defined(__linux__)
+        // A minimal io_uring without liburing: one submission and one completion ring mapped from the kernel, used by a single
+        // thread. Submissions never exceed the ring size, so the completion ring (twice as large) cannot overflow.
+        class Ring
+        {
+        public:
+
+            explicit Ring(unsigned int entries)
+            {
+                io_uring_params parameters{};
+                descriptor = static_cast<int>(syscall(SYS_io_uring_setup, entries, &parameters));
+                FSC_COUNT(SYSCALLS, 1);
+                if (descriptor < 0)
+                {
+                    return;
+                }
+
+                submissionSize = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned int);
+                completionSize = parameters.cq_off.cqes + parameters.cq_entries * sizeof(io_uring_cqe);
+                bool singleMapping{ (parameters.features & IORING_FEAT_SINGLE_MMAP) != 0 };
+                if (singleMapping)
+                {
+                    submissionSize = completionSize = std::max(submissionSize, completionSize);
+                }
+                submissionRing = Map(submissionSize, IORING_OFF_SQ_RING);
+                completionRing = singleMapping ? submissionRing : Map(completionSize, IORING_OFF_CQ_RING);
+                entriesSize = parameters.sq_entries * sizeof(io_uring_sqe);
+                void* entriesMapping{ Map(entriesSize, IORING_OFF_SQES) };
+                submissionEntries = entriesMapping == MAP_FAILED ? nullptr : static_cast<io_uring_sqe*>(entriesMapping);
+                if (submissionRing == MAP_FAILED || completionRing == MAP_FAILED || submissionEntries == nullptr)
+                {
+                    Release();
+                    return;
+                }
+
+                char* submission{ static_cast<char*>(submissionRing) };
+                submissionTail = reinterpret_cast<unsigned int*>(submission + parameters.sq_off.tail);
+                submissionMask = *reinterpret_cast<unsigned int*>(submission + parameters.sq_off.ring_mask);
+                submissionArray = reinterpret_cast<unsigned int*>(submission + parameters.sq_off.array);
+                tail = *submissionTail;
+
+                char* completion{ static_cast<char*>(completionRing) };
+                completionHead = reinterpret_cast<unsigned int*>(completion + parameters.cq_off.head);
+                completionTail = reinterpret_cast<unsigned int*>(completion + parameters.cq_off.tail);
+                completionMask = *reinterpret_cast<unsigned int*>(completion + parameters.cq_off.ring_mask);
+                completionEntries = reinterpret_cast<io_uring_cqe*>(completion + parameters.cq_off.cqes);
+            }
+
+            ~Ring()
+            {
+                Release();
+            }
+
+            Ring(const Ring&) = delete;
+            Ring& operator=(const Ring&) = delete;
+
+            bool IsValid() const noexcept
+            {
+                return descriptor >= 0;
+            }
+
+            // Every opcode the batch uses, checked once so a kernel missing one of them gets the thread backend instead.
+            bool SupportsOperations() const
+            {
+                constexpr unsigned int probeOperations{ 256 };
+                std::vector<char> storage(sizeof(io_uring_probe) + probeOperations * sizeof(io_uring_probe_op));
+                io_uring_probe* probe{ reinterpret_cast<io_uring_probe*>(storage.data()) };
+                FSC_COUNT(SYSCALLS, 1);
+                if (syscall(SYS_io_uring_register, descriptor, IORING_REGISTER_PROBE, probe, probeOperations) < 0)
+                {
+                    return false;
+                }
+                for (unsigned int opcode : { IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_CLOSE, IORING_OP_UNLINKAT, IORING_OP_MKDIRAT, IORING_OP_READ, IORING_OP_WRITE })
+                {
+                    if (opcode > probe->last_op || (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) == 0)
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            io_uring_sqe& Prepare() noexcept
+            {
+                unsigned int index{ tail & submissionMask };
+                io_uring_sqe& entry{ submissionEntries[index] };
+                std::memset(&entry, 0, sizeof(entry));
+                submissionArray[index] = index;
+                ++tail;
+                ++pending;
+                return entry;
+            }
+
+            // Publishes the prepared entries and waits until all of them completed, reporting each (user data, result).
+            template<typename Complete>
+            void SubmitAndWait(Complete complete)
+            {
+                std::atomic_ref<unsigned int>{ *submissionTail }.store(tail, std::memory_order_release);
+                unsigned int expected{ pending };
+                unsigned int completed{ 0 };
+                FSC_QUEUE_DEPTH(expected);
+                while (completed < expected)
+                {
+                    FSC_COUNT(SYSCALLS, 1);
+                    long result{ syscall(SYS_io_uring_enter, descriptor, pending, expected - completed, IORING_ENTER_GETEVENTS, nullptr, 0) };
+                    if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                    {
+                        throw std::system_error{ errno, std::generic_category(), "io_uring_enter" };
+                    }
+                    pending -= result > 0 ? static_cast<unsigned int>(result) : 0;
+
+                    unsigned int head{ *completionHead };
+                    unsigned int available{ std::atomic_ref<unsigned int>{ *completionTail }.load(std::memory_order_acquire) };
+                    for (; head != available; ++head, ++completed)
+                    {
+                        const io_uring_cqe& entry{ completionEntries[head & completionMask] };
+                        complete(entry.user_data, entry.res);
+                    }
+                    std::atomic_ref<unsigned int>{ *completionHead }.store(head, std::memory_order_release);
+                }
+            }
+
+        private:
+
+            void* Map(std::size_t size, off_t offset) const noexcept
+            {
+                return mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, descriptor, offset);
+            }
+
+            void Release() noexcept
+            {
+                if (submissionEntries != nullptr)
+                {
+                    munmap(submissionEntries, entriesSize);
+                }
+                if (completionRing != MAP_FAILED && completionRing != submissionRing)
+                {
+                    munmap(completionRing, completionSize);
+                }
+                if (submissionRing != MAP_FAILED)
+                {
+                    munmap(submissionRing, submissionSize);
+                }
+                if (descriptor >= 0)
+                {
+                    close(descriptor);
+                }
+                submissionEntries = nullptr;
+                submissionRing = completionRing = MAP_FAILED;
+                descriptor = -1;
+            }
+
+            int descriptor{ -1 };
+            void* submissionRing{ MAP_FAILED };
+            void* completionRing{ MAP_FAILED };
+            std::size_t submissionSize{ 0 };
+            std::size_t completionSize{ 0 };
+            std::size_t entriesSize{ 0 };
+            unsigned int* submissionTail{ nullptr };
+            unsigned int* submissionArray{ nullptr };
+            unsigned int submissionMask{ 0 };
+            io_uring_sqe* submissionEntries{ nullptr };
+            unsigned int* completionHead{ nullptr };
+            unsigned int* completionTail{ nullptr };
+            unsigned int completionMask{ 0 };
+            io_uring_cqe* completionEntries{ nullptr };
+            unsigned int tail{ 0 };
+            unsigned int pending{ 0 };
+
+        };
+
+        // Rings are per thread, so batches submitted from pool workers never share one.
+        Ring& GetRing()
+        {
+            thread_local Ring ring{ ringEntries };
+            return ring;
+        }
+
+        bool IsRingSupported()
+        {
+            static const bool supported{ []()
+            {
+                Ring ring{ 8 };
+                return ring.IsValid() && ring.SupportsOperations();
+            }() };
+            return supported;
+        }
+#endif
+    }
+
+#if defined(__linux__)
+    Batch::Index Batch::Stat(int directory, const char* name, int flags, struct statx* information)
+    {
+        return Add(Request{ Opcode::STAT, false, directory, flags, 0, name, information, 0, 0 });
+    }
+#endif
+
+    Batch::Index Batch::Open(int directory, const char* name, int flags, unsigned int mode)
+    {
+        return Add(Request{ Opcode::OPEN, false, directory, flags, mode, name, nullptr, 0, 0 });
+    }
+
+    Batch::Index Batch::Close(int descriptor)
+    {
+        return Add(Request{ Opcode::CLOSE, false, descriptor, 0, 0, nullptr, nullptr, 0, 0 });
+    }
+
+    Batch::Index Batch::Unlink(int directory, const char* name, int flags)
+    {
+        return Add(Request{ Opcode::UNLINK, false, directory, flags, 0, name, nullptr, 0, 0 });
+    }
+
+    Batch::Index Batch::MakeDirectory(int directory, const char* name, unsigned int mode)
+    {
+        return Add(Request{ Opcode::MAKE_DIRECTORY, false, directory, 0, mode, name, nullptr, 0, 0 });
+    }
+
+    Batch::Index Batch::Read(int descriptor, void* data, std::size_t size, std::uint64_t offset)
+    {
+        return Add(Request{ Opcode::READ, false, descriptor, 0, 0, nullptr, data, size, offset });
+    }
+
+    Batch::Index Batch::Write(int descriptor, const void* data, std::size_t size, std::uint64_t offset)
+    {
+        return Add(Request{ Opcode::WRITE, false, descriptor, 0, 0, nullptr, const_cast<void*>(data), size, offset });
+    }
+
+    void Batch::Link() noexcept
+    {
+        if (requests.size() > submitted)
+        {
+            requests.back().linked = true;
+        }
+    }
+
+    void Batch::Submit()
+    {
+        FSC_TRACE_SCOPE("batch");
+        results.resize(requests.size(), 0);
+        fsc_io::IoScheduler& scheduler{ fsc_io::GetIoScheduler() };
+        while (submitted < requests.size())
+        {
+            // Chunks end between chains, a chain is never split across two submissions.
+            std::size_t last{ submitted };
+            std::uint64_t bytes{ 0 };
+            for (std::size_t index{ submitted }; index < requests.size() && index - submitted < ringEntries; ++index)
+            {
+                if (!requests[index].linked || index + 1 == requests.size())
+                {
+                    last = index + 1;
+                }
+            }
+            if (last == submitted)
+            {
+                throw std::logic_error{ "Linked operations do not fit in one submission." };
+            }
+            for (std::size_t index{ submitted }; index < last; ++index)
+            {
+                bytes += requests[index].opcode == Opcode::WRITE ? requests[index].size : 0;
+            }
+
+            {
+                fsc_io::IoScheduler::Operation operation{ scheduler, bytes, last - submitted };
+                if (GetBackend() == Backend::URING)
+                {
+                    SubmitRing(submitted, last);
+                }
+                else
+                {
+                    SubmitThreads(submitted, last);
+                }
+            }
+            for (std::size_t index{ submitted }; index < last; ++index)
+            {
+                FSC_COUNT(BYTES, requests[index].opcode == Opcode::WRITE && results[index] > 0 ? results[index] : 0);
+                FSC_COUNT(ERRORS, results[index] < 0 ? 1 : 0);
+            }
+            submitted = last;
+        }
+    }
+
+    void Batch::Clear() noexcept
+    {
+        requests.clear();
+        results.clear();
+        submitted = 0;
+    }
+
+    int Batch::GetResult(Index index) const noexcept
+    {
+        return results[index];
+    }
+
+    std::size_t Batch::GetSize() const noexcept
+    {
+        return requests.size();
+    }
+
+    Batch::Index Batch::Add(const Request& request)
+    {
+        requests.push_back(request);
+        return requests.size() - 1;
+    }
+
+    void Batch::SubmitRing(std::size_t first, std::size_t last)
+    {
+#if defined(__linux__)
+        Ring& ring{ GetRing() };
+        if (!ring.IsValid())
+        {
+            // Setup can still fail per thread, for example when the locked memory limit is reached.
+            SubmitThreads(first, last);
+            return;
+        }
+        for (std::size_t index{ first }; index < last; ++index)
+        {
+            const Request& request{ requests[index] };
+            io_uring_sqe& entry{ ring.Prepare() };
+            entry.fd = request.descriptor;
+            entry.user_data = index;
+            if (request.linked && index + 1 < last)
+            {
+                entry.flags = IOSQE_IO_HARDLINK;
+            }
+            switch (request.opcode)
+            {
+            case Opcode::STAT:
+                entry.opcode = IORING_OP_STATX;
+                entry.addr = reinterpret_cast<std::uint64_t>(request.name);
+                entry.len = STATX_BASIC_STATS;
+                entry.off = reinterpret_cast<std::uint64_t>(request.data);
+                entry.statx_flags = static_cast<std::uint32_t>(request.flags | AT_STATX_SYNC_AS_STAT);
+                break;
+            case Opcode::OPEN:
+                entry.opcode = IORING_OP_OPENAT;
+                entry.addr = reinterpret_cast<std::uint64_t>(request.name);
+                entry.len = request.mode;
+                entry.open_flags = static_cast<std::uint32_t>(request.flags);
+                break;
+            case Opcode::CLOSE:
+                entry.opcode = IORING_OP_CLOSE;
+                break;
+            case Opcode::UNLINK:
+                entry.opcode = IORING_OP_UNLINKAT;
+                entry.addr = reinterpret_cast<std::uint64_t>(request.name);
+                entry.unlink_flags = static_cast<std::uint32_t>(request.flags);
+                break;
+            case Opcode::MAKE_DIRECTORY:
+                entry.opcode = IORING_OP_MKDIRAT;
+                entry.addr = reinterpret_cast<std::uint64_t>(request.name);
+                entry.len = request.mode;
+                break;
+            case Opcode::READ:
+            case Opcode::WRITE:
+                // Transfers above the 32 bit length complete short, like a partial read or write.
+                entry.opcode = request.opcode == Opcode::READ ? IORING_OP_READ : IORING_OP_WRITE;
+                entry.addr = reinterpret_cast<std::uint64_t>(request.data);
+                entry.len = static_cast<std::uint32_t>(std::min<std::size_t>(request.size, std::size_t{ 1 } << 30));
+                entry.off = request.offset;
+                break;
+            }
+        }
+        ring.SubmitAndWait([this](std::uint64_t index, int result) { results[index] = result; });
+#else
+        SubmitThreads(first, last);
+#endif
+    }
+
+    void Batch::SubmitThreads(std::size_t first, std::size_t last)
+    {
+        FSC_COUNT(SYSCALLS, last - first);
+        auto RunChains = [this](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t index{ begin }; index < end; ++index)
+            {
+                results[index] = Execute(requests[index]);
+            }
+        };
+        if (last - first <= inlineLimit)
+        {
+            RunChains(first, last);
+            return;
+        }
+
+        // Contiguous ranges per worker, cut only between chains so linked operations keep their order.
+        fsc_threads::ThreadPool& pool{ GetPool() };
+        std::size_t share{ (last - first + pool.GetThreadCount() - 1) / pool.GetThreadCount() };
+        std::vector<std::future<void>> tasks;
+        FSC_QUEUE_DEPTH(last - first);
+        for (std::size_t begin{ first }; begin < last;)
+        {
+            std::size_t end{ std::min(begin + share, last) };
+            while (end < last && requests[end - 1].linked)
+            {
+                ++end;
+            }
+            tasks.push_back(pool.Submit([&RunChains, begin, end]() { RunChains(begin, end); }));
+            begin = end;
+        }
+        for (std::future<void>& task : tasks)
+        {
+            task.get();
+        }
+    }
+
+    int Batch::Execute(const Request& request) noexcept
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        long result{ -1 };
+        errno = 0;
+        switch (request.opcode)
+        {
+        case Opcode::STAT:
+#if defined(__linux__)
+            result = statx(request.descriptor, request.name, request.flags | AT_STATX_SYNC_AS_STAT, STATX_BASIC_STATS, static_cast<struct statx*>(request.data));
+#else
+            errno = ENOSYS;
+#endif
+            break;
+        case Opcode::OPEN:
+            result = openat(request.descriptor, request.name, request.flags, static_cast<mode_t>(request.mode));
+            break;
+        case Opcode::CLOSE:
+            result = close(request.descriptor);
+            break;
+        case Opcode::UNLINK:
+            result = unlinkat(request.descriptor, request.name, request.flags);
+            break;
+        case Opcode::MAKE_DIRECTORY:
+            result = mkdirat(request.descriptor, request.name, static_cast<mode_t>(request.mode));
+            break;
+        case Opcode::READ:
+            do
+            {
+                result = pread(request.descriptor, request.data, request.size, static_cast<off_t>(request.offset));
+            } while (result < 0 && errno == EINTR);
+            break;
+        case Opcode::WRITE:
+            do
+            {
+                result = pwrite(request.descriptor, request.data, request.size, static_cast<off_t>(request.offset));
+            } while (result < 0 && errno == EINTR);
+            break;
+        }
+        return result < 0 ? -errno : static_cast<int>(std::min<long>(result, std::numeric_limits<int>::max()));
+#else
+        static_cast<void>(request);
+        return -ENOSYS;
+#endif
+    }
+
+    void SetBackend(std::string_view name)
+    {
+        auto IsSupported = []()
+        {
+#if defined(__linux__)
+            return IsRingSupported();
+#else
+            return false;
+#endif
+        };
+
+        if (name.empty() || name == "auto")
+        {
+            backend = IsSupported() ? Backend::URING : Backend::THREADS;
+        }
+        else if (name == "uring")
+        {
+            if (!IsSupported())
+            {
+                throw std::runtime_error{ "The io_uring backend is not available on this system, use \"--io-backend=threads\"." };
+            }
+            backend = Backend::URING;
+        }
+        else if (name == "threads")
+        {
+            backend = Backend::THREADS;
+        }
+        else
+        {
+            throw std::runtime_error{ "Invalid I/O backend \"" + std::string{ name } + "\", use auto, uring or threads." };
+        }
+    }
+
+    Backend GetBackend() noexcept
+    {
+        return backend.load(std::memory_order_relaxed);
+    }
+
+    void Prepare()
+    {
+        GetPool();
+#if defined(__linux__)
+        if (IsRingSupported())
+        {
+            GetRing();
+        }
+#endif
+    }
+}
@@ -0,0 +1,256 @@
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <thread>
+#include <algorithm>
+#include <charconv>
+#include <cctype>
+#include <limits>
+
+#include "io_scheduler.hpp"
+#include "argument_parser.hpp"
+#include "instrumentation.hpp"
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace fsc_io
+{
+    namespace
+    {
+        IoScheduler ioScheduler;
+        CopySettings copySettings;
+
+        // Bursts are capped at a tenth of a second worth of tokens.
+        constexpr double burstSeconds{ 0.1 };
+        constexpr std::chrono::nanoseconds maxAdaptiveDelay{ std::chrono::milliseconds{ 100 } };
+        constexpr std::chrono::nanoseconds adaptiveStep{ std::chrono::microseconds{ 50 } };
+        // Block sizes are kept a multiple of the largest common logical block size so they stay valid for O_DIRECT.
+        constexpr std::size_t blockAlignment{ 4096 };
+        constexpr std::size_t maxBlockSize{ std::size_t{ 1 } << 30 };
+
+        std::uint64_t ParseNumber(std::string_view flagName, std::string_view text, std::string_view& suffix)
+        {
+            std::uint64_t value{ 0 };
+            auto [end, error]{ std::from_chars(text.data(), text.data() + text.size(), value) };
+            if (error != std::errc{} || end == text.data())
+            {
+                throw std::runtime_error{ "Invalid value \"" + std::string{ text } + "\" for flag \"" + std::string{ flagName } + "\"." };
+            }
+            suffix = text.substr(static_cast<std::size_t>(end - text.data()));
+            return value;
+        }
+
+        // Accepts K, M or G with an optional B or iB, all binary multiples, so 50M, 50MB and 50MiB are the same size.
+        std::uint64_t ParseSize(std::string_view flagName, std::string_view text)
+        {
+            std::string_view suffix;
+            std::uint64_t value{ ParseNumber(flagName, text, suffix) };
+            if (suffix.empty()) { return value; }
+            int shift{ 0 };
+            switch (std::toupper(static_cast<unsigned char>(suffix[0])))
+            {
+            case 'K': shift = 10; break;
+            case 'M': shift = 20; break;
+            case 'G': shift = 30; break;
+            default: break;
+            }
+            std::string_view unit{ suffix.substr(1) };
+            if (shift == 0 || !(unit.empty() || unit == "B" || unit == "iB"))
+            {
+                throw std::runtime_error{ "Invalid size suffix \"" + std::string{ suffix } + "\" for flag \"" + std::string{ flagName } + "\", use K, M or G." };
+            }
+            if (value > (std::numeric_limits<std::uint64_t>::max() >> shift))
+            {
+                throw std::runtime_error{ "Invalid value \"" + std::string{ text } + "\" for flag \"" + std::string{ flagName } + "\"." };
+            }
+            return value << shift;
+        }
+    }
+
+    void TokenBucket::Reset(std::uint64_t tokensPerSecond, std::uint64_t burst) noexcept
+    {
+        rate = static_cast<double>(tokensPerSecond);
+        capacity = std::max(rate * burstSeconds, static_cast<double>(burst));
+        tokens = capacity;
+        last = std::chrono::steady_clock::now();
+    }
+
+    // Tokens may go negative so a request larger than the bucket still passes, after waiting for the debt.
+    std::chrono::nanoseconds TokenBucket::Take(std::uint64_t amount, std::chrono::steady_clock::time_point now) noexcept
+    {
+        if (rate <= 0.0)
+        {
+            return std::chrono::nanoseconds{ 0 };
+        }
+        double elapsed{ std::chrono::duration<double>(now - last).count() };
+        last = now;
+        tokens = std::min(capacity, tokens + elapsed * rate);
+        tokens -= static_cast<double>(amount);
+        if (tokens >= 0.0)
+        {
+            return std::chrono::nanoseconds{ 0 };
+        }
+        return std::chrono::nanoseconds{ static_cast<std::int64_t>(-tokens / rate * 1e9) };
+    }
+
+    IoScheduler::Operation::Operation(IoScheduler& ioScheduler, std::uint64_t bytes, std::uint64_t operations) : scheduler{ ioScheduler }, count{ std::max<std::uint64_t>(operations, 1) }
+    {
+        scheduler.Acquire(bytes, count);
+        start = std::chrono::steady_clock::now();
+    }
+
+    IoScheduler::Operation::~Operation()
+    {
+        scheduler.RecordLatency((std::chrono::steady_clock::now() - start) / static_cast<std::int64_t>(count));
+    }
+
+    void IoScheduler::Configure(const IoLimits& ioLimits)
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        limits = ioLimits;
+        byteBucket.Reset(limits.bytesPerSecond, 1 << 20);
+        operationBucket.Reset(limits.operationsPerSecond, 1);
+        averageLatency = 0.0;
+        adaptiveDelay = std::chrono::nanoseconds{ 0 };
+    }
+
+    bool IoScheduler::IsThrottled() const noexcept
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        return byteBucket.IsLimited() || operationBucket.IsLimited() || limits.latencyTarget.count() > 0;
+    }
+
+    void IoScheduler::Acquire(std::uint64_t bytes, std::uint64_t operations)
+    {
+        std::chrono::nanoseconds wait;
+        {
+            std::lock_guard<std::mutex> lock{ mutex };
+            std::chrono::steady_clock::time_point now{ std::chrono::steady_clock::now() };
+            wait = std::max(byteBucket.Take(bytes, now), operationBucket.Take(operations, now)) + adaptiveDelay;
+        }
+        if (wait.count() > 0)
+        {
+            FSC_TRACE_SCOPE("throttle");
+            std::this_thread::sleep_for(wait);
+        }
+    }
+
+    // Adaptive mode: additive increase of a pacing delay while the average latency is above the target, halving it otherwise.
+    void IoScheduler::RecordLatency(std::chrono::nanoseconds latency)
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        if (limits.latencyTarget.count() <= 0)
+        {
+            return;
+        }
+        averageLatency = averageLatency == 0.0 ? static_cast<double>(latency.count()) : averageLatency * 0.9 + static_cast<double>(latency.count()) * 0.1;
+        if (averageLatency > static_cast<double>(limits.latencyTarget.count()))
+        {
+            adaptiveDelay = std::min(adaptiveDelay + adaptiveStep, maxAdaptiveDelay);
+        }
+        else
+        {
+            adaptiveDelay /= 2;
+        }
+    }
+
+    IoScheduler& GetIoScheduler() noexcept
+    {
+        return ioScheduler;
+    }
+
+    const CopySettings& GetCopySettings() noexcept
+    {
+        return copySettings;
+    }
+
+    void ConfigureFromArguments(const ArgumentParser& argumentParser)
+    {
+        IoLimits limits;
+        if (argumentParser.HasFlag(FlagId::BWLIMIT))
+        {
+            limits.bytesPerSecond = ParseSize("--bwlimit", argumentParser.GetFlagValue(FlagId::BWLIMIT));
+        }
+        if (argumentParser.HasFlag(FlagId::IOPS_LIMIT))
+        {
+            limits.operationsPerSecond = ParseSize("--iops-limit", argumentParser.GetFlagValue(FlagId::IOPS_LIMIT));
+        }
+        if (argumentParser.HasFlag(FlagId::LATENCY_TARGET))
+        {
+            limits.latencyTarget = ParseDuration("--latency-target", argumentParser.GetFlagValue(FlagId::LATENCY_TARGET));
+        }
+        ioScheduler.Configure(limits);
+
+        CopySettings settings;
+        if (argumentParser.HasFlag(FlagId::BLOCK_SIZE))
+        {
+            std::uint64_t blockSize{ ParseSize("--block-size", argumentParser.GetFlagValue(FlagId::BLOCK_SIZE)) };
+            if (blockSize == 0 || blockSize > maxBlockSize)
+            {
+                throw std::runtime_error{ "Flag \"--block-size\" must be between 1 and 1G." };
+            }
+            settings.blockSize = static_cast<std::size_t>((blockSize + blockAlignment - 1) / blockAlignment * blockAlignment);
+        }
+        if (argumentParser.HasFlag(FlagId::LARGE_FILE_THRESHOLD))
+        {
+            settings.largeFileThreshold = ParseSize("--large-file-threshold", argumentParser.GetFlagValue(FlagId::LARGE_FILE_THRESHOLD));
+        }
+        settings.directIo = argumentParser.HasFlag(FlagId::DIRECT_IO);
+        copySettings = settings;
+
+        if (argumentParser.HasFlag(FlagId::IONICE))
+        {
+            SetIoPriority(argumentParser.GetFlagValue(FlagId::IONICE));
+        }
+    }
+
+    std::chrono::nanoseconds ParseDuration(std::string_view flagName, std::string_view text)
+    {
+        std::string_view suffix;
+        std::uint64_t value{ ParseNumber(flagName, text, suffix) };
+        if (suffix.empty() || suffix == "ms") { return std::chrono::milliseconds{ value }; }
+        if (suffix == "us") { return std::chrono::microseconds{ value }; }
+        if (suffix == "s") { return std::chrono::seconds{ value }; }
+        throw std::runtime_error{ "Invalid duration suffix \"" + std::string{ suffix } + "\" for flag \"" + std::string{ flagName } + "\", use us, ms or s." };
+    }
+
+    // Accepts "idle", "best-effort[:level]" or "realtime[:level]" with levels 0 (highest) to 7.
+    void SetIoPriority(std::string_view priority)
+    {
+#if defined(__linux__)
+        std::string_view className{ priority.substr(0, priority.find(':')) };
+        int level{ 4 };
+        if (className.size() < priority.size())
+        {
+            std::string_view levelText{ priority.substr(className.size() + 1) };
+            auto [end, error]{ std::from_chars(levelText.data(), levelText.data() + levelText.size(), level) };
+            if (error != std::errc{} || end != levelText.data() + levelText.size() || level < 0 || level > 7)
+            {
+                throw std::runtime_error{ "Invalid I/O priority level \"" + std::string{ levelText } + "\", use 0 to 7." };
+            }
+        }
+
+        int ioClass;
+        if (className == "realtime" || className == "rt") { ioClass = 1; }
+        else if (className == "best-effort" || className == "be") { ioClass = 2; }
+        else if (className == "idle") { ioClass = 3; level = 0; }
+        else
+        {
+            throw std::runtime_error{ "Invalid I/O priority class \"" + std::string{ className } + "\", use idle, best-effort or realtime." };
+        }
+
+        constexpr int ioprioWhoProcess{ 1 };
+        constexpr int ioprioClassShift{ 13 };
+        if (syscall(SYS_ioprio_set, ioprioWhoProcess, 0, (ioClass << ioprioClassShift) | level) != 0)
+        {
+            throw std::runtime_error{ "Failed to set I/O priority \"" + std::string{ priority } + "\"." };
+        }
+#else
+        static_cast<void>(priority);
+        throw std::runtime_error{ "Flag \"--ionice\" is not supported on this platform." };
+#endif
+    }
+}
\ No newline at end of file
@@ -2,18 +2,16 @@
 #include <stdexcept>
 
 #include "commands.hpp"
-#include "command_list.hpp"
-#include "command_structure.hpp"
+#include "server.hpp"
 
 int main(int argc, char* argv[])
 {
     try
     {
-        fsc::InitializeCommands();
-        const CommandList& commandList{ fsc::GetCommandList() };
-        ArgumentParser argumentParser{ argc, argv, commandList };
-        CommandStructure commandStructure{ commandList.GetCommandStructure(argumentParser.GetCommand()) };
-        commandStructure.func(argumentParser);
+        if (!fsc_server::ForwardToServer(argc, argv))
+        {
+            fsc::RunCommand(argc, argv);
+        }
     }
     catch (const std::exception& error)
     {
@@ -0,0 +1,393 @@
+#include <string>
+#include <optional>
+#include <filesystem>
+#include <system_error>
+#include <stdexcept>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <algorithm>
+#include <limits>
+
+#include "path_layer.hpp"
+#include "instrumentation.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#endif
+
+namespace fsc_path
+{
+#if defined(__unix__) || defined(__APPLE__)
+    namespace
+    {
+#if defined(__linux__)
+        constexpr int pathFlags{ O_PATH | O_CLOEXEC };
+#else
+        constexpr int pathFlags{ O_RDONLY | O_CLOEXEC };
+#endif
+
+        FileType ToFileType(std::uint32_t mode) noexcept
+        {
+            switch (mode & S_IFMT)
+            {
+            case S_IFREG: return FileType::REGULAR;
+            case S_IFDIR: return FileType::DIRECTORY;
+            case S_IFLNK: return FileType::SYMLINK;
+            default: return FileType::OTHER;
+            }
+        }
+
+        bool IsMissing(int error) noexcept
+        {
+            return error == ENOENT || error == ENOTDIR;
+        }
+
+        std::optional<Metadata> StatInternal(int directory, const char* name, int flags)
+        {
+            FSC_COUNT(SYSCALLS, 1);
+            Metadata metadata;
+#if defined(__linux__)
+            struct statx information{};
+            if (statx(directory, name, flags | AT_STATX_SYNC_AS_STAT, STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_INO | STATX_SIZE | STATX_MTIME, &information) != 0)
+            {
+                if (IsMissing(errno))
+                {
+                    return std::nullopt;
+                }
+                throw std::filesystem::filesystem_error{ "Failed to stat", name, std::error_code{ errno, std::generic_category() } };
+            }
+            metadata = ToMetadata(information);
+#else
+            struct stat information{};
+            int result{ name[0] == '\0' ? fstat(directory, &information) : fstatat(directory, name, &information, flags) };
+            if (result != 0)
+            {
+                if (IsMissing(errno))
+                {
+                    return std::nullopt;
+                }
+                throw std::filesystem::filesystem_error{ "Failed to stat", name, std::error_code{ errno, std::generic_category() } };
+            }
+            metadata.type = ToFileType(information.st_mode);
+            metadata.size = static_cast<std::uint64_t>(information.st_size);
+            metadata.inode = information.st_ino;
+            metadata.device = static_cast<std::uint64_t>(information.st_dev);
+            metadata.links = information.st_nlink;
+            metadata.mode = information.st_mode;
+            metadata.user = information.st_uid;
+            metadata.group = information.st_gid;
+            metadata.modifiedSeconds = information.st_mtime;
+#endif
+            return metadata;
+        }
+
+        // One path walk in the kernel through the already open handle, instead of a component by component canonical().
+        std::filesystem::path CanonicalPath(int descriptor, const std::filesystem::path& path)
+        {
+#if defined(__linux__)
+            char buffer[PATH_MAX];
+            std::string link{ "/proc/self/fd/" + std::to_string(descriptor) };
+            ssize_t length{ readlink(link.c_str(), buffer, sizeof(buffer)) };
+            FSC_COUNT(SYSCALLS, 1);
+            if (length > 0 && static_cast<std::size_t>(length) < sizeof(buffer) && buffer[0] == '/')
+            {
+                return std::filesystem::path{ std::string{ buffer, static_cast<std::size_t>(length) } };
+            }
+#else
+            static_cast<void>(descriptor);
+#endif
+            FSC_COUNT(SYSCALLS, 1);
+            return std::filesystem::canonical(path);
+        }
+    }
+
+    FileDescriptor::~FileDescriptor()
+    {
+        if (descriptor >= 0)
+        {
+            close(descriptor);
+        }
+    }
+
+    FileDescriptor::FileDescriptor(FileDescriptor&& other) noexcept : descriptor{ other.Release() }
+    {
+    }
+
+    FileDescriptor& FileDescriptor::operator=(FileDescriptor&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (descriptor >= 0)
+            {
+                close(descriptor);
+            }
+            descriptor = other.Release();
+        }
+        return *this;
+    }
+
+    int FileDescriptor::Release() noexcept
+    {
+        int released{ descriptor };
+        descriptor = -1;
+        return released;
+    }
+
+#if defined(__linux__)
+    Metadata ToMetadata(const struct statx& information) noexcept
+    {
+        Metadata metadata;
+        metadata.type = ToFileType(information.stx_mode);
+        metadata.size = information.stx_size;
+        metadata.inode = information.stx_ino;
+        metadata.device = (std::uint64_t{ information.stx_dev_major } << 32) | information.stx_dev_minor;
+        metadata.links = information.stx_nlink;
+        metadata.mode = information.stx_mode;
+        metadata.user = information.stx_uid;
+        metadata.group = information.stx_gid;
+        metadata.modifiedSeconds = information.stx_mtime.tv_sec;
+        metadata.modifiedNanoseconds = information.stx_mtime.tv_nsec;
+        return metadata;
+    }
+#endif
+
+    std::optional<Metadata> StatAt(int directory, const char* name, bool followSymlinks)
+    {
+        return StatInternal(directory, name, followSymlinks ? 0 : AT_SYMLINK_NOFOLLOW);
+    }
+
+    std::optional<Metadata> Stat(int descriptor)
+    {
+#if defined(__linux__)
+        return StatInternal(descriptor, "", AT_EMPTY_PATH);
+#else
+        return StatInternal(descriptor, "", 0);
+#endif
+    }
+
+    std::size_t GetDescriptorBudget() noexcept
+    {
+        rlimit limit{};
+        if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+        {
+            return 256;
+        }
+        if (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur / 4 >= std::numeric_limits<std::size_t>::max())
+        {
+            return std::numeric_limits<std::size_t>::max();
+        }
+        return std::max<std::size_t>(static_cast<std::size_t>(limit.rlim_cur / 4), 16);
+    }
+
+    ResolvedPath::ResolvedPath(const std::filesystem::path& unresolvedPath)
+    {
+        FSC_TRACE_SCOPE("resolve");
+        FSC_COUNT(SYSCALLS, 1);
+        handle = FileDescriptor{ open(unresolvedPath.c_str(), pathFlags) };
+        if (!handle.IsValid())
+        {
+            if (!IsMissing(errno))
+            {
+                throw std::filesystem::filesystem_error{ "Failed to open", unresolvedPath, std::error_code{ errno, std::generic_category() } };
+            }
+            path = std::filesystem::absolute(unresolvedPath).lexically_normal();
+            if (!path.has_filename())
+            {
+                path = path.parent_path();
+            }
+            name = path.filename().string();
+            FSC_COUNT(SYSCALLS, 1);
+            parent = FileDescriptor{ open(path.parent_path().c_str(), pathFlags | O_DIRECTORY) };
+            return;
+        }
+
+        metadata = Stat(handle.Get()).value_or(Metadata{});
+        path = CanonicalPath(handle.Get(), unresolvedPath);
+        name = path.has_relative_path() ? path.filename().string() : ".";
+        // A directory knows its parent, anything else is looked up again by name and has to still be the opened entry.
+        FSC_COUNT(SYSCALLS, 1);
+        if (metadata.type == FileType::DIRECTORY)
+        {
+            parent = FileDescriptor{ openat(handle.Get(), "..", pathFlags | O_DIRECTORY) };
+        }
+        else
+        {
+            parent = FileDescriptor{ open(path.parent_path().c_str(), pathFlags | O_DIRECTORY) };
+        }
+        if (!parent.IsValid())
+        {
+            throw std::filesystem::filesystem_error{ "Failed to open parent directory", path, std::error_code{ errno, std::generic_category() } };
+        }
+        if (metadata.type != FileType::DIRECTORY)
+        {
+            FSC_COUNT(SYSCALLS, 1);
+            std::optional<Metadata> entry{ StatAt(parent.Get(), name.c_str(), false) };
+            if (!entry || entry->device != metadata.device || entry->inode != metadata.inode)
+            {
+                throw std::filesystem::filesystem_error{ "Path changed while it was resolved", path, std::make_error_code(std::errc::resource_unavailable_try_again) };
+            }
+        }
+    }
+
+    ResolvedPath ResolvedPath::OpenAt(int directory, const std::filesystem::path& directoryPath, const std::string& entryName)
+    {
+        ResolvedPath entry;
+        entry.path = directoryPath / entryName;
+        entry.name = entryName;
+        if (directory < 0)
+        {
+            return entry;
+        }
+
+        FSC_COUNT(SYSCALLS, 2);
+        entry.parent = FileDescriptor{ fcntl(directory, F_DUPFD_CLOEXEC, 0) };
+        entry.handle = FileDescriptor{ openat(directory, entryName.c_str(), pathFlags) };
+        if (entry.handle.IsValid())
+        {
+            entry.metadata = Stat(entry.handle.Get()).value_or(Metadata{});
+        }
+        else if (!IsMissing(errno))
+        {
+            throw std::filesystem::filesystem_error{ "Failed to open", entry.path, std::error_code{ errno, std::generic_category() } };
+        }
+        return entry;
+    }
+
+    ResolvedPath ResolvedPath::Child(const std::string& childName) const
+    {
+        return OpenAt(metadata.type == FileType::DIRECTORY ? handle.Get() : -1, path, childName);
+    }
+
+    ResolvedPath ResolvedPath::Sibling(const std::string& siblingName) const
+    {
+        return OpenAt(parent.Get(), path.parent_path(), siblingName);
+    }
+#else
+    FileDescriptor::~FileDescriptor()
+    {
+    }
+
+    FileDescriptor::FileDescriptor(FileDescriptor&& other) noexcept : descriptor{ other.Release() }
+    {
+    }
+
+    FileDescriptor& FileDescriptor::operator=(FileDescriptor&& other) noexcept
+    {
+        descriptor = other.Release();
+        return *this;
+    }
+
+    int FileDescriptor::Release() noexcept
+    {
+        int released{ descriptor };
+        descriptor = -1;
+        return released;
+    }
+
+    std::size_t GetDescriptorBudget() noexcept
+    {
+        return 256;
+    }
+
+    std::optional<Metadata> StatAt(int, const char*, bool)
+    {
+        throw std::runtime_error{ "Descriptor relative operations are not supported on this platform." };
+    }
+
+    std::optional<Metadata> Stat(int)
+    {
+        throw std::runtime_error{ "Descriptor relative operations are not supported on this platform." };
+    }
+
+    namespace
+    {
+        Metadata StatPath(const std::filesystem::path& path)
+        {
+            Metadata metadata;
+            std::error_code error;
+            std::filesystem::file_status status{ std::filesystem::status(path, error) };
+            if (error || !std::filesystem::exists(status))
+            {
+                return metadata;
+            }
+            metadata.type = std::filesystem::is_directory(status) ? FileType::DIRECTORY : std::filesystem::is_regular_file(status) ? FileType::REGULAR : FileType::OTHER;
+            if (metadata.type == FileType::REGULAR)
+            {
+                metadata.size = std::filesystem::file_size(path, error);
+            }
+            return metadata;
+        }
+    }
+
+    ResolvedPath::ResolvedPath(const std::filesystem::path& unresolvedPath)
+    {
+        FSC_TRACE_SCOPE("resolve");
+        std::error_code error;
+        path = std::filesystem::canonical(unresolvedPath, error);
+        if (error)
+        {
+            path = std::filesystem::absolute(unresolvedPath).lexically_normal();
+        }
+        name = path.filename().string();
+        metadata = StatPath(path);
+    }
+
+    ResolvedPath ResolvedPath::OpenAt(int, const std::filesystem::path& directoryPath, const std::string& entryName)
+    {
+        ResolvedPath entry;
+        entry.path = directoryPath / entryName;
+        entry.name = entryName;
+        entry.metadata = StatPath(entry.path);
+        return entry;
+    }
+
+    ResolvedPath ResolvedPath::Child(const std::string& childName) const
+    {
+        return OpenAt(-1, path, childName);
+    }
+
+    ResolvedPath ResolvedPath::Sibling(const std::string& siblingName) const
+    {
+        return OpenAt(-1, path.parent_path(), siblingName);
+    }
+#endif
+
+    bool ResolvedPath::Exists() const noexcept
+    {
+        return metadata.type != FileType::NONE;
+    }
+
+    bool ResolvedPath::IsDirectory() const noexcept
+    {
+        return metadata.type == FileType::DIRECTORY;
+    }
+
+    const Metadata& ResolvedPath::GetMetadata() const noexcept
+    {
+        return metadata;
+    }
+
+    const std::filesystem::path& ResolvedPath::GetPath() const noexcept
+    {
+        return path;
+    }
+
+    const std::string& ResolvedPath::GetName() const noexcept
+    {
+        return name;
+    }
+
+    int ResolvedPath::GetParentDescriptor() const noexcept
+    {
+        return parent.Get();
+    }
+
+    int ResolvedPath::GetDescriptor() const noexcept
+    {
+        return handle.Get();
+    }
+}
\ No newline at end of file
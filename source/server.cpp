@@ -0,0 +1,459 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <streambuf>
+#include <filesystem>
+
+#include "server.hpp"
+#include "commands.hpp"
+#include "thread_pool.hpp"
+#include "io_batch.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+namespace fsc_server
+{
+#if defined(__unix__) || defined(__APPLE__)
+    namespace
+    {
+        // Every message is a frame: one type byte followed by a 32 bit payload length and the payload.
+        enum FrameType : char
+        {
+            STANDARD_OUTPUT = 'o',
+            STANDARD_ERROR = 'e',
+            INPUT_REQUEST = 'i',
+            INPUT_LINE = 'l',
+            INPUT_END = 'z',
+            EXIT = 'x',
+        };
+
+        // The server itself, commands that stream binary data through the client's own stdin and stdout and commands that
+        // run until interrupted stay local. So does --ionice, which would change the I/O class of the server for every later
+        // client. The server handles one client at a time and rejects all of them as well.
+        bool IsForwardable(int argc, char* argv[]) noexcept
+        {
+            std::string_view command{ argv[1] };
+            if (command == "serve" || command == "pack" || command == "unpack" || command == "watch")
+            {
+                return false;
+            }
+            for (int i{ 2 }; i < argc; ++i)
+            {
+                std::string_view argument{ argv[i] };
+                if (argument == "--ionice" || argument.starts_with("--ionice="))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        class Socket
+        {
+        public:
+
+            explicit Socket(int socketDescriptor) noexcept : descriptor{ socketDescriptor } {}
+            ~Socket() { if (descriptor >= 0) { close(descriptor); } }
+            Socket(const Socket&) = delete;
+            Socket& operator=(const Socket&) = delete;
+
+            int Get() const noexcept { return descriptor; }
+
+        private:
+
+            int descriptor;
+
+        };
+
+        bool WriteAll(int descriptor, const char* data, std::size_t size) noexcept
+        {
+            while (size > 0)
+            {
+                ssize_t written{ send(descriptor, data, size, MSG_NOSIGNAL) };
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return false;
+                }
+                data += written;
+                size -= static_cast<std::size_t>(written);
+            }
+            return true;
+        }
+
+        bool ReadAll(int descriptor, char* data, std::size_t size) noexcept
+        {
+            while (size > 0)
+            {
+                ssize_t received{ recv(descriptor, data, size, 0) };
+                if (received < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (received <= 0)
+                {
+                    return false;
+                }
+                data += received;
+                size -= static_cast<std::size_t>(received);
+            }
+            return true;
+        }
+
+        bool WriteFrame(int descriptor, char type, const char* data, std::uint32_t size) noexcept
+        {
+            char header[1 + sizeof(std::uint32_t)];
+            header[0] = type;
+            std::memcpy(header + 1, &size, sizeof(size));
+            return WriteAll(descriptor, header, sizeof(header)) && WriteAll(descriptor, data, size);
+        }
+
+        bool ReadFrame(int descriptor, char& type, std::string& payload)
+        {
+            char header[1 + sizeof(std::uint32_t)];
+            if (!ReadAll(descriptor, header, sizeof(header)))
+            {
+                return false;
+            }
+            type = header[0];
+            std::uint32_t size;
+            std::memcpy(&size, header + 1, sizeof(size));
+            payload.resize(size);
+            return ReadAll(descriptor, payload.data(), size);
+        }
+
+        sockaddr_un MakeAddress(const std::string& socketPath)
+        {
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            if (socketPath.size() >= sizeof(address.sun_path))
+            {
+                throw std::runtime_error{ "Socket path is too long \"" + socketPath + "\"." };
+            }
+            std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+            return address;
+        }
+
+        // Output written to std::cout/std::cerr while serving a client is sent back as frames.
+        class FrameOutputBuffer : public std::streambuf
+        {
+        public:
+
+            FrameOutputBuffer(int socketDescriptor, char frameType) noexcept : descriptor{ socketDescriptor }, type{ frameType }
+            {
+                setp(buffer, buffer + sizeof(buffer));
+            }
+
+        protected:
+
+            int_type overflow(int_type character) override
+            {
+                if (sync() != 0)
+                {
+                    return traits_type::eof();
+                }
+                if (!traits_type::eq_int_type(character, traits_type::eof()))
+                {
+                    *pptr() = traits_type::to_char_type(character);
+                    pbump(1);
+                }
+                return traits_type::not_eof(character);
+            }
+
+            int sync() override
+            {
+                std::uint32_t size{ static_cast<std::uint32_t>(pptr() - pbase()) };
+                if (size > 0 && !WriteFrame(descriptor, type, pbase(), size))
+                {
+                    return -1;
+                }
+                setp(buffer, buffer + sizeof(buffer));
+                return 0;
+            }
+
+        private:
+
+            int descriptor;
+            char type;
+            char buffer[16384];
+
+        };
+
+        // Reading std::cin while serving a client asks the client for one line of its standard input.
+        class FrameInputBuffer : public std::streambuf
+        {
+        public:
+
+            explicit FrameInputBuffer(int socketDescriptor) noexcept : descriptor{ socketDescriptor } {}
+
+        protected:
+
+            int_type underflow() override
+            {
+                if (gptr() < egptr())
+                {
+                    return traits_type::to_int_type(*gptr());
+                }
+                std::cout.flush();
+                char frameType;
+                if (!WriteFrame(descriptor, INPUT_REQUEST, nullptr, 0) || !ReadFrame(descriptor, frameType, line) || frameType != INPUT_LINE)
+                {
+                    return traits_type::eof();
+                }
+                line += '\n';
+                setg(line.data(), line.data(), line.data() + line.size());
+                return traits_type::to_int_type(*gptr());
+            }
+
+        private:
+
+            int descriptor;
+            std::string line;
+
+        };
+
+        void ServeClient(int descriptor)
+        {
+            char frameType;
+            std::string payload;
+            if (!ReadFrame(descriptor, frameType, payload))
+            {
+                return;
+            }
+
+            // Request payload: working directory followed by argv, each terminated by '\0'.
+            std::vector<std::string> arguments;
+            std::size_t begin{ 0 };
+            for (std::size_t i{ 0 }; i < payload.size(); ++i)
+            {
+                if (payload[i] == '\0')
+                {
+                    arguments.emplace_back(payload, begin, i - begin);
+                    begin = i + 1;
+                }
+            }
+            if (arguments.size() < 3)
+            {
+                return;
+            }
+
+            std::vector<char*> argv;
+            for (std::size_t i{ 1 }; i < arguments.size(); ++i)
+            {
+                argv.push_back(arguments[i].data());
+            }
+            argv.push_back(nullptr);
+
+            FrameOutputBuffer outputBuffer{ descriptor, STANDARD_OUTPUT };
+            FrameOutputBuffer errorBuffer{ descriptor, STANDARD_ERROR };
+            FrameInputBuffer inputBuffer{ descriptor };
+            std::streambuf* previousOutput{ std::cout.rdbuf(&outputBuffer) };
+            std::streambuf* previousError{ std::cerr.rdbuf(&errorBuffer) };
+            std::streambuf* previousInput{ std::cin.rdbuf(&inputBuffer) };
+
+            try
+            {
+                std::filesystem::current_path(arguments[0]);
+                if (!IsForwardable(static_cast<int>(argv.size() - 1), argv.data()))
+                {
+                    throw std::runtime_error{ "Command \"" + std::string{ argv[1] } + "\" cannot be forwarded to a server." };
+                }
+                fsc::RunCommand(static_cast<int>(argv.size() - 1), argv.data());
+            }
+            catch (const std::exception& error)
+            {
+                std::cerr << error.what() << std::endl;
+            }
+
+            std::cout.flush();
+            std::cerr.flush();
+            std::cout.clear();
+            std::cerr.clear();
+            std::cin.clear();
+            std::cout.rdbuf(previousOutput);
+            std::cerr.rdbuf(previousError);
+            std::cin.rdbuf(previousInput);
+
+            WriteFrame(descriptor, EXIT, nullptr, 0);
+        }
+    }
+
+    std::string GetDefaultSocketPath()
+    {
+        if (const char* socketPath{ std::getenv("FSC_SOCKET") }; socketPath != nullptr && *socketPath != '\0')
+        {
+            return socketPath;
+        }
+        if (const char* runtimeDirectory{ std::getenv("XDG_RUNTIME_DIR") }; runtimeDirectory != nullptr && *runtimeDirectory != '\0')
+        {
+            return std::string{ runtimeDirectory } + "/fsc.sock";
+        }
+        return "/tmp/fsc-" + std::to_string(getuid()) + ".sock";
+    }
+
+    void Serve(const std::string& socketPath)
+    {
+        signal(SIGPIPE, SIG_IGN);
+        sockaddr_un address{ MakeAddress(socketPath) };
+
+        {
+            Socket probe{ socket(AF_UNIX, SOCK_STREAM, 0) };
+            if (connect(probe.Get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+            {
+                throw std::runtime_error{ "A server is already listening on \"" + socketPath + "\"." };
+            }
+        }
+        unlink(socketPath.c_str());
+
+        Socket listener{ socket(AF_UNIX, SOCK_STREAM, 0) };
+        if (listener.Get() < 0)
+        {
+            throw std::runtime_error{ "Error creating socket: " + std::string{ std::strerror(errno) } };
+        }
+        // The socket is created accessible to the owner only, there is no window before a chmod.
+        mode_t previousMask{ umask(S_IRWXG | S_IRWXO | S_IXUSR) };
+        int bound{ bind(listener.Get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) };
+        int bindError{ errno };
+        umask(previousMask);
+        if (bound != 0)
+        {
+            throw std::runtime_error{ "Error binding \"" + socketPath + "\": " + std::strerror(bindError) };
+        }
+        if (listen(listener.Get(), SOMAXCONN) != 0)
+        {
+            throw std::runtime_error{ "Error listening on \"" + socketPath + "\": " + std::strerror(errno) };
+        }
+
+        // Thread pools and the io_uring probe are set up once, requests find them ready.
+        fsc_threads::GetSharedPool();
+        fsc_batch::Prepare();
+
+        std::cout << "Serving on \"" << socketPath << "\"." << std::endl;
+
+        std::filesystem::path workingDirectory{ std::filesystem::current_path() };
+        while (true)
+        {
+            Socket client{ accept(listener.Get(), nullptr, nullptr) };
+            if (client.Get() < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                {
+                    continue;
+                }
+                throw std::runtime_error{ "Error accepting connection: " + std::string{ std::strerror(errno) } };
+            }
+            ServeClient(client.Get());
+
+            std::error_code error;
+            std::filesystem::current_path(workingDirectory, error);
+        }
+    }
+
+    bool ForwardToServer(int argc, char* argv[])
+    {
+        const char* socketPath{ std::getenv("FSC_SOCKET") };
+        if (socketPath == nullptr || *socketPath == '\0' || argc < 2 || !IsForwardable(argc, argv))
+        {
+            return false;
+        }
+
+        sockaddr_un address;
+        try
+        {
+            address = MakeAddress(socketPath);
+        }
+        catch (const std::runtime_error&)
+        {
+            return false;
+        }
+
+        Socket server{ socket(AF_UNIX, SOCK_STREAM, 0) };
+        if (server.Get() < 0 || connect(server.Get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+        {
+            return false;
+        }
+        signal(SIGPIPE, SIG_IGN);
+
+        std::string request{ std::filesystem::current_path().string() };
+        request += '\0';
+        for (int i{ 0 }; i < argc; ++i)
+        {
+            request += argv[i];
+            request += '\0';
+        }
+
+        auto LostConnection = []()
+        {
+            return std::runtime_error{ "Lost connection to server \"" + GetDefaultSocketPath() + "\"." };
+        };
+
+        if (!WriteFrame(server.Get(), INPUT_LINE, request.data(), static_cast<std::uint32_t>(request.size())))
+        {
+            throw LostConnection();
+        }
+
+        char frameType;
+        std::string payload;
+        while (ReadFrame(server.Get(), frameType, payload))
+        {
+            switch (frameType)
+            {
+            case STANDARD_OUTPUT:
+                std::cout.write(payload.data(), static_cast<std::streamsize>(payload.size())).flush();
+                break;
+            case STANDARD_ERROR:
+                std::cerr.write(payload.data(), static_cast<std::streamsize>(payload.size())).flush();
+                break;
+            case INPUT_REQUEST:
+            {
+                std::string line;
+                bool sent{ std::getline(std::cin, line)
+                    ? WriteFrame(server.Get(), INPUT_LINE, line.data(), static_cast<std::uint32_t>(line.size()))
+                    : WriteFrame(server.Get(), INPUT_END, nullptr, 0) };
+                if (!sent)
+                {
+                    throw LostConnection();
+                }
+                break;
+            }
+            case EXIT:
+                return true;
+            default:
+                break;
+            }
+        }
+        throw LostConnection();
+    }
+#else
+    std::string GetDefaultSocketPath()
+    {
+        return "";
+    }
+
+    void Serve(const std::string&)
+    {
+        throw std::runtime_error{ "Command \"serve\" is not supported on this platform." };
+    }
+
+    bool ForwardToServer(int, char*[])
+    {
+        return false;
+    }
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+
+#include "sha256.hpp"
+
+namespace fsc_hash
+{
+    namespace
+    {
+        constexpr std::array<std::uint32_t, 64> roundConstants{
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+
+        constexpr std::uint32_t RotateRight(std::uint32_t value, unsigned int count) noexcept
+        {
+            return (value >> count) | (value << (32 - count));
+        }
+    }
+
+    Sha256::Sha256() noexcept : state{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 }
+    {
+    }
+
+    void Sha256::Update(const void* data, std::size_t size) noexcept
+    {
+        const std::uint8_t* bytes{ static_cast<const std::uint8_t*>(data) };
+        length += size;
+        if (buffered > 0)
+        {
+            std::size_t taken{ std::min(size, buffer.size() - buffered) };
+            std::memcpy(buffer.data() + buffered, bytes, taken);
+            buffered += taken;
+            bytes += taken;
+            size -= taken;
+            if (buffered < buffer.size())
+            {
+                return;
+            }
+            Transform(buffer.data());
+            buffered = 0;
+        }
+        for (; size >= buffer.size(); bytes += buffer.size(), size -= buffer.size())
+        {
+            Transform(bytes);
+        }
+        std::memcpy(buffer.data(), bytes, size);
+        buffered = size;
+    }
+
+    Digest Sha256::Finish() noexcept
+    {
+        std::uint64_t bits{ length * 8 };
+        constexpr std::uint8_t padding{ 0x80 };
+        Update(&padding, 1);
+        constexpr std::array<std::uint8_t, 64> zeros{};
+        Update(zeros.data(), (buffer.size() * 2 - 8 - buffered) % buffer.size());
+        std::array<std::uint8_t, 8> encodedLength;
+        for (std::size_t i{ 0 }; i < encodedLength.size(); ++i)
+        {
+            encodedLength[i] = static_cast<std::uint8_t>(bits >> (56 - 8 * i));
+        }
+        Update(encodedLength.data(), encodedLength.size());
+
+        Digest digest;
+        for (std::size_t i{ 0 }; i < state.size(); ++i)
+        {
+            for (std::size_t j{ 0 }; j < 4; ++j)
+            {
+                digest[i * 4 + j] = static_cast<std::uint8_t>(state[i] >> (24 - 8 * j));
+            }
+        }
+        return digest;
+    }
+
+    Digest Sha256::Hash(const void* data, std::size_t size) noexcept
+    {
+        Sha256 hash;
+        hash.Update(data, size);
+        return hash.Finish();
+    }
+
+    void Sha256::Transform(const std::uint8_t* block) noexcept
+    {
+        std::array<std::uint32_t, 64> schedule;
+        for (std::size_t i{ 0 }; i < 16; ++i)
+        {
+            schedule[i] = (std::uint32_t{ block[i * 4] } << 24) | (std::uint32_t{ block[i * 4 + 1] } << 16) | (std::uint32_t{ block[i * 4 + 2] } << 8) | block[i * 4 + 3];
+        }
+        for (std::size_t i{ 16 }; i < schedule.size(); ++i)
+        {
+            std::uint32_t s0{ RotateRight(schedule[i - 15], 7) ^ RotateRight(schedule[i - 15], 18) ^ (schedule[i - 15] >> 3) };
+            std::uint32_t s1{ RotateRight(schedule[i - 2], 17) ^ RotateRight(schedule[i - 2], 19) ^ (schedule[i - 2] >> 10) };
+            schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+        }
+
+        std::uint32_t a{ state[0] }, b{ state[1] }, c{ state[2] }, d{ state[3] }, e{ state[4] }, f{ state[5] }, g{ state[6] }, h{ state[7] };
+        for (std::size_t i{ 0 }; i < schedule.size(); ++i)
+        {
+            std::uint32_t s1{ RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25) };
+            std::uint32_t choice{ (e & f) ^ (~e & g) };
+            std::uint32_t first{ h + s1 + choice + roundConstants[i] + schedule[i] };
+            std::uint32_t s0{ RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22) };
+            std::uint32_t majority{ (a & b) ^ (a & c) ^ (b & c) };
+            std::uint32_t second{ s0 + majority };
+            h = g;
+            g = f;
+            f = e;
+            e = d + first;
+            d = c;
+            c = b;
+            b = a;
+            a = first + second;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+
+    std::string ToHex(const Digest& digest)
+    {
+        constexpr char digits[]{ "0123456789abcdef" };
+        std::string hex(digest.size() * 2, '0');
+        for (std::size_t i{ 0 }; i < digest.size(); ++i)
+        {
+            hex[i * 2] = digits[digest[i] >> 4];
+            hex[i * 2 + 1] = digits[digest[i] & 0x0f];
+        }
+        return hex;
+    }
+}
@@ -0,0 +1,1072 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <chrono>
+#include <ctime>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+
+#include "snapshot_store.hpp"
+#include "sha256.hpp"
+#include "tree_model.hpp"
+#include "thread_pool.hpp"
+#include "io_batch.hpp"
+#include "io_scheduler.hpp"
+#include "instrumentation.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace fsc_snapshot
+{
+#if defined(__unix__) || defined(__APPLE__)
+    namespace
+    {
+        // FastCDC style chunking: no cut point before the minimum, a stricter mask up to the average size and a looser one
+        // after it, which keeps chunk sizes close to the average, and a forced cut at the maximum.
+        constexpr std::size_t minChunkSize{ 16 << 10 };
+        constexpr std::size_t averageChunkSize{ 64 << 10 };
+        constexpr std::size_t maxChunkSize{ 256 << 10 };
+        constexpr std::uint64_t strictMask{ ~std::uint64_t{ 0 } << (64 - 18) };
+        constexpr std::uint64_t looseMask{ ~std::uint64_t{ 0 } << (64 - 14) };
+        constexpr std::string_view manifestMagic{ "FSCSNAP1" };
+        // Files are processed at most this far ahead of the slowest one still running, which bounds the queued tasks.
+        constexpr std::size_t maxPendingFiles{ 4096 };
+
+        // Fixed pseudo random values per byte, generated with splitmix64 so chunk boundaries never change between builds.
+        constexpr std::array<std::uint64_t, 256> gearTable{ []()
+        {
+            std::array<std::uint64_t, 256> table{};
+            std::uint64_t state{ 0x66736353'6e617031 };
+            for (std::uint64_t& value : table)
+            {
+                state += 0x9e3779b97f4a7c15;
+                std::uint64_t mixed{ state };
+                mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9;
+                mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111eb;
+                value = mixed ^ (mixed >> 31);
+            }
+            return table;
+        }() };
+
+        std::error_code LastError() noexcept
+        {
+            return std::error_code{ errno, std::generic_category() };
+        }
+
+        // Returns the length of the next chunk at the start of data, size must reach maxChunkSize unless the file ends sooner.
+        std::size_t FindCut(const std::uint8_t* data, std::size_t size) noexcept
+        {
+            if (size <= minChunkSize)
+            {
+                return size;
+            }
+            std::size_t limit{ std::min(size, maxChunkSize) };
+            std::size_t normal{ std::min(limit, averageChunkSize) };
+            std::uint64_t hash{ 0 };
+            std::size_t index{ minChunkSize };
+            for (; index < normal; ++index)
+            {
+                hash = (hash << 1) + gearTable[data[index]];
+                if ((hash & strictMask) == 0)
+                {
+                    return index + 1;
+                }
+            }
+            for (; index < limit; ++index)
+            {
+                hash = (hash << 1) + gearTable[data[index]];
+                if ((hash & looseMask) == 0)
+                {
+                    return index + 1;
+                }
+            }
+            return limit;
+        }
+
+        struct DigestHash
+        {
+            std::size_t operator()(const fsc_hash::Digest& digest) const noexcept
+            {
+                std::size_t hash;
+                std::memcpy(&hash, digest.data(), sizeof(hash));
+                return hash;
+            }
+        };
+
+        struct ChunkReference
+        {
+            fsc_hash::Digest digest;
+            std::uint32_t size;
+        };
+
+        struct ManifestEntry
+        {
+            // Relative to the snapshot root, empty for the root itself.
+            std::string path;
+            fsc_path::FileType type{ fsc_path::FileType::NONE };
+            std::uint32_t mode{ 0 };
+            std::int64_t modified{ 0 };
+            std::uint64_t size{ 0 };
+            std::uint64_t inode{ 0 };
+            std::string target;
+            std::vector<ChunkReference> chunks;
+        };
+
+        struct Manifest
+        {
+            std::string source;
+            std::vector<ManifestEntry> entries;
+        };
+
+        void ReadFully(int descriptor, void* data, std::size_t size, const std::filesystem::path& path)
+        {
+            for (std::size_t received{ 0 }; received < size;)
+            {
+                ssize_t result{ read(descriptor, static_cast<char*>(data) + received, size - received) };
+                FSC_COUNT(SYSCALLS, 1);
+                if (result < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (result <= 0)
+                {
+                    throw std::filesystem::filesystem_error{ "Failed to read", path, result < 0 ? LastError() : std::make_error_code(std::errc::io_error) };
+                }
+                received += static_cast<std::size_t>(result);
+            }
+        }
+
+        void WriteFully(int descriptor, const void* data, std::size_t size, const std::filesystem::path& path)
+        {
+            for (std::size_t written{ 0 }; written < size;)
+            {
+                ssize_t result{ write(descriptor, static_cast<const char*>(data) + written, size - written) };
+                FSC_COUNT(SYSCALLS, 1);
+                if (result < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (result < 0)
+                {
+                    FSC_COUNT(ERRORS, 1);
+                    throw std::filesystem::filesystem_error{ "Failed to write", path, LastError() };
+                }
+                written += static_cast<std::size_t>(result);
+            }
+        }
+
+        class ChunkStore
+        {
+        public:
+
+            ChunkStore(const std::filesystem::path& storePath, bool create) : path{ storePath }
+            {
+                if (create)
+                {
+                    FSC_COUNT(SYSCALLS, 3);
+                    for (const std::filesystem::path& directory : { path, path / "chunks", path / "snapshots" })
+                    {
+                        if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+                        {
+                            throw std::filesystem::filesystem_error{ "Failed to create store", directory, LastError() };
+                        }
+                    }
+                }
+
+                FSC_COUNT(SYSCALLS, 2);
+                chunks = fsc_path::FileDescriptor{ open((path / "chunks").c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+                snapshots = fsc_path::FileDescriptor{ open((path / "snapshots").c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+                if (!chunks.IsValid() || !snapshots.IsValid())
+                {
+                    throw std::runtime_error{ "\"" + path.string() + "\" is not a snapshot store." };
+                }
+
+                if (create)
+                {
+                    std::vector<std::string> names;
+                    names.reserve(256);
+                    fsc_batch::Batch batch;
+                    for (unsigned int prefix{ 0 }; prefix < 256; ++prefix)
+                    {
+                        constexpr char digits[]{ "0123456789abcdef" };
+                        names.push_back(std::string{ digits[prefix >> 4], digits[prefix & 0x0f] });
+                        batch.MakeDirectory(chunks.Get(), names.back().c_str(), 0755);
+                    }
+                    batch.Submit();
+                    for (std::size_t i{ 0 }; i < names.size(); ++i)
+                    {
+                        if (batch.GetResult(i) < 0 && batch.GetResult(i) != -EEXIST)
+                        {
+                            throw std::filesystem::filesystem_error{ "Failed to create store", path / "chunks" / names[i], std::error_code{ -batch.GetResult(i), std::generic_category() } };
+                        }
+                    }
+                }
+            }
+
+            // Writes the chunk unless the store already has it, returns whether it was written. Chunks appear under their
+            // final name by rename only, so a reader never sees a partial chunk.
+            bool Put(const fsc_hash::Digest& digest, const std::uint8_t* data, std::size_t size)
+            {
+                {
+                    std::lock_guard<std::mutex> lock{ mutex };
+                    if (!known.insert(digest).second)
+                    {
+                        return false;
+                    }
+                }
+
+                std::string name{ GetName(digest) };
+                FSC_COUNT(SYSCALLS, 1);
+                if (faccessat(chunks.Get(), name.c_str(), F_OK, AT_SYMLINK_NOFOLLOW) == 0)
+                {
+                    return false;
+                }
+
+                std::string temporary{ name + ".tmp." + std::to_string(getpid()) + "." + std::to_string(temporaryCounter++) };
+                FSC_COUNT(SYSCALLS, 1);
+                fsc_path::FileDescriptor file{ openat(chunks.Get(), temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444) };
+                if (!file.IsValid())
+                {
+                    throw std::filesystem::filesystem_error{ "Failed to write chunk", path / "chunks" / temporary, LastError() };
+                }
+                try
+                {
+                    fsc_io::IoScheduler::Operation operation{ fsc_io::GetIoScheduler(), size };
+                    WriteFully(file.Get(), data, size, path / "chunks" / temporary);
+                    FSC_COUNT(SYSCALLS, 2);
+                    if (close(file.Release()) != 0 || renameat(chunks.Get(), temporary.c_str(), chunks.Get(), name.c_str()) != 0)
+                    {
+                        throw std::filesystem::filesystem_error{ "Failed to write chunk", path / "chunks" / name, LastError() };
+                    }
+                }
+                catch (...)
+                {
+                    FSC_COUNT(SYSCALLS, 1);
+                    unlinkat(chunks.Get(), temporary.c_str(), 0);
+                    throw;
+                }
+                FSC_COUNT(BYTES, size);
+                return true;
+            }
+
+            // Reads and verifies a chunk, corruption in the store is reported rather than restored.
+            std::vector<std::uint8_t> Get(const ChunkReference& chunk) const
+            {
+                std::string name{ GetName(chunk.digest) };
+                FSC_COUNT(SYSCALLS, 1);
+                fsc_path::FileDescriptor file{ openat(chunks.Get(), name.c_str(), O_RDONLY | O_CLOEXEC) };
+                if (!file.IsValid())
+                {
+                    throw std::filesystem::filesystem_error{ "Missing chunk", path / "chunks" / name, LastError() };
+                }
+                std::vector<std::uint8_t> data(chunk.size);
+                ReadFully(file.Get(), data.data(), data.size(), path / "chunks" / name);
+                if (fsc_hash::Sha256::Hash(data.data(), data.size()) != chunk.digest)
+                {
+                    throw std::runtime_error{ "Chunk \"" + name + "\" in the store is corrupt." };
+                }
+                return data;
+            }
+
+            // Makes every chunk written so far durable before a manifest referencing them is published.
+            void Sync() const
+            {
+                FSC_TRACE_SCOPE("sync");
+                FSC_COUNT(SYSCALLS, 1);
+#if defined(__linux__)
+                if (syncfs(chunks.Get()) != 0)
+                {
+                    throw std::filesystem::filesystem_error{ "Failed to sync store", path, LastError() };
+                }
+#else
+                sync();
+#endif
+            }
+
+            std::vector<std::string> ListSnapshots() const
+            {
+                std::vector<std::string> ids;
+                FSC_COUNT(SYSCALLS, 1);
+                int descriptor{ openat(snapshots.Get(), ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+                DIR* stream{ descriptor >= 0 ? fdopendir(descriptor) : nullptr };
+                if (stream == nullptr)
+                {
+                    std::error_code error{ LastError() };
+                    if (descriptor >= 0)
+                    {
+                        close(descriptor);
+                    }
+                    throw std::filesystem::filesystem_error{ "Failed to read directory", path / "snapshots", error };
+                }
+                std::unique_ptr<DIR, int(*)(DIR*)> streamGuard{ stream, closedir };
+                while (dirent* entry{ readdir(stream) })
+                {
+                    std::string_view name{ entry->d_name };
+                    if (name != "." && name != ".." && name.find(".tmp") == std::string_view::npos)
+                    {
+                        ids.emplace_back(name);
+                    }
+                }
+                std::sort(ids.begin(), ids.end());
+                return ids;
+            }
+
+            int GetSnapshotsDescriptor() const noexcept
+            {
+                return snapshots.Get();
+            }
+
+            const std::filesystem::path& GetPath() const noexcept
+            {
+                return path;
+            }
+
+        private:
+
+            static std::string GetName(const fsc_hash::Digest& digest)
+            {
+                std::string hex{ fsc_hash::ToHex(digest) };
+                return hex.substr(0, 2) + "/" + hex;
+            }
+
+            std::filesystem::path path;
+            fsc_path::FileDescriptor chunks;
+            fsc_path::FileDescriptor snapshots;
+            std::mutex mutex;
+            std::unordered_set<fsc_hash::Digest, DigestHash> known;
+            std::atomic<std::uint64_t> temporaryCounter{ 0 };
+
+        };
+
+        // Little endian fixed width integers and length prefixed strings.
+        class ManifestWriter
+        {
+        public:
+
+            template<typename Integer>
+            void Put(Integer value)
+            {
+                std::uint64_t bits{ static_cast<std::uint64_t>(value) };
+                for (std::size_t i{ 0 }; i < sizeof(Integer); ++i)
+                {
+                    data.push_back(static_cast<char>((bits >> (8 * i)) & 0xff));
+                }
+            }
+
+            void PutString(std::string_view text)
+            {
+                Put(static_cast<std::uint32_t>(text.size()));
+                data.append(text);
+            }
+
+            void PutBytes(const void* bytes, std::size_t size)
+            {
+                data.append(static_cast<const char*>(bytes), size);
+            }
+
+            const std::string& GetData() const noexcept
+            {
+                return data;
+            }
+
+        private:
+
+            std::string data;
+
+        };
+
+        class ManifestReader
+        {
+        public:
+
+            ManifestReader(std::string_view manifestData, std::string manifestId) : data{ manifestData }, id{ std::move(manifestId) }
+            {
+            }
+
+            template<typename Integer>
+            Integer Get()
+            {
+                Require(sizeof(Integer));
+                std::uint64_t bits{ 0 };
+                for (std::size_t i{ 0 }; i < sizeof(Integer); ++i)
+                {
+                    bits |= std::uint64_t{ static_cast<unsigned char>(data[position + i]) } << (8 * i);
+                }
+                position += sizeof(Integer);
+                return static_cast<Integer>(bits);
+            }
+
+            std::string GetString()
+            {
+                std::uint32_t size{ Get<std::uint32_t>() };
+                Require(size);
+                std::string text{ data.substr(position, size) };
+                position += size;
+                return text;
+            }
+
+            void GetBytes(void* bytes, std::size_t size)
+            {
+                Require(size);
+                std::memcpy(bytes, data.data() + position, size);
+                position += size;
+            }
+
+            void Require(std::size_t size) const
+            {
+                if (data.size() - position < size)
+                {
+                    throw std::runtime_error{ "Snapshot \"" + id + "\" is corrupt." };
+                }
+            }
+
+        private:
+
+            std::string_view data;
+            std::string id;
+            std::size_t position{ 0 };
+
+        };
+
+        std::string EncodeManifest(const Manifest& manifest)
+        {
+            ManifestWriter writer;
+            writer.PutBytes(manifestMagic.data(), manifestMagic.size());
+            writer.PutString(manifest.source);
+            writer.Put(static_cast<std::uint64_t>(manifest.entries.size()));
+            for (const ManifestEntry& entry : manifest.entries)
+            {
+                writer.Put(static_cast<std::uint8_t>(entry.type));
+                writer.Put(entry.mode);
+                writer.Put(entry.modified);
+                writer.Put(entry.size);
+                writer.Put(entry.inode);
+                writer.PutString(entry.path);
+                if (entry.type == fsc_path::FileType::SYMLINK)
+                {
+                    writer.PutString(entry.target);
+                }
+                else if (entry.type == fsc_path::FileType::REGULAR)
+                {
+                    writer.Put(static_cast<std::uint32_t>(entry.chunks.size()));
+                    for (const ChunkReference& chunk : entry.chunks)
+                    {
+                        writer.PutBytes(chunk.digest.data(), chunk.digest.size());
+                        writer.Put(chunk.size);
+                    }
+                }
+            }
+            return writer.GetData();
+        }
+
+        Manifest ReadManifest(const ChunkStore& store, const std::string& id)
+        {
+            FSC_TRACE_SCOPE("read manifest");
+            std::ifstream file{ store.GetPath() / "snapshots" / id, std::ios::binary };
+            if (!file)
+            {
+                throw std::runtime_error{ "Snapshot \"" + id + "\" does not exist." };
+            }
+            std::ostringstream contents;
+            contents << file.rdbuf();
+            std::string data{ contents.str() };
+
+            ManifestReader reader{ data, id };
+            std::array<char, manifestMagic.size()> magic;
+            reader.GetBytes(magic.data(), magic.size());
+            if (std::string_view{ magic.data(), magic.size() } != manifestMagic)
+            {
+                throw std::runtime_error{ "\"" + id + "\" is not a snapshot." };
+            }
+
+            Manifest manifest;
+            manifest.source = reader.GetString();
+            std::uint64_t count{ reader.Get<std::uint64_t>() };
+            reader.Require(count);
+            manifest.entries.resize(static_cast<std::size_t>(count));
+            for (ManifestEntry& entry : manifest.entries)
+            {
+                entry.type = static_cast<fsc_path::FileType>(reader.Get<std::uint8_t>());
+                entry.mode = reader.Get<std::uint32_t>();
+                entry.modified = reader.Get<std::int64_t>();
+                entry.size = reader.Get<std::uint64_t>();
+                entry.inode = reader.Get<std::uint64_t>();
+                entry.path = reader.GetString();
+                if (entry.type == fsc_path::FileType::SYMLINK)
+                {
+                    entry.target = reader.GetString();
+                }
+                else if (entry.type == fsc_path::FileType::REGULAR)
+                {
+                    std::uint32_t chunkCount{ reader.Get<std::uint32_t>() };
+                    reader.Require(std::size_t{ chunkCount } * (sizeof(fsc_hash::Digest) + sizeof(std::uint32_t)));
+                    entry.chunks.resize(chunkCount);
+                    for (ChunkReference& chunk : entry.chunks)
+                    {
+                        reader.GetBytes(chunk.digest.data(), chunk.digest.size());
+                        chunk.size = reader.Get<std::uint32_t>();
+                    }
+                }
+            }
+            return manifest;
+        }
+
+        // The manifest becomes visible under its id by rename, after the chunks it references are durable.
+        void WriteManifest(const ChunkStore& store, const std::string& id, const Manifest& manifest)
+        {
+            FSC_TRACE_SCOPE("write manifest");
+            std::string data{ EncodeManifest(manifest) };
+            std::string temporary{ id + ".tmp" };
+            FSC_COUNT(SYSCALLS, 1);
+            fsc_path::FileDescriptor file{ openat(store.GetSnapshotsDescriptor(), temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) };
+            if (!file.IsValid())
+            {
+                throw std::filesystem::filesystem_error{ "Failed to write snapshot", store.GetPath() / "snapshots" / temporary, LastError() };
+            }
+            WriteFully(file.Get(), data.data(), data.size(), store.GetPath() / "snapshots" / temporary);
+            FSC_COUNT(SYSCALLS, 3);
+            if (fsync(file.Get()) != 0 || close(file.Release()) != 0 || renameat(store.GetSnapshotsDescriptor(), temporary.c_str(), store.GetSnapshotsDescriptor(), id.c_str()) != 0)
+            {
+                throw std::filesystem::filesystem_error{ "Failed to write snapshot", store.GetPath() / "snapshots" / id, LastError() };
+            }
+        }
+
+        // UTC time to the second, ids sort in the order the snapshots were taken.
+        std::string NewSnapshotId(const ChunkStore& store)
+        {
+            std::time_t now{ std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) };
+            std::tm time{};
+            gmtime_r(&now, &time);
+            char text[32];
+            std::strftime(text, sizeof(text), "%Y%m%dT%H%M%SZ", &time);
+
+            std::string id{ text };
+            for (int attempt{ 1 }; faccessat(store.GetSnapshotsDescriptor(), id.c_str(), F_OK, AT_SYMLINK_NOFOLLOW) == 0; ++attempt)
+            {
+                id = std::string{ text } + "-" + (attempt < 10 ? "0" : "") + std::to_string(attempt);
+            }
+            return id;
+        }
+
+        struct ChunkCounters
+        {
+            std::atomic<std::uint64_t> chunks{ 0 };
+            std::atomic<std::uint64_t> newChunks{ 0 };
+            std::atomic<std::uint64_t> newBytes{ 0 };
+        };
+
+        // Streams the file through a window of two maximum sized chunks, the next cut is always searched with a full
+        // maximum chunk ahead unless the file ends first.
+        std::vector<ChunkReference> ChunkFile(ChunkStore& store, int descriptor, const std::filesystem::path& path, ChunkCounters& counters)
+        {
+            FSC_TRACE_SCOPE("chunk");
+            thread_local std::vector<std::uint8_t> buffer(maxChunkSize * 2);
+            std::vector<ChunkReference> chunks;
+            std::size_t start{ 0 };
+            std::size_t end{ 0 };
+            bool finished{ false };
+            while (true)
+            {
+                if (!finished && end - start < maxChunkSize)
+                {
+                    std::memmove(buffer.data(), buffer.data() + start, end - start);
+                    end -= start;
+                    start = 0;
+                    while (end < buffer.size())
+                    {
+                        ssize_t result{ read(descriptor, buffer.data() + end, buffer.size() - end) };
+                        FSC_COUNT(SYSCALLS, 1);
+                        if (result < 0 && errno == EINTR)
+                        {
+                            continue;
+                        }
+                        if (result < 0)
+                        {
+                            FSC_COUNT(ERRORS, 1);
+                            throw std::filesystem::filesystem_error{ "Failed to read file", path, LastError() };
+                        }
+                        if (result == 0)
+                        {
+                            finished = true;
+                            break;
+                        }
+                        end += static_cast<std::size_t>(result);
+                    }
+                }
+                if (start == end)
+                {
+                    break;
+                }
+
+                std::size_t size{ FindCut(buffer.data() + start, end - start) };
+                ChunkReference chunk{ fsc_hash::Sha256::Hash(buffer.data() + start, size), static_cast<std::uint32_t>(size) };
+                if (store.Put(chunk.digest, buffer.data() + start, size))
+                {
+                    ++counters.newChunks;
+                    counters.newBytes += size;
+                }
+                ++counters.chunks;
+                chunks.push_back(chunk);
+                start += size;
+            }
+            return chunks;
+        }
+
+        // Reads only the magic and the source that lead every manifest, not its entries.
+        bool IsSnapshotOf(const ChunkStore& store, const std::string& id, const std::string& source)
+        {
+            std::ifstream file{ store.GetPath() / "snapshots" / id, std::ios::binary };
+            if (!file)
+            {
+                throw std::runtime_error{ "Snapshot \"" + id + "\" does not exist." };
+            }
+            std::string header(manifestMagic.size() + sizeof(std::uint32_t), '\0');
+            file.read(header.data(), static_cast<std::streamsize>(header.size()));
+            header.resize(static_cast<std::size_t>(file.gcount()));
+
+            ManifestReader reader{ header, id };
+            std::array<char, manifestMagic.size()> magic;
+            reader.GetBytes(magic.data(), magic.size());
+            if (std::string_view{ magic.data(), magic.size() } != manifestMagic)
+            {
+                throw std::runtime_error{ "\"" + id + "\" is not a snapshot." };
+            }
+            if (reader.Get<std::uint32_t>() != source.size())
+            {
+                return false;
+            }
+
+            std::string recorded(source.size(), '\0');
+            file.read(recorded.data(), static_cast<std::streamsize>(recorded.size()));
+            if (static_cast<std::size_t>(file.gcount()) != recorded.size())
+            {
+                throw std::runtime_error{ "Snapshot \"" + id + "\" is corrupt." };
+            }
+            return recorded == source;
+        }
+
+        // Snapshots of other sources are told apart by their header alone, and one that cannot be read only costs the
+        // unchanged files their shortcut, so it is skipped rather than failing the snapshot.
+        std::optional<Manifest> FindPrevious(const ChunkStore& store, const std::string& source)
+        {
+            std::vector<std::string> ids{ store.ListSnapshots() };
+            for (auto id{ ids.rbegin() }; id != ids.rend(); ++id)
+            {
+                try
+                {
+                    if (IsSnapshotOf(store, *id, source))
+                    {
+                        return ReadManifest(store, *id);
+                    }
+                }
+                catch (const std::exception& error)
+                {
+                    std::cerr << "Skipping unreadable snapshot \"" + *id + "\": " + error.what() << std::endl;
+                }
+            }
+            return std::nullopt;
+        }
+
+        // Manifests come from the store, still nothing is restored outside of the destination.
+        std::vector<std::string> SplitRelativePath(const std::string& path, const std::string& id)
+        {
+            std::vector<std::string> components;
+            for (const std::filesystem::path& component : std::filesystem::path{ path })
+            {
+                if (component == ".." || component == "." || component.has_root_path())
+                {
+                    throw std::runtime_error{ "Snapshot \"" + id + "\" has an invalid path \"" + path + "\"." };
+                }
+                components.push_back(component.string());
+            }
+            return components;
+        }
+
+        // Handles of the directories along the path of the current entry. Each component is opened with O_NOFOLLOW relative
+        // to the one before, so a symlink in the destination fails the restore instead of redirecting it.
+        class DirectoryWalk
+        {
+        public:
+
+            DirectoryWalk(int rootDirectory, const std::filesystem::path& rootPath) : root{ rootDirectory }, path{ rootPath } {}
+
+            // The directory holding the last component, missing directories above it are created when create is set.
+            int OpenParent(const std::vector<std::string>& components, bool create)
+            {
+                std::size_t depth{ components.size() - 1 };
+                std::size_t common{ 0 };
+                while (common < directories.size() && common < depth && directories[common].first == components[common])
+                {
+                    ++common;
+                }
+                directories.resize(common);
+
+                for (std::size_t i{ common }; i < depth; ++i)
+                {
+                    int parent{ i == 0 ? root : directories[i - 1].second.Get() };
+                    const char* name{ components[i].c_str() };
+                    FSC_COUNT(SYSCALLS, 1);
+                    fsc_path::FileDescriptor directory{ openat(parent, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) };
+                    if (!directory.IsValid() && errno == ENOENT && create)
+                    {
+                        FSC_COUNT(SYSCALLS, 2);
+                        if (mkdirat(parent, name, 0700) != 0 && errno != EEXIST)
+                        {
+                            throw std::filesystem::filesystem_error{ "Failed to create directory", GetPath(components, i + 1), LastError() };
+                        }
+                        directory = fsc_path::FileDescriptor{ openat(parent, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) };
+                    }
+                    if (!directory.IsValid())
+                    {
+                        throw std::filesystem::filesystem_error{ "Failed to open directory", GetPath(components, i + 1), LastError() };
+                    }
+                    directories.emplace_back(components[i], std::move(directory));
+                }
+                return depth == 0 ? root : directories[depth - 1].second.Get();
+            }
+
+            std::filesystem::path GetPath(const std::vector<std::string>& components, std::size_t count) const
+            {
+                std::filesystem::path result{ path };
+                for (std::size_t i{ 0 }; i < count; ++i)
+                {
+                    result /= components[i];
+                }
+                return result;
+            }
+
+        private:
+
+            int root;
+            std::filesystem::path path;
+            std::vector<std::pair<std::string, fsc_path::FileDescriptor>> directories;
+
+        };
+    }
+
+    SnapshotResult Snapshot(const fsc_path::ResolvedPath& source, const std::filesystem::path& storePath)
+    {
+        FSC_TRACE_SCOPE("snapshot");
+        ChunkStore store{ storePath, true };
+        std::string sourcePath{ source.GetPath().string() };
+        std::optional<Manifest> previous{ FindPrevious(store, sourcePath) };
+        std::unordered_map<std::string_view, const ManifestEntry*> previousFiles;
+        if (previous)
+        {
+            for (const ManifestEntry& entry : previous->entries)
+            {
+                if (entry.type == fsc_path::FileType::REGULAR)
+                {
+                    previousFiles.emplace(entry.path, &entry);
+                }
+            }
+        }
+
+        fsc_tree::BuildOptions options;
+        options.sortByName = true;
+        fsc_tree::TreeModel tree{ fsc_tree::TreeModel::Build(source, options) };
+
+        // A store inside the source is left out of its own snapshots.
+        std::error_code error;
+        std::filesystem::path storeRelative{ std::filesystem::weakly_canonical(storePath, error).lexically_relative(source.GetPath()) };
+        bool storeInside{ !error && !storeRelative.empty() && *storeRelative.begin() != ".." && storeRelative != "." };
+
+        SnapshotResult result;
+        Manifest manifest;
+        manifest.source = sourcePath;
+        manifest.entries.reserve(tree.GetSize());
+        std::vector<bool> skipped(tree.GetSize(), false);
+        std::deque<std::pair<std::size_t, std::future<std::vector<ChunkReference>>>> pending;
+        ChunkCounters counters;
+        {
+            fsc_threads::ThreadPool pool;
+            auto WaitFront = [&]()
+            {
+                manifest.entries[pending.front().first].chunks = pending.front().second.get();
+                pending.pop_front();
+            };
+
+            try
+            {
+                for (fsc_tree::EntryIndex index{ 0 }; index < tree.GetSize(); ++index)
+                {
+                    fsc_tree::EntryIndex parent{ tree.GetParent(index) };
+                    std::string relativePath{ tree.GetRelativePath(index) };
+                    skipped[index] = (parent != fsc_tree::noEntry && skipped[parent]) || (storeInside && relativePath == storeRelative.string());
+                    if (skipped[index])
+                    {
+                        continue;
+                    }
+
+                    ManifestEntry& entry{ manifest.entries.emplace_back() };
+                    entry.path = std::move(relativePath);
+                    entry.type = tree.GetType(index);
+                    entry.mode = tree.GetMode(index);
+                    entry.modified = tree.GetModified(index);
+                    entry.size = tree.GetFileSize(index);
+                    entry.inode = tree.GetInode(index);
+                    ++result.entries;
+
+                    // The root is opened through its parent, everything else relative to the root.
+                    int directory{ index == tree.GetRoot() ? source.GetParentDescriptor() : source.GetDescriptor() };
+                    std::string name{ index == tree.GetRoot() ? source.GetName() : entry.path };
+                    if (entry.type == fsc_path::FileType::SYMLINK)
+                    {
+                        std::array<char, PATH_MAX> target;
+                        FSC_COUNT(SYSCALLS, 1);
+                        ssize_t length{ readlinkat(directory, name.c_str(), target.data(), target.size()) };
+                        if (length < 0)
+                        {
+                            throw std::filesystem::filesystem_error{ "Failed to read link", tree.GetPath(index), LastError() };
+                        }
+                        entry.target.assign(target.data(), static_cast<std::size_t>(length));
+                    }
+                    if (entry.type != fsc_path::FileType::REGULAR)
+                    {
+                        continue;
+                    }
+
+                    ++result.files;
+                    auto unchanged{ previousFiles.find(entry.path) };
+                    if (unchanged != previousFiles.end() && unchanged->second->size == entry.size && unchanged->second->modified == entry.modified && unchanged->second->inode == entry.inode)
+                    {
+                        entry.chunks = unchanged->second->chunks;
+                        counters.chunks += entry.chunks.size();
+                        ++result.unchangedFiles;
+                        continue;
+                    }
+
+                    // Opened by the task itself, so only the files being chunked hold a descriptor, not the whole window.
+                    pending.emplace_back(manifest.entries.size() - 1, pool.Submit([&store, &counters, directory, name = std::move(name), path = tree.GetPath(index)]()
+                    {
+                        FSC_COUNT(SYSCALLS, 1);
+                        fsc_path::FileDescriptor file{ openat(directory, name.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC) };
+                        if (!file.IsValid())
+                        {
+                            throw std::filesystem::filesystem_error{ "Failed to open file", path, LastError() };
+                        }
+                        return ChunkFile(store, file.Get(), path, counters);
+                    }));
+                    FSC_QUEUE_DEPTH(pending.size());
+                    while (pending.size() > maxPendingFiles)
+                    {
+                        WaitFront();
+                    }
+                }
+                while (!pending.empty())
+                {
+                    WaitFront();
+                }
+            }
+            catch (...)
+            {
+                for (auto& task : pending)
+                {
+                    task.second.wait();
+                }
+                throw;
+            }
+        }
+
+        for (ManifestEntry& entry : manifest.entries)
+        {
+            if (entry.type == fsc_path::FileType::REGULAR)
+            {
+                entry.size = 0;
+                for (const ChunkReference& chunk : entry.chunks)
+                {
+                    entry.size += chunk.size;
+                }
+            }
+        }
+
+        result.chunks = counters.chunks;
+        result.newChunks = counters.newChunks;
+        result.newBytes = counters.newBytes;
+        store.Sync();
+        result.id = NewSnapshotId(store);
+        WriteManifest(store, result.id, manifest);
+        return result;
+    }
+
+    RestoreResult Restore(const std::filesystem::path& storePath, std::string_view id, const fsc_path::ResolvedPath& destination, const RestoreOptions& options)
+    {
+        FSC_TRACE_SCOPE("restore");
+        ChunkStore store{ storePath, false };
+        RestoreResult result;
+        result.id = std::string{ id };
+        if (result.id.empty())
+        {
+            std::vector<std::string> ids{ store.ListSnapshots() };
+            if (ids.empty())
+            {
+                throw std::runtime_error{ "Store has no snapshots." };
+            }
+            result.id = ids.back();
+        }
+        if (result.id.find('/') != std::string::npos)
+        {
+            throw std::runtime_error{ "Snapshot \"" + result.id + "\" does not exist." };
+        }
+        Manifest manifest{ ReadManifest(store, result.id) };
+
+        std::string rootName{ std::filesystem::path{ manifest.source }.filename().string() };
+        if (rootName.empty() || rootName == "..")
+        {
+            rootName = "root";
+        }
+        FSC_COUNT(SYSCALLS, 1);
+        if (faccessat(destination.GetDescriptor(), rootName.c_str(), F_OK, AT_SYMLINK_NOFOLLOW) == 0 && !options.overwrite)
+        {
+            throw std::runtime_error{ "Destination already has item \"" + rootName + "\", use flag \"-o\" to overwrite." };
+        }
+
+        struct Fixup
+        {
+            std::vector<std::string> components;
+            std::uint32_t mode;
+            std::int64_t modified;
+        };
+        std::vector<Fixup> fixups;
+        std::deque<std::future<void>> pending;
+        // Every queued write holds its file open, the directory walk and the store need some room too.
+        std::size_t maxPendingWrites{ std::min(maxPendingFiles, fsc_path::GetDescriptorBudget()) };
+        DirectoryWalk walk{ destination.GetDescriptor(), destination.GetPath() };
+        {
+            fsc_threads::ThreadPool pool;
+            try
+            {
+                for (const ManifestEntry& entry : manifest.entries)
+                {
+                    std::vector<std::string> components{ SplitRelativePath(entry.path, result.id) };
+                    components.insert(components.begin(), rootName);
+                    int parent{ walk.OpenParent(components, true) };
+                    const char* name{ components.back().c_str() };
+                    std::filesystem::path path{ walk.GetPath(components, components.size()) };
+                    timespec times[2]{ { 0, UTIME_OMIT }, { static_cast<time_t>(entry.modified / 1000000000), static_cast<long>(entry.modified % 1000000000) } };
+                    ++result.entries;
+                    switch (entry.type)
+                    {
+                    case fsc_path::FileType::DIRECTORY:
+                        FSC_COUNT(SYSCALLS, 1);
+                        if (mkdirat(parent, name, 0700) != 0 && errno != EEXIST)
+                        {
+                            throw std::filesystem::filesystem_error{ "Failed to create directory", path, LastError() };
+                        }
+                        fixups.push_back(Fixup{ std::move(components), entry.mode & 07777, entry.modified });
+                        break;
+                    case fsc_path::FileType::SYMLINK:
+                        FSC_COUNT(SYSCALLS, 2);
+                        if (options.overwrite)
+                        {
+                            unlinkat(parent, name, 0);
+                        }
+                        if (symlinkat(entry.target.c_str(), parent, name) != 0)
+                        {
+                            throw std::filesystem::filesystem_error{ "Failed to create link", path, LastError() };
+                        }
+                        FSC_COUNT(SYSCALLS, 1);
+                        utimensat(parent, name, times, AT_SYMLINK_NOFOLLOW);
+                        break;
+                    case fsc_path::FileType::REGULAR:
+                    {
+                        FSC_COUNT(SYSCALLS, 1);
+                        auto file{ std::make_shared<fsc_path::FileDescriptor>(openat(parent, name, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600)) };
+                        if (!file->IsValid())
+                        {
+                            throw std::filesystem::filesystem_error{ "Failed to create file", path, LastError() };
+                        }
+                        result.bytes += entry.size;
+                        pending.push_back(pool.Submit([&store, &entry, file, filePath = path, times]()
+                        {
+                            FSC_TRACE_SCOPE("write");
+                            for (const ChunkReference& chunk : entry.chunks)
+                            {
+                                std::vector<std::uint8_t> data{ store.Get(chunk) };
+                                fsc_io::IoScheduler::Operation operation{ fsc_io::GetIoScheduler(), data.size() };
+                                WriteFully(file->Get(), data.data(), data.size(), filePath);
+                                FSC_COUNT(BYTES, data.size());
+                            }
+                            FSC_COUNT(SYSCALLS, 2);
+                            fchmod(file->Get(), entry.mode & 07777);
+                            futimens(file->Get(), times);
+                        }));
+                        FSC_QUEUE_DEPTH(pending.size());
+                        while (pending.size() > maxPendingWrites)
+                        {
+                            pending.front().get();
+                            pending.pop_front();
+                        }
+                        break;
+                    }
+                    default:
+                        --result.entries;
+                        break;
+                    }
+                }
+                while (!pending.empty())
+                {
+                    pending.front().get();
+                    pending.pop_front();
+                }
+            }
+            catch (...)
+            {
+                for (std::future<void>& task : pending)
+                {
+                    task.wait();
+                }
+                throw;
+            }
+        }
+
+        // Directories get their mode and time after their contents are written, deepest first, through handles of their own.
+        for (auto fixup{ fixups.rbegin() }; fixup != fixups.rend(); ++fixup)
+        {
+            timespec times[2]{ { 0, UTIME_OMIT }, { static_cast<time_t>(fixup->modified / 1000000000), static_cast<long>(fixup->modified % 1000000000) } };
+            int parent{ walk.OpenParent(fixup->components, false) };
+            FSC_COUNT(SYSCALLS, 3);
+            fsc_path::FileDescriptor directory{ openat(parent, fixup->components.back().c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) };
+            if (!directory.IsValid())
+            {
+                throw std::filesystem::filesystem_error{ "Failed to open directory", walk.GetPath(fixup->components, fixup->components.size()), LastError() };
+            }
+            fchmod(directory.Get(), fixup->mode);
+            futimens(directory.Get(), times);
+        }
+        return result;
+    }
+#else
+    SnapshotResult Snapshot(const fsc_path::ResolvedPath&, const std::filesystem::path&)
+    {
+        throw std::runtime_error{ "Command \"snapshot\" is not supported on this platform." };
+    }
+
+    RestoreResult Restore(const std::filesystem::path&, std::string_view, const fsc_path::ResolvedPath&, const RestoreOptions&)
+    {
+        throw std::runtime_error{ "Command \"restore\" is not supported on this platform." };
+    }
+#endif
+}
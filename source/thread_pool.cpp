@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <utility>
+
+#include "thread_pool.hpp"
+#include "instrumentation.hpp"
+
+namespace fsc_threads
+{
+    ThreadPool::ThreadPool(std::size_t threadCount)
+    {
+        threadCount = std::max<std::size_t>(threadCount, 1);
+        workers.reserve(threadCount);
+        for (std::size_t i{ 0 }; i < threadCount; ++i)
+        {
+            workers.emplace_back([this]() { Work(); });
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock{ mutex };
+            stopping = true;
+        }
+        available.notify_all();
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    void ThreadPool::Post(std::function<void()> task)
+    {
+        std::size_t depth;
+        {
+            std::lock_guard<std::mutex> lock{ mutex };
+            tasks.push_back(std::move(task));
+            depth = tasks.size();
+        }
+        FSC_QUEUE_DEPTH(depth);
+        available.notify_one();
+    }
+
+    std::size_t ThreadPool::GetThreadCount() const noexcept
+    {
+        return workers.size();
+    }
+
+    std::size_t ThreadPool::GetDefaultThreadCount() noexcept
+    {
+        return std::clamp<std::size_t>(std::thread::hardware_concurrency() * 2, 4, 64);
+    }
+
+    // Remaining tasks are still run when the pool is destroyed so no future is left without a result.
+    void ThreadPool::Work()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock{ mutex };
+                available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    ThreadPool& GetSharedPool()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+}
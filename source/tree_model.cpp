@@ -0,0 +1,479 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <filesystem>
+#include <system_error>
+#include <stdexcept>
+#include <cerrno>
+#include <memory>
+#include <optional>
+
+#include "tree_model.hpp"
+#include "instrumentation.hpp"
+#include "io_batch.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace fsc_tree
+{
+    namespace
+    {
+        std::uint64_t HashName(std::string_view name) noexcept
+        {
+            std::uint64_t hash{ 14695981039346656037ull };
+            for (char character : name)
+            {
+                hash = (hash ^ static_cast<unsigned char>(character)) * 1099511628211ull;
+            }
+            return hash;
+        }
+    }
+
+    // Each name is stored as a two byte length, the bytes and a terminating zero so it can be passed to *at() calls directly.
+    NameId NameArena::Append(std::string_view name)
+    {
+        if (name.size() > std::numeric_limits<std::uint16_t>::max())
+        {
+            throw std::length_error{ "Name is too long." };
+        }
+        std::size_t required{ sizeof(std::uint16_t) + name.size() + 1 };
+        if (blockUsed + required > blockSize)
+        {
+            blocks.push_back(std::make_unique<char[]>(blockSize));
+            blockUsed = 0;
+        }
+
+        char* destination{ blocks.back().get() + blockUsed };
+        std::uint16_t length{ static_cast<std::uint16_t>(name.size()) };
+        std::memcpy(destination, &length, sizeof(length));
+        std::memcpy(destination + sizeof(length), name.data(), name.size());
+        destination[sizeof(length) + name.size()] = '\0';
+
+        NameId id{ (blocks.size() - 1) * blockSize + blockUsed };
+        blockUsed += required;
+        return id;
+    }
+
+    void NameArena::Grow()
+    {
+        std::vector<NameId> previous{ std::move(slots) };
+        slots.assign(previous.empty() ? 1024 : previous.size() * 2, 0);
+        std::size_t mask{ slots.size() - 1 };
+        for (NameId slot : previous)
+        {
+            if (slot != 0)
+            {
+                std::size_t position{ HashName(Get(slot - 1)) & mask };
+                while (slots[position] != 0)
+                {
+                    position = (position + 1) & mask;
+                }
+                slots[position] = slot;
+            }
+        }
+    }
+
+    NameId NameArena::Intern(std::string_view name)
+    {
+        if ((count + 1) * 2 > slots.size())
+        {
+            Grow();
+        }
+
+        std::size_t mask{ slots.size() - 1 };
+        std::size_t position{ HashName(name) & mask };
+        while (slots[position] != 0)
+        {
+            if (Get(slots[position] - 1) == name)
+            {
+                return slots[position] - 1;
+            }
+            position = (position + 1) & mask;
+        }
+
+        NameId id{ Append(name) };
+        slots[position] = id + 1;
+        ++count;
+        return id;
+    }
+
+    std::string_view NameArena::Get(NameId id) const noexcept
+    {
+        const char* source{ blocks[id / blockSize].get() + id % blockSize };
+        std::uint16_t length;
+        std::memcpy(&length, source, sizeof(length));
+        return std::string_view{ source + sizeof(length), length };
+    }
+
+    std::size_t NameArena::GetMemoryUsage() const noexcept
+    {
+        return blocks.size() * blockSize + slots.capacity() * sizeof(NameId);
+    }
+
+    EntryIndex TreeModel::Add(EntryIndex parent, NameId name, const fsc_path::Metadata& metadata)
+    {
+        if (parents.size() >= noEntry)
+        {
+            throw std::length_error{ "Tree has too many entries." };
+        }
+
+        EntryIndex index{ static_cast<EntryIndex>(parents.size()) };
+        parents.push_back(parent);
+        names.push_back(name);
+        types.push_back(metadata.type);
+        sizes.push_back(metadata.size);
+        modified.push_back(metadata.modifiedSeconds * 1000000000 + metadata.modifiedNanoseconds);
+        inodes.push_back(metadata.inode);
+        modes.push_back(metadata.mode);
+        firstChildren.push_back(noEntry);
+        childCounts.push_back(0);
+        return index;
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    namespace
+    {
+        fsc_path::FileType ToFileType(unsigned char type) noexcept
+        {
+            switch (type)
+            {
+            case DT_REG: return fsc_path::FileType::REGULAR;
+            case DT_DIR: return fsc_path::FileType::DIRECTORY;
+            case DT_LNK: return fsc_path::FileType::SYMLINK;
+            case DT_UNKNOWN: return fsc_path::FileType::NONE;
+            default: return fsc_path::FileType::OTHER;
+            }
+        }
+
+        struct PendingEntry
+        {
+            NameId name;
+            fsc_path::FileType type;
+            std::uint64_t inode;
+        };
+    }
+
+    void TreeModel::BuildDirectory(int directory, EntryIndex index, const BuildOptions& options, const fsc_exclude::Scope& scope)
+    {
+        std::vector<PendingEntry> pending;
+        FSC_COUNT(SYSCALLS, 1);
+        DIR* stream{ fdopendir(directory) };
+        if (stream == nullptr)
+        {
+            std::error_code error{ errno, std::generic_category() };
+            close(directory);
+            throw std::filesystem::filesystem_error{ "Failed to read directory", GetPath(index), error };
+        }
+        std::unique_ptr<DIR, int(*)(DIR*)> streamGuard{ stream, closedir };
+
+        errno = 0;
+        while (dirent* entry{ readdir(stream) })
+        {
+            std::string_view name{ entry->d_name };
+            if (name == "." || name == "..")
+            {
+                continue;
+            }
+            fsc_path::FileType type{ ToFileType(entry->d_type) };
+            if (!scope.IsEmpty())
+            {
+                if (type == fsc_path::FileType::NONE)
+                {
+                    if (std::optional<fsc_path::Metadata> stat{ fsc_path::StatAt(dirfd(stream), entry->d_name, false) })
+                    {
+                        type = stat->type;
+                    }
+                }
+                if (scope.IsExcluded(name, type == fsc_path::FileType::DIRECTORY))
+                {
+                    errno = 0;
+                    continue;
+                }
+            }
+            pending.push_back(PendingEntry{ arena.Intern(name), type, entry->d_ino });
+        }
+        if (errno != 0)
+        {
+            std::error_code error{ errno, std::generic_category() };
+            throw std::filesystem::filesystem_error{ "Failed to read directory", GetPath(index), error };
+        }
+        FSC_COUNT(ENTRIES, pending.size());
+
+        if (options.sortByName)
+        {
+            std::sort(pending.begin(), pending.end(), [this](const PendingEntry& left, const PendingEntry& right)
+            {
+                return arena.Get(left.name) < arena.Get(right.name);
+            });
+        }
+
+        // Reserve the contiguous child range before descending, grandchildren are appended after it.
+        int descriptor{ dirfd(stream) };
+        firstChildren[index] = static_cast<EntryIndex>(parents.size());
+        childCounts[index] = static_cast<std::uint32_t>(pending.size());
+#if defined(__linux__)
+        // The stats of a directory's entries are submitted as one batch.
+        std::vector<struct statx> information;
+        fsc_batch::Batch batch;
+        if (options.metadata)
+        {
+            information.resize(pending.size());
+            for (std::size_t i{ 0 }; i < pending.size(); ++i)
+            {
+                batch.Stat(descriptor, arena.Get(pending[i].name).data(), AT_SYMLINK_NOFOLLOW, &information[i]);
+            }
+            batch.Submit();
+        }
+#endif
+        for (std::size_t i{ 0 }; i < pending.size(); ++i)
+        {
+            const PendingEntry& entry{ pending[i] };
+            fsc_path::Metadata metadata;
+            metadata.type = entry.type;
+            metadata.inode = entry.inode;
+#if defined(__linux__)
+            if (options.metadata)
+            {
+                if (batch.GetResult(i) == 0)
+                {
+                    metadata = fsc_path::ToMetadata(information[i]);
+                }
+                else if (batch.GetResult(i) != -ENOENT)
+                {
+                    throw std::filesystem::filesystem_error{ "Failed to stat", arena.Get(entry.name).data(), std::error_code{ -batch.GetResult(i), std::generic_category() } };
+                }
+            }
+            else
+#endif
+            if (options.metadata || entry.type == fsc_path::FileType::NONE)
+            {
+                if (std::optional<fsc_path::Metadata> stat{ fsc_path::StatAt(descriptor, arena.Get(entry.name).data(), false) })
+                {
+                    metadata = *stat;
+                }
+            }
+            Add(index, entry.name, metadata);
+        }
+
+        if (options.recursive)
+        {
+            EntryIndex first{ firstChildren[index] };
+            for (EntryIndex child{ first }; child < first + childCounts[index]; ++child)
+            {
+                if (types[child] == fsc_path::FileType::DIRECTORY)
+                {
+                    FSC_COUNT(SYSCALLS, 1);
+                    int childDirectory{ openat(descriptor, arena.Get(names[child]).data(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) };
+                    if (childDirectory < 0)
+                    {
+                        std::error_code error{ errno, std::generic_category() };
+                        throw std::filesystem::filesystem_error{ "Failed to open directory", GetPath(child), error };
+                    }
+                    BuildDirectory(childDirectory, child, options, scope.Enter(descriptor, arena.Get(names[child])));
+                }
+            }
+        }
+    }
+
+    TreeModel TreeModel::Build(const fsc_path::ResolvedPath& root, const BuildOptions& options)
+    {
+        FSC_TRACE_SCOPE("build tree");
+        TreeModel model;
+        model.rootPath = root.GetPath();
+        EntryIndex index{ model.Add(noEntry, model.arena.Intern(root.GetName()), root.GetMetadata()) };
+        if (root.IsDirectory())
+        {
+            FSC_COUNT(SYSCALLS, 1);
+            int directory{ openat(root.GetDescriptor(), ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+            if (directory < 0)
+            {
+                throw std::filesystem::filesystem_error{ "Failed to open directory", root.GetPath(), std::error_code{ errno, std::generic_category() } };
+            }
+            model.BuildDirectory(directory, index, options, fsc_exclude::Open(root));
+        }
+        return model;
+    }
+#else
+    void TreeModel::BuildDirectory(int, EntryIndex index, const BuildOptions& options, const fsc_exclude::Scope& scope)
+    {
+        struct PendingEntry
+        {
+            std::string name;
+            fsc_path::FileType type;
+            std::uint64_t size;
+        };
+
+        std::vector<PendingEntry> pending;
+        for (const auto& entry : std::filesystem::directory_iterator(GetPath(index)))
+        {
+            fsc_path::FileType type{ entry.is_symlink() ? fsc_path::FileType::SYMLINK : entry.is_directory() ? fsc_path::FileType::DIRECTORY : entry.is_regular_file() ? fsc_path::FileType::REGULAR : fsc_path::FileType::OTHER };
+            if (scope.IsExcluded(entry.path().filename().string(), type == fsc_path::FileType::DIRECTORY))
+            {
+                continue;
+            }
+            std::error_code error;
+            std::uint64_t size{ type == fsc_path::FileType::REGULAR && options.metadata ? entry.file_size(error) : 0 };
+            pending.push_back(PendingEntry{ entry.path().filename().string(), type, size });
+        }
+        FSC_COUNT(ENTRIES, pending.size());
+
+        if (options.sortByName)
+        {
+            std::sort(pending.begin(), pending.end(), [](const PendingEntry& left, const PendingEntry& right)
+            {
+                return left.name < right.name;
+            });
+        }
+
+        firstChildren[index] = static_cast<EntryIndex>(parents.size());
+        childCounts[index] = static_cast<std::uint32_t>(pending.size());
+        for (const PendingEntry& entry : pending)
+        {
+            fsc_path::Metadata metadata;
+            metadata.type = entry.type;
+            metadata.size = entry.size;
+            Add(index, arena.Intern(entry.name), metadata);
+        }
+
+        if (options.recursive)
+        {
+            EntryIndex first{ firstChildren[index] };
+            for (EntryIndex child{ first }; child < first + childCounts[index]; ++child)
+            {
+                if (types[child] == fsc_path::FileType::DIRECTORY)
+                {
+                    BuildDirectory(-1, child, options, scope.Enter(GetPath(child)));
+                }
+            }
+        }
+    }
+
+    TreeModel TreeModel::Build(const fsc_path::ResolvedPath& root, const BuildOptions& options)
+    {
+        FSC_TRACE_SCOPE("build tree");
+        TreeModel model;
+        model.rootPath = root.GetPath();
+        EntryIndex index{ model.Add(noEntry, model.arena.Intern(root.GetName()), root.GetMetadata()) };
+        if (root.IsDirectory())
+        {
+            model.BuildDirectory(-1, index, options, fsc_exclude::Open(root));
+        }
+        return model;
+    }
+#endif
+
+    std::size_t TreeModel::GetSize() const noexcept
+    {
+        return parents.size();
+    }
+
+    EntryIndex TreeModel::GetRoot() const noexcept
+    {
+        return 0;
+    }
+
+    EntryIndex TreeModel::GetParent(EntryIndex index) const noexcept
+    {
+        return parents[index];
+    }
+
+    std::string_view TreeModel::GetName(EntryIndex index) const noexcept
+    {
+        return arena.Get(names[index]);
+    }
+
+    fsc_path::FileType TreeModel::GetType(EntryIndex index) const noexcept
+    {
+        return types[index];
+    }
+
+    std::uint64_t TreeModel::GetFileSize(EntryIndex index) const noexcept
+    {
+        return sizes[index];
+    }
+
+    std::int64_t TreeModel::GetModified(EntryIndex index) const noexcept
+    {
+        return modified[index];
+    }
+
+    std::uint64_t TreeModel::GetInode(EntryIndex index) const noexcept
+    {
+        return inodes[index];
+    }
+
+    std::uint32_t TreeModel::GetMode(EntryIndex index) const noexcept
+    {
+        return modes[index];
+    }
+
+    EntryIndex TreeModel::GetFirstChild(EntryIndex index) const noexcept
+    {
+        return firstChildren[index];
+    }
+
+    std::uint32_t TreeModel::GetChildCount(EntryIndex index) const noexcept
+    {
+        return childCounts[index];
+    }
+
+    std::string TreeModel::GetRelativePath(EntryIndex index) const
+    {
+        std::size_t length{ 0 };
+        std::size_t depth{ 0 };
+        for (EntryIndex current{ index }; current != GetRoot(); current = parents[current])
+        {
+            length += GetName(current).size() + 1;
+            ++depth;
+        }
+        if (depth == 0)
+        {
+            return std::string{};
+        }
+
+        // Filled from the back so the parent chain is only walked twice and the string is allocated once.
+        std::string relativePath(length - 1, std::filesystem::path::preferred_separator);
+        std::size_t position{ relativePath.size() };
+        for (EntryIndex current{ index }; current != GetRoot(); current = parents[current])
+        {
+            std::string_view name{ GetName(current) };
+            position -= name.size();
+            relativePath.replace(position, name.size(), name);
+            if (position > 0)
+            {
+                --position;
+            }
+        }
+        return relativePath;
+    }
+
+    std::filesystem::path TreeModel::GetPath(EntryIndex index) const
+    {
+        if (index == GetRoot())
+        {
+            return rootPath;
+        }
+        return rootPath / GetRelativePath(index);
+    }
+
+    std::size_t TreeModel::GetMemoryUsage() const noexcept
+    {
+        return arena.GetMemoryUsage()
+            + parents.capacity() * sizeof(EntryIndex)
+            + names.capacity() * sizeof(NameId)
+            + types.capacity() * sizeof(fsc_path::FileType)
+            + sizes.capacity() * sizeof(std::uint64_t)
+            + modified.capacity() * sizeof(std::int64_t)
+            + inodes.capacity() * sizeof(std::uint64_t)
+            + modes.capacity() * sizeof(std::uint32_t)
+            + firstChildren.capacity() * sizeof(EntryIndex)
+            + childCounts.capacity() * sizeof(std::uint32_t);
+    }
+}
@@ -3,20 +3,29 @@
 #include <algorithm>
 #include <filesystem>
 #include <stdexcept>
-#include <sstream>
 #include <fstream>
+#include <array>
+#include <optional>
 
 #include "argument_parser.hpp"
+#include "instrumentation.hpp"
+#include "path_layer.hpp"
 
 namespace fsc_utilities
 {
     bool PromptConfirmation(const std::string& prompt)
     {
+        FSC_TRACE_SCOPE("prompt");
         std::string input;
         while (true)
         {
             std::cout << prompt << " (y/n): ";
-            std::getline(std::cin, input);
+            // A closed input answers no, otherwise the prompt would repeat forever, also inside a server.
+            if (!std::getline(std::cin, input))
+            {
+                std::cout << std::endl;
+                return false;
+            }
             std::transform(input.begin(), input.end(), input.begin(), ::tolower);
             if (input == "y" || input == "yes")
             {
@@ -33,51 +42,60 @@ namespace fsc_utilities
         }
     }
 
-    std::string ReadFile(std::filesystem::path path)
+    void StreamFile(const std::filesystem::path& path, std::ostream& output)
     {
-        std::ifstream file{ path };
+        FSC_TRACE_SCOPE("read");
+        std::ifstream file{ path, std::ios::binary };
         if (!file || !file.is_open())
         {
             throw std::runtime_error{ "Failed to read file \"" + path.string() + "\"." };
         }
 
-        std::ostringstream ss;
-        ss << file.rdbuf();
-        return ss.str();
+        std::array<char, 1 << 16> buffer;
+        while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0)
+        {
+            output.write(buffer.data(), file.gcount());
+            FSC_COUNT(BYTES, static_cast<std::uint64_t>(file.gcount()));
+        }
+        if (file.bad())
+        {
+            throw std::runtime_error{ "Failed to read file \"" + path.string() + "\"." };
+        }
     }
 
-    bool ValidateMove(std::filesystem::path target, std::filesystem::path destination, bool overwriteFlag, bool silentPromptFlag)
+    void ValidateDestination(const fsc_path::ResolvedPath& destination)
     {
-        if (!std::filesystem::exists(target))
+        if (!destination.Exists())
         {
-            throw std::runtime_error{ "Target does not exist." };
+            throw std::runtime_error{ "Destination does not exist." };
         }
-        target = std::filesystem::canonical(target);
 
-        if (!std::filesystem::exists(destination))
+        if (!destination.IsDirectory())
         {
-            throw std::runtime_error{ "Destination does not exist." };
+            throw std::runtime_error{ "Destination is not a directory." };
         }
-        destination = std::filesystem::canonical(destination);
+    }
 
-        if (target == destination)
+    std::optional<fsc_path::ResolvedPath> ValidateMoveTarget(const fsc_path::ResolvedPath& target, const fsc_path::ResolvedPath& destination, bool overwriteFlag, bool silentPromptFlag)
+    {
+        if (!target.Exists())
         {
-            throw std::runtime_error{ "Target and destination are the same path." };
+            throw std::runtime_error{ "Target does not exist." };
         }
 
-        if (!std::filesystem::is_directory(destination))
+        if (target.GetPath() == destination.GetPath())
         {
-            throw std::runtime_error{ "Destination is not a directory." };
+            throw std::runtime_error{ "Target and destination are the same path." };
         }
 
-        if (target.parent_path() == destination)
+        if (target.GetPath().parent_path() == destination.GetPath())
         {
             throw std::runtime_error{ "Target is already in destination." };
         }
 
-        std::string targetName{ target.filename().string() };
-        bool overwrite{ std::filesystem::exists(destination / targetName) };
-        if (overwrite)
+        const std::string& targetName{ target.GetName() };
+        fsc_path::ResolvedPath item{ destination.Child(targetName) };
+        if (item.Exists())
         {
             if (!overwriteFlag)
             {
@@ -85,13 +103,24 @@ namespace fsc_utilities
             }
             else if (!silentPromptFlag)
             {
-                if (!fsc_utilities::PromptConfirmation("Overwrite item? \"" + std::filesystem::canonical((destination / targetName)).string() + "\"."))
+                if (!fsc_utilities::PromptConfirmation("Overwrite item? \"" + item.GetPath().string() + "\"."))
                 {
-                    return false;
+                    return std::nullopt;
                 }
             }
         }
 
-        return true;
+        return item;
+    }
+
+    std::optional<fsc_path::ResolvedPath> ValidateMove(const fsc_path::ResolvedPath& target, const fsc_path::ResolvedPath& destination, bool overwriteFlag, bool silentPromptFlag)
+    {
+        FSC_TRACE_SCOPE("validate");
+        if (!target.Exists())
+        {
+            throw std::runtime_error{ "Target does not exist." };
+        }
+        ValidateDestination(destination);
+        return ValidateMoveTarget(target, destination, overwriteFlag, silentPromptFlag);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,508 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <chrono>
+#include <algorithm>
+#include <optional>
+#include <filesystem>
+#include <system_error>
+#include <stdexcept>
+#include <iostream>
+#include <cerrno>
+
+#include "watcher.hpp"
+#include "file_operations.hpp"
+#include "exclude_rules.hpp"
+#include "instrumentation.hpp"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+namespace fsc_watch
+{
+#if defined(__linux__)
+    namespace
+    {
+        constexpr std::uint32_t watchMask{ IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO
+            | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK };
+        constexpr int maxDelayWindows{ 10 };
+
+        std::error_code LastError() noexcept
+        {
+            return std::error_code{ errno, std::generic_category() };
+        }
+
+        // Paths are kept relative to the source root, the root itself is the empty path.
+        std::string Join(const std::string& directory, std::string_view name)
+        {
+            return directory.empty() ? std::string{ name } : directory + "/" + std::string{ name };
+        }
+
+        bool IsWithin(const std::string& path, const std::string& directory) noexcept
+        {
+            return directory.empty() || (path.starts_with(directory) && (path.size() == directory.size() || path[directory.size()] == '/'));
+        }
+
+        class Watcher
+        {
+        public:
+
+            Watcher(const fsc_path::ResolvedPath& sourcePath, const fsc_path::ResolvedPath& destinationDirectoryPath, const std::string& destinationItemName, const WatchOptions& watchOptions)
+                : source{ sourcePath }, destinationDirectory{ destinationDirectoryPath }, destinationName{ destinationItemName },
+                destinationRoot{ destinationDirectoryPath.GetPath() / destinationItemName }, options{ watchOptions }, rootScope{ fsc_exclude::Open(sourcePath) }
+            {
+                FSC_COUNT(SYSCALLS, 1);
+                inotify = fsc_path::FileDescriptor{ inotify_init1(IN_NONBLOCK | IN_CLOEXEC) };
+                if (!inotify.IsValid())
+                {
+                    throw std::filesystem::filesystem_error{ "Failed to start watching", source.GetPath(), LastError() };
+                }
+            }
+
+            void Run()
+            {
+                // Watches go up first so nothing changed during the initial sync is missed.
+                AddWatches("");
+                {
+                    FSC_TRACE_SCOPE("sync");
+                    fsc_operations::MirrorTree(source, destinationDirectory, destinationName, true, rootScope);
+                }
+                std::cout << "Synced \"" + source.GetPath().string() + "\" to \"" + destinationRoot.string() + "\", watching " << watches.size() << " directories." << std::endl;
+
+                while (true)
+                {
+                    Wait(std::chrono::milliseconds{ -1 });
+                    auto deadline{ std::chrono::steady_clock::now() + options.debounce * maxDelayWindows };
+                    for (auto now{ std::chrono::steady_clock::now() }; now < deadline; now = std::chrono::steady_clock::now())
+                    {
+                        if (!Wait(std::min(options.debounce, std::chrono::ceil<std::chrono::milliseconds>(deadline - now))))
+                        {
+                            break;
+                        }
+                    }
+                    Replay();
+                }
+            }
+
+        private:
+
+            // Returns whether any event arrived before the timeout, a negative timeout waits indefinitely.
+            bool Wait(std::chrono::milliseconds timeout)
+            {
+                pollfd descriptor{ inotify.Get(), POLLIN, 0 };
+                FSC_COUNT(SYSCALLS, 1);
+                int ready{ poll(&descriptor, 1, static_cast<int>(timeout.count())) };
+                if (ready < 0 && errno != EINTR)
+                {
+                    throw std::filesystem::filesystem_error{ "Failed to wait for changes", source.GetPath(), LastError() };
+                }
+                if (ready <= 0)
+                {
+                    return false;
+                }
+
+                while (true)
+                {
+                    FSC_COUNT(SYSCALLS, 1);
+                    ssize_t size{ read(inotify.Get(), buffer.data(), buffer.size()) };
+                    if (size < 0)
+                    {
+                        if (errno == EAGAIN || errno == EINTR)
+                        {
+                            return true;
+                        }
+                        throw std::filesystem::filesystem_error{ "Failed to read changes", source.GetPath(), LastError() };
+                    }
+                    for (std::size_t offset{ 0 }; offset < static_cast<std::size_t>(size);)
+                    {
+                        const inotify_event* event{ reinterpret_cast<const inotify_event*>(buffer.data() + offset) };
+                        Handle(*event);
+                        offset += sizeof(inotify_event) + event->len;
+                    }
+                }
+            }
+
+            void Handle(const inotify_event& event)
+            {
+                if (event.mask & IN_Q_OVERFLOW)
+                {
+                    overflowed = true;
+                    return;
+                }
+                auto watch{ watches.find(event.wd) };
+                if (watch == watches.end())
+                {
+                    return;
+                }
+                if (event.mask & IN_IGNORED)
+                {
+                    watches.erase(watch);
+                    return;
+                }
+                // Other directories report through their parent, only the root has no parent watched.
+                if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+                {
+                    if (watch->second.empty())
+                    {
+                        throw std::runtime_error{ "Target was removed or moved." };
+                    }
+                    return;
+                }
+
+                std::string path{ Join(watch->second, event.len > 0 ? event.name : "") };
+                bool directory{ (event.mask & IN_ISDIR) != 0 };
+                if (event.mask & IN_MOVED_FROM)
+                {
+                    movedFrom[event.cookie] = { path, directory };
+                    return;
+                }
+                if (event.mask & IN_MOVED_TO)
+                {
+                    auto from{ movedFrom.find(event.cookie) };
+                    if (from != movedFrom.end())
+                    {
+                        MoveChanges(from->second.first, path);
+                        if (directory)
+                        {
+                            for (auto& [descriptor, watchedPath] : watches)
+                            {
+                                if (IsWithin(watchedPath, from->second.first))
+                                {
+                                    watchedPath = path + watchedPath.substr(from->second.first.size());
+                                }
+                            }
+                        }
+                        renames.emplace_back(from->second.first, path);
+                        movedFrom.erase(from);
+                        return;
+                    }
+                }
+
+                if (directory && (event.mask & (IN_CREATE | IN_MOVED_TO)))
+                {
+                    AddWatches(path);
+                    changes[path] = true;
+                }
+                else if (!directory || (event.mask & IN_DELETE))
+                {
+                    changes.try_emplace(path, false);
+                }
+            }
+
+            // Changes recorded before a rename follow the renamed item, changes of an item it replaced are dropped.
+            void MoveChanges(const std::string& from, const std::string& to)
+            {
+                std::erase_if(changes, [&to](const auto& change) { return IsWithin(change.first, to); });
+                std::vector<std::pair<std::string, bool>> moved;
+                for (auto change{ changes.begin() }; change != changes.end();)
+                {
+                    if (IsWithin(change->first, from))
+                    {
+                        moved.emplace_back(to + change->first.substr(from.size()), change->second);
+                        change = changes.erase(change);
+                    }
+                    else
+                    {
+                        ++change;
+                    }
+                }
+                for (auto& [path, skipUnchanged] : moved)
+                {
+                    changes[std::move(path)] = skipUnchanged;
+                }
+            }
+
+            // The scope inside a directory, or no value when the directory or one of its parents is excluded.
+            std::optional<fsc_exclude::Scope> GetScope(const std::string& relativePath) const
+            {
+                fsc_exclude::Scope scope{ rootScope };
+                std::filesystem::path path{ source.GetPath() };
+                for (const std::filesystem::path& component : std::filesystem::path{ relativePath })
+                {
+                    if (scope.IsExcluded(component.string(), true))
+                    {
+                        return std::nullopt;
+                    }
+                    path /= component;
+                    scope = scope.Enter(path);
+                }
+                return scope;
+            }
+
+            bool IsExcluded(const std::string& relativePath, bool directory) const
+            {
+                std::filesystem::path path{ relativePath };
+                std::optional<fsc_exclude::Scope> scope{ GetScope(path.parent_path().string()) };
+                return !scope || scope->IsExcluded(path.filename().string(), directory);
+            }
+
+            void AddWatches(const std::string& relativePath)
+            {
+                std::optional<fsc_exclude::Scope> rootOfWatches{ GetScope(relativePath) };
+                if (!rootOfWatches)
+                {
+                    return;
+                }
+                std::vector<std::pair<std::string, fsc_exclude::Scope>> pending;
+                pending.emplace_back(relativePath, std::move(*rootOfWatches));
+                while (!pending.empty())
+                {
+                    auto [directory, scope]{ std::move(pending.back()) };
+                    pending.pop_back();
+                    std::filesystem::path path{ directory.empty() ? source.GetPath() : source.GetPath() / directory };
+                    FSC_COUNT(SYSCALLS, 1);
+                    int watch{ inotify_add_watch(inotify.Get(), path.c_str(), watchMask) };
+                    if (watch < 0)
+                    {
+                        // Removed again before it could be watched, its parent reports that.
+                        if (errno == ENOENT || errno == ENOTDIR)
+                        {
+                            continue;
+                        }
+                        if (errno == ENOSPC)
+                        {
+                            throw std::runtime_error{ "Out of inotify watches, raise fs.inotify.max_user_watches." };
+                        }
+                        throw std::filesystem::filesystem_error{ "Failed to watch directory", path, LastError() };
+                    }
+                    watches[watch] = directory;
+
+                    FSC_COUNT(SYSCALLS, 1);
+                    int descriptor{ open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) };
+                    DIR* stream{ descriptor >= 0 ? fdopendir(descriptor) : nullptr };
+                    if (stream == nullptr)
+                    {
+                        if (descriptor >= 0)
+                        {
+                            close(descriptor);
+                        }
+                        continue;
+                    }
+                    while (dirent* entry{ readdir(stream) })
+                    {
+                        std::string_view name{ entry->d_name };
+                        if (name == "." || name == "..")
+                        {
+                            continue;
+                        }
+                        bool isDirectory{ entry->d_type == DT_DIR };
+                        if (entry->d_type == DT_UNKNOWN)
+                        {
+                            std::optional<fsc_path::Metadata> metadata{ fsc_path::StatAt(dirfd(stream), entry->d_name, false) };
+                            isDirectory = metadata && metadata->type == fsc_path::FileType::DIRECTORY;
+                        }
+                        if (isDirectory && !scope.IsExcluded(name, true))
+                        {
+                            pending.emplace_back(Join(directory, name), scope.Enter(dirfd(stream), name));
+                        }
+                    }
+                    closedir(stream);
+                }
+            }
+
+            void RemoveWatches(const std::string& relativePath)
+            {
+                for (auto watch{ watches.begin() }; watch != watches.end();)
+                {
+                    if (IsWithin(watch->second, relativePath))
+                    {
+                        FSC_COUNT(SYSCALLS, 1);
+                        inotify_rm_watch(inotify.Get(), watch->first);
+                        watch = watches.erase(watch);
+                    }
+                    else
+                    {
+                        ++watch;
+                    }
+                }
+            }
+
+            fsc_path::ResolvedPath Resolve(const std::filesystem::path& root, const std::filesystem::path& relativePath) const
+            {
+                return fsc_path::ResolvedPath{ relativePath.empty() ? root : root / relativePath };
+            }
+
+            // Mirrors one changed entry. When its parent appeared or vanished since the event, the nearest ancestor present
+            // on both sides is compared instead.
+            void Mirror(const std::string& path, bool skipUnchanged)
+            {
+                std::filesystem::path relativePath{ path };
+                while (!relativePath.empty())
+                {
+                    fsc_path::ResolvedPath sourceParent{ Resolve(source.GetPath(), relativePath.parent_path()) };
+                    fsc_path::ResolvedPath destinationParent{ Resolve(destinationRoot, relativePath.parent_path()) };
+                    if (sourceParent.IsDirectory() && destinationParent.IsDirectory())
+                    {
+                        std::optional<fsc_exclude::Scope> scope{ GetScope(relativePath.parent_path().string()) };
+                        std::string name{ relativePath.filename().string() };
+                        fsc_path::ResolvedPath item{ sourceParent.Child(name) };
+                        // A removed item keeps its type in the destination, which decides whether a directory rule applies.
+                        bool directory{ item.Exists() ? item.IsDirectory() : destinationParent.Child(name).IsDirectory() };
+                        if (scope && !scope->IsExcluded(name, directory))
+                        {
+                            fsc_operations::MirrorTree(item, destinationParent, name, skipUnchanged, scope->Enter(item.GetPath()));
+                        }
+                        return;
+                    }
+                    relativePath = relativePath.parent_path();
+                    skipUnchanged = true;
+                }
+                fsc_operations::MirrorTree(source, destinationDirectory, destinationName, true, rootScope);
+            }
+
+            bool HasChangedAncestor(const std::string& path) const
+            {
+                for (std::size_t slash{ path.rfind('/') }; slash != std::string::npos && slash > 0; slash = path.rfind('/', slash - 1))
+                {
+                    if (changes.contains(path.substr(0, slash)))
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            void Report(const std::string& path, const std::exception& error) const
+            {
+                std::cerr << "\"" + (path.empty() ? source.GetPath() : source.GetPath() / path).string() + "\": " + error.what() << std::endl;
+            }
+
+            void Replay()
+            {
+                FSC_TRACE_SCOPE("replay");
+                if (overflowed)
+                {
+                    // Events were lost, so the watches are rebuilt and the whole tree is compared again.
+                    RemoveWatches("");
+                    movedFrom.clear();
+                    renames.clear();
+                    changes.clear();
+                    overflowed = false;
+                    try
+                    {
+                        AddWatches("");
+                        Mirror("", true);
+                    }
+                    catch (const std::filesystem::filesystem_error& error)
+                    {
+                        Report("", error);
+                    }
+                    std::cout << "Event queue overflowed, rescanned \"" + source.GetPath().string() + "\"." << std::endl;
+                    return;
+                }
+
+                // Moved out of the tree.
+                for (const auto& [cookie, moved] : movedFrom)
+                {
+                    if (moved.second)
+                    {
+                        RemoveWatches(moved.first);
+                    }
+                    changes.try_emplace(moved.first, false);
+                }
+                movedFrom.clear();
+
+                std::size_t renamed{ 0 };
+                for (const auto& [from, to] : renames)
+                {
+                    std::error_code error;
+                    try
+                    {
+                        // Renamed to an excluded name, its old copy is removed by mirroring the old path.
+                        if (IsExcluded(to, fsc_path::ResolvedPath{ source.GetPath() / to }.IsDirectory()))
+                        {
+                            changes.try_emplace(from, false);
+                            continue;
+                        }
+                        fsc_path::ResolvedPath fromPath{ destinationRoot / from };
+                        fsc_path::ResolvedPath toPath{ destinationRoot / to };
+                        if (fromPath.Exists())
+                        {
+                            fsc_operations::Rename(fromPath, toPath, error);
+                        }
+                        else
+                        {
+                            error = std::make_error_code(std::errc::no_such_file_or_directory);
+                        }
+                    }
+                    catch (const std::filesystem::filesystem_error& exception)
+                    {
+                        error = exception.code();
+                    }
+                    // Not in the destination yet, or its parent is not, both ends are mirrored instead.
+                    if (error)
+                    {
+                        changes.try_emplace(from, false);
+                        changes[to] = false;
+                        continue;
+                    }
+                    ++renamed;
+                }
+                renames.clear();
+
+                std::size_t replayed{ 0 };
+                for (const auto& [path, skipUnchanged] : changes)
+                {
+                    if (HasChangedAncestor(path))
+                    {
+                        continue;
+                    }
+                    try
+                    {
+                        Mirror(path, skipUnchanged);
+                        ++replayed;
+                    }
+                    catch (const std::filesystem::filesystem_error& error)
+                    {
+                        Report(path, error);
+                    }
+                }
+                changes.clear();
+                if (replayed > 0 || renamed > 0)
+                {
+                    std::cout << "Replayed " << replayed << " changes and " << renamed << " renames." << std::endl;
+                }
+            }
+
+            const fsc_path::ResolvedPath& source;
+            const fsc_path::ResolvedPath& destinationDirectory;
+            std::string destinationName;
+            std::filesystem::path destinationRoot;
+            WatchOptions options;
+            // Excluded directories are neither watched nor mirrored, ignore files are read as directories are entered.
+            fsc_exclude::Scope rootScope;
+            fsc_path::FileDescriptor inotify;
+            alignas(inotify_event) std::array<char, 64 << 10> buffer;
+            // Watch descriptor to the relative path of the directory.
+            std::unordered_map<int, std::string> watches;
+            // Cookie to the path and whether it is a directory, until the matching IN_MOVED_TO arrives.
+            std::unordered_map<std::uint32_t, std::pair<std::string, bool>> movedFrom;
+            std::vector<std::pair<std::string, std::string>> renames;
+            // Changed entries in path order, and whether unchanged files below them may be skipped.
+            std::map<std::string, bool> changes;
+            bool overflowed{ false };
+
+        };
+    }
+
+    void Watch(const fsc_path::ResolvedPath& source, const fsc_path::ResolvedPath& destinationDirectory, const std::string& destinationName, const WatchOptions& options)
+    {
+        Watcher watcher{ source, destinationDirectory, destinationName, options };
+        watcher.Run();
+    }
+#else
+    void Watch(const fsc_path::ResolvedPath&, const fsc_path::ResolvedPath&, const std::string&, const WatchOptions&)
+    {
+        throw std::runtime_error{ "Command \"watch\" is not supported on this platform." };
+    }
+#endif
+}
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Packs, unpacks, snapshots and restores trees of more entries than the default descriptor limit, with that limit set, so
+# a pipelined walk that keeps a descriptor per queued entry fails here. Usage: descriptor_limit.sh <fsc>
+set -eu
+
+if [ "$#" -ne 1 ]; then
+    echo "Usage: $0 <fsc>" >&2
+    exit 1
+fi
+
+FSC="$(realpath "$1")"
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT INT TERM
+
+ulimit -n 1024
+COUNT=3000
+
+# One file per directory, so every queued file lives in a different directory, and one wide directory.
+mkdir -p "$WORK/nested" "$WORK/flat"
+i=0
+while [ "$i" -lt "$COUNT" ]; do
+    mkdir "$WORK/nested/d$i"
+    echo "$i" > "$WORK/nested/d$i/f"
+    echo "$i" > "$WORK/flat/f$i"
+    i=$((i + 1))
+done
+
+fail()
+{
+    echo "descriptor_limit: $1" >&2
+    exit 1
+}
+
+for tree in nested flat; do
+    mkdir "$WORK/unpacked_$tree" "$WORK/restored_$tree"
+    (cd "$WORK" && "$FSC" pack "$tree") > "$WORK/$tree.tar" || fail "pack $tree failed"
+    (cd "$WORK/unpacked_$tree" && "$FSC" unpack . < "$WORK/$tree.tar") || fail "unpack $tree failed"
+    diff -r "$WORK/$tree" "$WORK/unpacked_$tree/$tree" || fail "unpacked $tree differs"
+
+    "$FSC" snapshot "$WORK/$tree" "$WORK/store_$tree" || fail "snapshot $tree failed"
+    "$FSC" restore "$WORK/store_$tree" "$WORK/restored_$tree" || fail "restore $tree failed"
+    diff -r "$WORK/$tree" "$WORK/restored_$tree/$tree" || fail "restored $tree differs"
+done
+
+echo "descriptor_limit: passed"